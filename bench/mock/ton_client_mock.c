@@ -0,0 +1,505 @@
+/* Offline stand-in for libton_client.
+ *
+ * Implements every symbol declared in tonclient.h without talking to any
+ * TON endpoint. Async requests are served by per-context worker threads
+ * which fire callbacks according to the load settings below, so that the
+ * extension's request/callback path can be benchmarked on any Linux box.
+ *
+ * Settings are resolved in this order (later wins):
+ *   1. built-in defaults;
+ *   2. TON_MOCK_* environment variables (e.g. TON_MOCK_CALLBACKS=100);
+ *   3. "mock_*" keys found in the config JSON passed to tc_create_context;
+ *   4. "mock_*" keys found in the params JSON of the particular request.
+ *
+ * Keys (environment variable names are the upper-cased equivalents):
+ *   mock_workers       worker threads per context (context-level only)
+ *   mock_callbacks     data callbacks fired per request
+ *   mock_payload_size  filler bytes added to every callback payload
+ *   mock_burst         callbacks fired back-to-back before pausing
+ *   mock_interval_us   pause between bursts, in microseconds
+ *   mock_delay_us      delay before the first callback, in microseconds
+ *   mock_status        response type of data callbacks (0 - success, 1 - error)
+ *   mock_finish        0 - the last data callback has finished=true;
+ *                      1 - data callbacks are followed by a finishing nop
+ *                          callback, like the SDK does for subscriptions;
+ *                      2 - never finish until the context is destroyed.
+ *
+ * Every callback payload looks like
+ *   {"seq":N,"request":R,"ts":T,"data":"xxx..."}
+ * where T is CLOCK_MONOTONIC time in nanoseconds taken right before the
+ * callback is fired. It matches PHP's hrtime(true), so consumers can compute
+ * delivery latency.
+ *
+ * tc_request_sync answers "client.version" with {"result":{"version":"mock"}}
+ * and "mock.echo" with {"result":<params JSON as is>}.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "../../deps/include/tonclient.h"
+
+#define MOCK_MAX_CONTEXTS 256
+#define MOCK_MAX_WORKERS 64
+
+#define MOCK_FINISH_LAST  0
+#define MOCK_FINISH_NOP   1
+#define MOCK_FINISH_NEVER 2
+
+typedef struct mock_settings {
+    long workers;
+    long callbacks;
+    long payload_size;
+    long burst;
+    long interval_us;
+    long delay_us;
+    long status;
+    long finish;
+} mock_settings_t;
+
+typedef struct mock_job {
+    struct mock_job *next;
+    mock_settings_t settings;
+    uint64_t request_no;
+    void *request_ptr;
+    tc_response_handler_ptr_t handler_ptr;
+    uint32_t request_id;
+    tc_response_handler_t handler;
+} mock_job_t;
+
+typedef struct mock_context {
+    uint32_t id;
+    mock_settings_t settings;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    mock_job_t *head;
+    mock_job_t *tail;
+    mock_job_t *parked;
+    volatile bool stopping;
+    int worker_count;
+    pthread_t workers[MOCK_MAX_WORKERS];
+} mock_context_t;
+
+struct tc_string_handle_t {
+    tc_string_data_t data;
+    char content[1];
+};
+
+static pthread_mutex_t contexts_mutex = PTHREAD_MUTEX_INITIALIZER;
+static mock_context_t *contexts[MOCK_MAX_CONTEXTS];
+static uint64_t next_request_no = 1;
+
+static uint64_t mock_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void mock_sleep_us(long us) {
+    if (us <= 0) {
+        return;
+    }
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+// Looks up a numeric value of "key" anywhere in the given JSON text.
+// Good enough for flat mock settings; doesn't try to be a JSON parser.
+static bool mock_json_long(const char *json, uint32_t len, const char *key, long *value) {
+    size_t key_len = strlen(key);
+    const char *end = json + len;
+    const char *p = json;
+    while (p + key_len + 2 < end) {
+        if (*p == '"' && memcmp(p + 1, key, key_len) == 0 && p[key_len + 1] == '"') {
+            const char *v = p + key_len + 2;
+            while (v < end && (isspace((unsigned char) *v) || *v == ':')) v++;
+            if (v < end && (*v == '-' || isdigit((unsigned char) *v))) {
+                char buf[32];
+                size_t n = 0;
+                while (v < end && n < sizeof(buf) - 1 && (*v == '-' || isdigit((unsigned char) *v))) {
+                    buf[n++] = *v++;
+                }
+                buf[n] = '\0';
+                *value = strtol(buf, NULL, 10);
+                return true;
+            }
+            if (end - v >= 4 && memcmp(v, "true", 4) == 0) {
+                *value = 1;
+                return true;
+            }
+            if (end - v >= 5 && memcmp(v, "false", 5) == 0) {
+                *value = 0;
+                return true;
+            }
+        }
+        p++;
+    }
+    return false;
+}
+
+#define MOCK_SETTINGS_APPLY(apply, s, src) \
+    apply(src, "mock_workers", "TON_MOCK_WORKERS", &(s)->workers); \
+    apply(src, "mock_callbacks", "TON_MOCK_CALLBACKS", &(s)->callbacks); \
+    apply(src, "mock_payload_size", "TON_MOCK_PAYLOAD_SIZE", &(s)->payload_size); \
+    apply(src, "mock_burst", "TON_MOCK_BURST", &(s)->burst); \
+    apply(src, "mock_interval_us", "TON_MOCK_INTERVAL_US", &(s)->interval_us); \
+    apply(src, "mock_delay_us", "TON_MOCK_DELAY_US", &(s)->delay_us); \
+    apply(src, "mock_status", "TON_MOCK_STATUS", &(s)->status); \
+    apply(src, "mock_finish", "TON_MOCK_FINISH", &(s)->finish)
+
+static void mock_apply_env(const void *unused, const char *key, const char *env, long *value) {
+    (void) unused;
+    (void) key;
+    const char *str = getenv(env);
+    if (str && *str) {
+        *value = strtol(str, NULL, 10);
+    }
+}
+
+static void mock_apply_json(const tc_string_data_t *json, const char *key, const char *env, long *value) {
+    (void) env;
+    if (json->content && json->len) {
+        mock_json_long(json->content, json->len, key, value);
+    }
+}
+
+static void mock_settings_sanitize(mock_settings_t *s) {
+    if (s->workers < 1) s->workers = 1;
+    if (s->workers > MOCK_MAX_WORKERS) s->workers = MOCK_MAX_WORKERS;
+    if (s->callbacks < 0) s->callbacks = 0;
+    if (s->payload_size < 0) s->payload_size = 0;
+    if (s->burst < 1) s->burst = 1;
+    if (s->interval_us < 0) s->interval_us = 0;
+    if (s->delay_us < 0) s->delay_us = 0;
+    if (s->finish < MOCK_FINISH_LAST || s->finish > MOCK_FINISH_NEVER) s->finish = MOCK_FINISH_LAST;
+}
+
+static void mock_settings_init(mock_settings_t *s, tc_string_data_t config) {
+    s->workers = 1;
+    s->callbacks = 1;
+    s->payload_size = 64;
+    s->burst = 1;
+    s->interval_us = 0;
+    s->delay_us = 0;
+    s->status = tc_response_success;
+    s->finish = MOCK_FINISH_LAST;
+    MOCK_SETTINGS_APPLY(mock_apply_env, s, NULL);
+    MOCK_SETTINGS_APPLY(mock_apply_json, s, &config);
+    mock_settings_sanitize(s);
+}
+
+static tc_string_handle_t *mock_string_create(const char *content, size_t len) {
+    tc_string_handle_t *handle = malloc(sizeof(tc_string_handle_t) + len);
+    memcpy(handle->content, content, len);
+    handle->content[len] = '\0';
+    handle->data.content = handle->content;
+    handle->data.len = (uint32_t) len;
+    return handle;
+}
+
+// Formats straight into the handle, sized by a first vsnprintf() pass (echo replies may be of any length).
+static tc_string_handle_t *mock_string_printf(const char *fmt, ...) {
+    va_list args, copy;
+    va_start(args, fmt);
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    if (len < 0) {
+        len = 0;
+    }
+    tc_string_handle_t *handle = malloc(sizeof(tc_string_handle_t) + (size_t) len);
+    vsnprintf(handle->content, (size_t) len + 1, fmt, args);
+    va_end(args);
+    handle->data.content = handle->content;
+    handle->data.len = (uint32_t) len;
+    return handle;
+}
+
+// Renders a callback payload into a reusable buffer and returns its length.
+static size_t mock_payload_render(char **buf, size_t *cap, const char *prefix, uint64_t seq, uint64_t request_no,
+                                  long payload_size, const char *suffix) {
+    size_t need = (size_t) payload_size + 128;
+    if (*cap < need) {
+        *buf = realloc(*buf, need);
+        *cap = need;
+    }
+    int head = snprintf(*buf, *cap, "%s{\"seq\":%llu,\"request\":%llu,\"ts\":%llu,\"data\":\"",
+                        prefix,
+                        (unsigned long long) seq,
+                        (unsigned long long) request_no,
+                        (unsigned long long) mock_now_ns());
+    size_t len = (size_t) head;
+    memset(*buf + len, 'x', (size_t) payload_size);
+    len += (size_t) payload_size;
+    len += (size_t) snprintf(*buf + len, *cap - len, "\"}%s", suffix);
+    return len;
+}
+
+static void mock_job_fire(mock_job_t *job, const char *json, size_t len, uint32_t status, bool finished) {
+    tc_string_data_t data = {json, (uint32_t) len};
+    if (job->handler_ptr) {
+        job->handler_ptr(job->request_ptr, data, status, finished);
+    } else if (job->handler) {
+        job->handler(job->request_id, data, status, finished);
+    }
+}
+
+static void mock_job_finish(mock_job_t *job) {
+    mock_job_fire(job, "", 0, tc_response_nop, true);
+    free(job);
+}
+
+static void mock_job_run(mock_context_t *ctx, mock_job_t *job, char **buf, size_t *cap) {
+    const mock_settings_t *s = &job->settings;
+    mock_sleep_us(s->delay_us);
+    long i;
+    for (i = 0; i < s->callbacks && !ctx->stopping; i++) {
+        bool last = i == s->callbacks - 1;
+        size_t len = mock_payload_render(buf, cap, "", (uint64_t) i, job->request_no, s->payload_size, "");
+        mock_job_fire(job, *buf, len, (uint32_t) s->status, last && s->finish == MOCK_FINISH_LAST);
+        if (!last && (i + 1) % s->burst == 0) {
+            mock_sleep_us(s->interval_us);
+        }
+    }
+    if (s->finish == MOCK_FINISH_NEVER && !ctx->stopping) {
+        pthread_mutex_lock(&ctx->mutex);
+        job->next = ctx->parked;
+        ctx->parked = job;
+        pthread_mutex_unlock(&ctx->mutex);
+        return;
+    }
+    if (s->finish != MOCK_FINISH_LAST || i < s->callbacks || s->callbacks == 0) {
+        mock_job_finish(job);
+    } else {
+        free(job);
+    }
+}
+
+static void *mock_worker(void *arg) {
+    mock_context_t *ctx = arg;
+    char *buf = NULL;
+    size_t cap = 0;
+    for (;;) {
+        pthread_mutex_lock(&ctx->mutex);
+        while (!ctx->head && !ctx->stopping) {
+            pthread_cond_wait(&ctx->cond, &ctx->mutex);
+        }
+        if (ctx->stopping) {
+            pthread_mutex_unlock(&ctx->mutex);
+            break;
+        }
+        mock_job_t *job = ctx->head;
+        ctx->head = job->next;
+        if (!ctx->head) {
+            ctx->tail = NULL;
+        }
+        pthread_mutex_unlock(&ctx->mutex);
+        mock_job_run(ctx, job, &buf, &cap);
+    }
+    free(buf);
+    return NULL;
+}
+
+static mock_context_t *mock_context_find(uint32_t id) {
+    mock_context_t *ctx = NULL;
+    pthread_mutex_lock(&contexts_mutex);
+    if (id > 0 && id <= MOCK_MAX_CONTEXTS) {
+        ctx = contexts[id - 1];
+    }
+    pthread_mutex_unlock(&contexts_mutex);
+    return ctx;
+}
+
+static void mock_context_enqueue(mock_context_t *ctx, mock_job_t *job) {
+    job->next = NULL;
+    job->request_no = __atomic_fetch_add(&next_request_no, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&ctx->mutex);
+    if (ctx->tail) {
+        ctx->tail->next = job;
+    } else {
+        ctx->head = job;
+    }
+    ctx->tail = job;
+    pthread_cond_signal(&ctx->cond);
+    pthread_mutex_unlock(&ctx->mutex);
+}
+
+static mock_job_t *mock_job_create(mock_context_t *ctx, tc_string_data_t params) {
+    mock_job_t *job = calloc(1, sizeof(mock_job_t));
+    job->settings = ctx->settings;
+    MOCK_SETTINGS_APPLY(mock_apply_json, &job->settings, &params);
+    mock_settings_sanitize(&job->settings);
+    return job;
+}
+
+tc_string_handle_t *tc_create_context(tc_string_data_t config) {
+    mock_context_t *ctx = calloc(1, sizeof(mock_context_t));
+    mock_settings_init(&ctx->settings, config);
+    pthread_mutex_init(&ctx->mutex, NULL);
+    pthread_cond_init(&ctx->cond, NULL);
+
+    pthread_mutex_lock(&contexts_mutex);
+    for (uint32_t i = 0; i < MOCK_MAX_CONTEXTS; i++) {
+        if (!contexts[i]) {
+            ctx->id = i + 1;
+            contexts[i] = ctx;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&contexts_mutex);
+
+    if (!ctx->id) {
+        pthread_cond_destroy(&ctx->cond);
+        pthread_mutex_destroy(&ctx->mutex);
+        free(ctx);
+        return mock_string_printf("{\"error\":{\"code\":1,\"message\":\"too many mock contexts\"}}");
+    }
+
+    for (long i = 0; i < ctx->settings.workers; i++) {
+        if (pthread_create(&ctx->workers[ctx->worker_count], NULL, mock_worker, ctx) == 0) {
+            ctx->worker_count++;
+        }
+    }
+
+    return mock_string_printf("{\"result\":%u}", ctx->id);
+}
+
+void tc_destroy_context(uint32_t context) {
+    mock_context_t *ctx = NULL;
+    pthread_mutex_lock(&contexts_mutex);
+    if (context > 0 && context <= MOCK_MAX_CONTEXTS) {
+        ctx = contexts[context - 1];
+        contexts[context - 1] = NULL;
+    }
+    pthread_mutex_unlock(&contexts_mutex);
+    if (!ctx) {
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->mutex);
+    ctx->stopping = true;
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->mutex);
+    for (int i = 0; i < ctx->worker_count; i++) {
+        pthread_join(ctx->workers[i], NULL);
+    }
+
+    // Requests which never started or never finish get their final callback here,
+    // so that consumers waiting for "finished" don't hang forever.
+    mock_job_t *job;
+    while ((job = ctx->head) != NULL) {
+        ctx->head = job->next;
+        mock_job_finish(job);
+    }
+    while ((job = ctx->parked) != NULL) {
+        ctx->parked = job->next;
+        mock_job_finish(job);
+    }
+
+    pthread_cond_destroy(&ctx->cond);
+    pthread_mutex_destroy(&ctx->mutex);
+    free(ctx);
+}
+
+static void mock_request_unknown_context(
+        uint32_t context, void *request_ptr, tc_response_handler_ptr_t handler_ptr,
+        uint32_t request_id, tc_response_handler_t handler) {
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf),
+                       "{\"code\":23,\"message\":\"Invalid context handle: %u\"}", context);
+    tc_string_data_t data = {buf, (uint32_t) len};
+    if (handler_ptr) {
+        handler_ptr(request_ptr, data, tc_response_error, true);
+    } else if (handler) {
+        handler(request_id, data, tc_response_error, true);
+    }
+}
+
+void tc_request(
+        uint32_t context,
+        tc_string_data_t function_name,
+        tc_string_data_t function_params_json,
+        uint32_t request_id,
+        tc_response_handler_t response_handler) {
+    (void) function_name;
+    mock_context_t *ctx = mock_context_find(context);
+    if (!ctx) {
+        mock_request_unknown_context(context, NULL, NULL, request_id, response_handler);
+        return;
+    }
+    mock_job_t *job = mock_job_create(ctx, function_params_json);
+    job->request_id = request_id;
+    job->handler = response_handler;
+    mock_context_enqueue(ctx, job);
+}
+
+void tc_request_ptr(
+        uint32_t context,
+        tc_string_data_t function_name,
+        tc_string_data_t function_params_json,
+        void *request_ptr,
+        tc_response_handler_ptr_t response_handler) {
+    (void) function_name;
+    mock_context_t *ctx = mock_context_find(context);
+    if (!ctx) {
+        mock_request_unknown_context(context, request_ptr, response_handler, 0, NULL);
+        return;
+    }
+    mock_job_t *job = mock_job_create(ctx, function_params_json);
+    job->request_ptr = request_ptr;
+    job->handler_ptr = response_handler;
+    mock_context_enqueue(ctx, job);
+}
+
+tc_string_handle_t *tc_request_sync(
+        uint32_t context,
+        tc_string_data_t function_name,
+        tc_string_data_t function_params_json) {
+    mock_context_t *ctx = mock_context_find(context);
+    if (!ctx) {
+        return mock_string_printf("{\"error\":{\"code\":23,\"message\":\"Invalid context handle: %u\"}}", context);
+    }
+    if (function_name.len == 14 && memcmp(function_name.content, "client.version", 14) == 0) {
+        return mock_string_printf("{\"result\":{\"version\":\"mock\"}}");
+    }
+    if (function_name.len == 9 && memcmp(function_name.content, "mock.echo", 9) == 0) {
+        return mock_string_printf("{\"result\":%.*s}", (int) function_params_json.len, function_params_json.content);
+    }
+
+    mock_settings_t s = ctx->settings;
+    MOCK_SETTINGS_APPLY(mock_apply_json, &s, &function_params_json);
+    mock_settings_sanitize(&s);
+    mock_sleep_us(s.delay_us);
+
+    if (s.status == tc_response_error) {
+        return mock_string_printf("{\"error\":{\"code\":1,\"message\":\"mock error\"}}");
+    }
+
+    char *buf = NULL;
+    size_t cap = 0;
+    uint64_t request_no = __atomic_fetch_add(&next_request_no, 1, __ATOMIC_RELAXED);
+    size_t len = mock_payload_render(&buf, &cap, "{\"result\":", 0, request_no, s.payload_size, "}");
+    tc_string_handle_t *handle = mock_string_create(buf, len);
+    free(buf);
+    return handle;
+}
+
+tc_string_data_t tc_read_string(const tc_string_handle_t *handle) {
+    if (!handle) {
+        tc_string_data_t empty = {"", 0};
+        return empty;
+    }
+    return handle->data;
+}
+
+void tc_destroy_string(const tc_string_handle_t *handle) {
+    free((void *) handle);
+}
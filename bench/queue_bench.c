@@ -0,0 +1,105 @@
+/*
+ * Microbenchmark of the rpa_queue implementations (rpa_queue.c and rpa_queue_spsc.c).
+ * Built once per implementation by bench/CMakeLists.txt:
+ *
+ *   queue_bench_mutex [items] [capacity] [producers] [batch]
+ *   queue_bench_spsc  [items] [capacity] [producers] [batch]
+ *
+ * Producer threads push items as fast as they can while the main thread pops them,
+ * one by one with rpa_queue_pop, or with rpa_queue_timedpopn if batch > 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "rpa_queue.h"
+
+typedef struct bench_producer {
+    pthread_t thread;
+    rpa_queue_t *queue;
+    uintptr_t items;
+} bench_producer_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void *produce(void *arg) {
+    bench_producer_t *p = arg;
+    for (uintptr_t i = 1; i <= p->items; i++) {
+        // push gives up after being woken up without a free slot
+        while (!rpa_queue_push(p->queue, (void *) i));
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    uint64_t items = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+    uint32_t capacity = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 1024;
+    uint32_t producers = argc > 3 ? (uint32_t) strtoul(argv[3], NULL, 10) : 1;
+    uint32_t batch = argc > 4 ? (uint32_t) strtoul(argv[4], NULL, 10) : 1;
+    if (producers == 0 || batch == 0 || capacity == 0) {
+        fprintf(stderr, "usage: %s [items] [capacity] [producers] [batch]\n", argv[0]);
+        return 1;
+    }
+
+    rpa_queue_t *queue;
+    if (!rpa_queue_create(&queue, capacity)) {
+        fprintf(stderr, "failed to create queue\n");
+        return 1;
+    }
+
+    bench_producer_t *p = calloc(producers, sizeof(bench_producer_t));
+    void **data = malloc(batch * sizeof(void *));
+    uint64_t total = (items / producers) * producers;
+    uint64_t popped = 0, checksum = 0, pops = 0;
+
+    uint64_t begin = now_ns();
+    for (uint32_t i = 0; i < producers; i++) {
+        p[i].queue = queue;
+        p[i].items = (uintptr_t) (items / producers);
+        pthread_create(&p[i].thread, NULL, produce, &p[i]);
+    }
+    while (popped < total) {
+        if (batch > 1) {
+            uint32_t n = rpa_queue_timedpopn(queue, data, NULL, batch, 1000, NULL, NULL);
+            for (uint32_t i = 0; i < n; i++) {
+                checksum += (uintptr_t) data[i];
+            }
+            popped += n;
+        } else if (rpa_queue_pop(queue, data)) {
+            checksum += (uintptr_t) data[0];
+            popped++;
+        }
+        pops++;
+    }
+    uint64_t elapsed = now_ns() - begin;
+    for (uint32_t i = 0; i < producers; i++) {
+        pthread_join(p[i].thread, NULL);
+    }
+
+    uint64_t per_producer = items / producers;
+    if (checksum != producers * (per_producer * (per_producer + 1) / 2)) {
+        fprintf(stderr, "checksum mismatch\n");
+        return 1;
+    }
+
+    printf("items           %llu\n", (unsigned long long) total);
+    printf("capacity        %u\n", capacity);
+    printf("producers       %u\n", producers);
+    printf("batch           %u\n", batch);
+    printf("pop_calls       %llu\n", (unsigned long long) pops);
+    printf("elapsed_ms      %.3f\n", elapsed / 1e6);
+    printf("ns_per_item     %.2f\n", (double) elapsed / (double) total);
+    printf("items_per_sec   %.0f\n", total / (elapsed / 1e9));
+
+    rpa_queue_term(queue);
+    rpa_queue_destroy(queue);
+    free(data);
+    free(p);
+    return 0;
+}
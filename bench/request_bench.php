@@ -0,0 +1,146 @@
+<?php
+/*
+ * End-to-end benchmark of the async request path (ton_request_start / ton_request_next).
+ *
+ * Intended to be run against the mock libton_client (see DEVELOPMENT.md, "Benchmarking"):
+ *
+ *   php -d extension=build/modules/ton_client.so bench/request_bench.php \
+ *       --requests=1000 --concurrency=100 --callbacks=10 --payload=256
+ *
+ * With --batch=N events are fetched by ton_request_next_batch (up to N at once,
+ * lingering up to --linger milliseconds) instead of ton_request_next.
+ *
+ * With --decode requests are started with 'decode' option, so events carry
+ * arrays decoded by the extension instead of JSON; without it, every event is
+ * decoded by json_decode as applications usually do.
+ *
+ * Every mock payload carries the CLOCK_MONOTONIC time it was fired at ("ts"),
+ * which is compared with hrtime() when the event is fetched by ton_request_next
+ * to get the delivery latency.
+ */
+
+$options = getopt('', [
+    'requests::', 'concurrency::', 'callbacks::', 'payload::',
+    'burst::', 'interval::', 'workers::', 'finish::', 'timeout::',
+    'batch::', 'linger::', 'decode', 'json',
+]);
+
+$requests = (int)($options['requests'] ?? 1000);
+$concurrency = max(1, (int)($options['concurrency'] ?? 100));
+$callbacks = (int)($options['callbacks'] ?? 10);
+$payload = (int)($options['payload'] ?? 256);
+$burst = (int)($options['burst'] ?? 1);
+$interval = (int)($options['interval'] ?? 0);
+$workers = (int)($options['workers'] ?? 1);
+$finish = (int)($options['finish'] ?? 0);
+$timeout = (int)($options['timeout'] ?? 10000);
+$batch = (int)($options['batch'] ?? 0);
+$linger = (int)($options['linger'] ?? 0);
+$decode = isset($options['decode']);
+
+if (!extension_loaded('ton_client')) {
+    fwrite(STDERR, "ton_client extension is not loaded\n");
+    exit(1);
+}
+
+$config = json_encode([
+    'mock_workers' => $workers,
+    'mock_callbacks' => $callbacks,
+    'mock_payload_size' => $payload,
+    'mock_burst' => $burst,
+    'mock_interval_us' => $interval,
+    'mock_finish' => $finish,
+]);
+$context = json_decode(ton_create_context($config), true)['result'];
+
+$version = json_decode(ton_request_sync($context, 'client.version', '{}'), true);
+if (($version['result']['version'] ?? null) !== 'mock') {
+    fwrite(STDERR, "WARNING: not running against the mock TON client library\n");
+}
+
+$latencies = [];
+$events = 0;
+$bytes = 0;
+$timeouts = 0;
+$started = 0;
+$finished = 0;
+$active = [];
+
+$begin = hrtime(true);
+while ($finished < $requests) {
+    while ($started < $requests && count($active) < $concurrency) {
+        $active[] = ton_request_start($context, 'mock.run', '{}', null, ['decode' => $decode]);
+        $started++;
+    }
+    foreach ($active as $key => $request) {
+        if ($batch > 0) {
+            $batchEvents = ton_request_next_batch($request, $batch, $linger);
+            if (!$batchEvents) {
+                $batchEvents = [ton_request_next($request, $timeout)];
+            }
+        } else {
+            $batchEvents = [ton_request_next($request, $timeout)];
+        }
+        foreach ($batchEvents as $event) {
+            if ($event === null) {
+                $timeouts++;
+                unset($active[$key]);
+                $finished++;
+                continue 2;
+            }
+            [$json, $status, $done] = $event;
+            $now = hrtime(true);
+            $events++;
+            if (!$decode) {
+                $json = $json !== '' ? json_decode($json, true) : null;
+            }
+            if (isset($json['ts'])) {
+                $latencies[] = $now - $json['ts'];
+                $bytes += strlen($json['data']);
+            }
+            if ($done) {
+                unset($active[$key]);
+                $finished++;
+            }
+        }
+    }
+}
+$elapsed = hrtime(true) - $begin;
+
+ton_destroy_context($context);
+
+sort($latencies);
+$percentile = function (float $p) use ($latencies): float {
+    if (!$latencies) {
+        return 0.0;
+    }
+    $index = (int)min(count($latencies) - 1, floor($p * count($latencies)));
+    return $latencies[$index] / 1000.0;
+};
+
+$result = [
+    'requests' => $requests,
+    'concurrency' => $concurrency,
+    'callbacks_per_request' => $callbacks,
+    'payload_size' => $payload,
+    'batch' => $batch,
+    'decode' => (int)$decode,
+    'events' => $events,
+    'timeouts' => $timeouts,
+    'elapsed_ms' => round($elapsed / 1e6, 3),
+    'events_per_sec' => $elapsed ? round($events / ($elapsed / 1e9)) : 0,
+    'mb_per_sec' => $elapsed ? round($bytes / 1048576 / ($elapsed / 1e9), 2) : 0,
+    'latency_us_p50' => round($percentile(0.50), 1),
+    'latency_us_p90' => round($percentile(0.90), 1),
+    'latency_us_p99' => round($percentile(0.99), 1),
+    'latency_us_max' => round($percentile(1.0), 1),
+    'peak_memory_kb' => intdiv(memory_get_peak_usage(), 1024),
+];
+
+if (isset($options['json'])) {
+    echo json_encode($result, JSON_PRETTY_PRINT), PHP_EOL;
+} else {
+    foreach ($result as $name => $value) {
+        printf("%-22s %s\n", $name, $value);
+    }
+}
@@ -7,17 +7,32 @@ function usage() {
 Usage: build.sh [args] [/path/to/sdk/installation/directory]
 Args:
     -d      Enable debug output.
+    -m      Build against the mock TON client library from bench/mock instead of the TON SDK.
+    -q      Use the lock-free single-producer/single-consumer callback queue.
+    -u      Compile in USDT probes (requires sys/sdt.h).
     -h      Show this help.
 EOT
 }
 
 ENABLE_DEBUG=0
+USE_MOCK=0
+SPSC_QUEUE=0
+USDT_PROBES=0
 
-while getopts ":dh" opt; do
+while getopts ":dmquh" opt; do
   case ${opt} in
     d )
       ENABLE_DEBUG=1
       ;;
+    m )
+      USE_MOCK=1
+      ;;
+    q )
+      SPSC_QUEUE=1
+      ;;
+    u )
+      USDT_PROBES=1
+      ;;
     h )
       usage
       exit 0
@@ -38,14 +53,29 @@ if [ "$#" -ne 0 ]; then
   SDK_INSTALL_DIR=$1
 fi
 
+rm -rf ${BUILD_DIR}
+mkdir -p ${BUILD_DIR}
+
+if [ "${USE_MOCK}" -ne 0 ]; then
+  SDK_INSTALL_DIR=${BUILD_DIR}/mock/install
+  cmake -S ${SRC_DIR}/bench -B ${BUILD_DIR}/mock -DCMAKE_INSTALL_PREFIX=${SDK_INSTALL_DIR}
+  cmake --build ${BUILD_DIR}/mock
+  cmake --install ${BUILD_DIR}/mock
+fi
+
 CONFIGURE_OPTIONS=--with-ton_client=${SDK_INSTALL_DIR}
 if [ "${ENABLE_DEBUG}" -ne 0 ]; then
   CONFIGURE_OPTIONS="${CONFIGURE_OPTIONS} --enable-ton_client_debug"
 fi
+if [ "${SPSC_QUEUE}" -ne 0 ]; then
+  CONFIGURE_OPTIONS="${CONFIGURE_OPTIONS} --enable-ton_client_spsc_queue"
+fi
+if [ "${USDT_PROBES}" -ne 0 ]; then
+  CONFIGURE_OPTIONS="${CONFIGURE_OPTIONS} --enable-ton_client_usdt"
+fi
 
-rm -rf ${BUILD_DIR}
-mkdir -p ${BUILD_DIR}
 cp -r ${SRC_DIR}/src/* ${BUILD_DIR}
+cp -r ${SRC_DIR}/tests ${BUILD_DIR}
 
 cd ${BUILD_DIR}
 phpize
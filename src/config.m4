@@ -10,6 +10,20 @@ PHP_ARG_ENABLE([ton_client_debug],
    [no],
    [no])
 
+PHP_ARG_ENABLE([ton_client_spsc_queue],
+   [whether to use the lock-free callback queue for ton_client],
+   [AS_HELP_STRING([--enable-ton_client_spsc_queue],
+     [Use lock-free single-producer/single-consumer callback queue (rpa_queue_spsc.c) for ton_client])],
+   [no],
+   [no])
+
+PHP_ARG_ENABLE([ton_client_usdt],
+   [whether to compile in USDT probes for ton_client],
+   [AS_HELP_STRING([--enable-ton_client_usdt],
+     [Compile in SystemTap/DTrace compatible static probes (ton_probes.h) for ton_client; requires sys/sdt.h])],
+   [no],
+   [no])
+
 if test "$PHP_TON_CLIENT" != "no"; then
 
   if test -r $PHP_TON_CLIENT/include/tonclient.h; then
@@ -45,5 +59,21 @@ if test "$PHP_TON_CLIENT" != "no"; then
     -L$TON_CLIENT_DIR/$PHP_LIBDIR
   ])
 
-  PHP_NEW_EXTENSION(ton_client, ton_client.c rpa_queue.c, $ext_shared)
+  if test "$PHP_TON_CLIENT_SPSC_QUEUE" == "yes"; then
+    TON_CLIENT_QUEUE_SOURCE=rpa_queue_spsc.c
+  else
+    TON_CLIENT_QUEUE_SOURCE=rpa_queue.c
+  fi
+
+  dnl Passed as a compiler flag rather than via config.h, which is not included by the queue sources
+  TON_CLIENT_CFLAGS=
+  if test "$PHP_TON_CLIENT_USDT" == "yes"; then
+    AC_CHECK_HEADER([sys/sdt.h], [
+      TON_CLIENT_CFLAGS=-DHAVE_TON_CLIENT_USDT=1
+    ], [
+      AC_MSG_ERROR([sys/sdt.h not found; install systemtap-sdt-dev(el)])
+    ])
+  fi
+
+  PHP_NEW_EXTENSION(ton_client, ton_client.c $TON_CLIENT_QUEUE_SOURCE rpa_queue_time.c ton_notifier.c ton_pool.c ton_json.c ton_shm_cache.c ton_broadcast.c ton_stats.c ton_trace.c, $ext_shared,, $TON_CLIENT_CFLAGS)
 fi
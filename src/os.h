@@ -7,3 +7,9 @@
 #elif defined(__APPLE__)
 #define TON_APPLE
 #endif
+
+#if defined(_MSC_VER)
+#define TON_THREAD_LOCAL __declspec(thread)
+#else
+#define TON_THREAD_LOCAL __thread
+#endif
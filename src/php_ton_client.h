@@ -8,6 +8,29 @@ extern zend_module_entry ton_client_module_entry;
 
 # define PHP_TON_CLIENT_VERSION "1.38.0"
 
+# include "zend_smart_str_public.h"
+
+ZEND_BEGIN_MODULE_GLOBALS(ton_client)
+    smart_str params_buffer; /* params passed as arrays are encoded here, see ton_params_json */
+    struct ton_await_waiter *await_waiters; /* fibers suspended by ton_await */
+    uint32_t await_count;
+    uint32_t await_capacity;
+    HashTable persistent_contexts; /* contexts kept across requests, by config JSON, see ton_create_context */
+    HashTable result_cache; /* ton_request_sync responses, see ton_result_cache_get */
+    struct ton_result_cache_entry *result_cache_head; /* most recently used */
+    struct ton_result_cache_entry *result_cache_tail; /* least recently used, evicted first */
+    size_t result_cache_size;
+    uint64_t result_cache_hits;
+    uint64_t result_cache_misses;
+    uint64_t result_cache_evictions;
+    HashTable context_configs; /* hashes of the configs by context ID, see ton_cache_key */
+    HashTable single_flights; /* single-flight requests in flight, see ton_request_flight_lead */
+ZEND_END_MODULE_GLOBALS(ton_client)
+
+ZEND_EXTERN_MODULE_GLOBALS(ton_client)
+
+# define TON_CLIENT_G(v) ZEND_MODULE_GLOBALS_ACCESSOR(ton_client, v)
+
 # if defined(ZTS) && defined(COMPILE_DL_TON_CLIENT)
 ZEND_TSRMLS_CACHE_EXTERN()
 # endif
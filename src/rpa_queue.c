@@ -22,34 +22,39 @@
 #include <assert.h>
 #include "os.h"
 #include "debug.h"
+#include "ton_stats.h"
+#include "ton_probes.h"
 
-#ifdef TON_APPLE
-#include <sys/time.h>
-#ifdef __MACH__
-#include <mach/clock.h>
-#include <mach/mach.h>
-#endif
-#else
-
-#include <time.h>
-
+#ifndef TON_WINDOWS
+#include <unistd.h>
 #endif
 
 // uncomment to print debug messages
 //#define QUEUE_DEBUG
 
+// flag of the gap of the object pushed by rpa_queue_push_final, which is never evicted
+#define RPA_GAP_PINNED 0x80000000u
+
 struct rpa_queue_t {
   void **data;
+  uint32_t *gaps; /**< # objects dropped right before each one */
   volatile uint32_t nelts; /**< # elements */
   uint32_t in;  /**< next empty location */
   uint32_t out;   /**< next filled location */
   uint32_t bounds;/**< max size of queue */
+  uint32_t initial_bounds; /**< bounds the queue was created with */
+  uint32_t max_bounds; /**< max size RPA_OVERFLOW_GROW can reach */
+  uint32_t pending_gap; /**< # objects dropped since the last push */
+  rpa_queue_overflow_t overflow_policy;
+  int overflow_wait_ms;
   uint32_t full_waiters;
   uint32_t empty_waiters;
   pthread_mutex_t *one_big_mutex;
   pthread_cond_t *not_empty;
   pthread_cond_t *not_full;
   int terminated;
+  int notify_read_fd;  /**< readable while the queue is not empty */
+  int notify_write_fd;
 };
 
 #ifdef QUEUE_DEBUG
@@ -75,37 +80,86 @@ static void Q_DBG(const char*msg, rpa_queue_t *q) {
  */
 #define rpa_queue_empty(queue) ((queue)->nelts == 0)
 
-struct timespec get_current_timespec() {
-    struct timespec now;
-#if defined(TON_APPLE)
-    #ifdef __MACH__ // OS X does not have clock_gettime, use clock_get_time
-    clock_serv_t cclock;
-    mach_timespec_t mts;
-    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-    clock_get_time(cclock, &mts);
-    mach_port_deallocate(mach_task_self(), cclock);
-    now.tv_sec = mts.tv_sec;
-    now.tv_nsec = mts.tv_nsec;
-#else
-    int result = gettimeofday(&now, NULL);
-    assert(result == 0);
+/**
+ * Signals the notification descriptor when the first element is pushed into
+ * the empty queue. Expected to be called from within critical sections.
+ */
+static void rpa_queue_notify_not_empty(rpa_queue_t *queue)
+{
+#ifndef TON_WINDOWS
+  if (queue->notify_write_fd >= 0 && queue->nelts == 1) {
+    uint64_t one = 1;
+    ssize_t rv = write(queue->notify_write_fd, &one, sizeof(one));
+    (void) rv; /* may only fail if it's already readable */
+  }
 #endif
-#else
-    int result = timespec_get(&now, TIME_UTC);
-    assert(result != 0);
+}
+
+/**
+ * Drains the notification descriptor when the last element is popped from
+ * the queue. Expected to be called from within critical sections.
+ */
+static void rpa_queue_notify_empty(rpa_queue_t *queue)
+{
+#ifndef TON_WINDOWS
+  if (queue->notify_read_fd >= 0 && queue->nelts == 0) {
+    char buf[64];
+    while (read(queue->notify_read_fd, buf, sizeof(buf)) > 0);
+  }
 #endif
-    return now;
 }
 
-struct timespec get_future_timespec(int ms) {
-    struct timespec now = get_current_timespec(), due;
-    due.tv_sec = now.tv_sec + ms / 1000;
-    due.tv_nsec = now.tv_nsec + (ms % 1000) * 1000000;
-    if (due.tv_nsec >= 1000000000) {
-        due.tv_nsec -= 1000000000;
-        due.tv_sec++;
-    }
-    return due;
+/**
+ * Puts the object to the tail of the queue, which must not be full, along with
+ * the number of objects dropped before it. Expected to be called from within
+ * critical sections.
+ */
+static void rpa_queue_put(rpa_queue_t *queue, void *data, bool pinned)
+{
+  queue->data[queue->in] = data;
+  queue->gaps[queue->in] = queue->pending_gap | (pinned ? RPA_GAP_PINNED : 0);
+  queue->pending_gap = 0;
+  queue->in++;
+  if (queue->in >= queue->bounds) {
+    queue->in -= queue->bounds;
+  }
+  queue->nelts++;
+  rpa_queue_notify_not_empty(queue);
+}
+
+/**
+ * Takes the object from the head of the queue, which must not be empty.
+ * Expected to be called from within critical sections.
+ */
+static void rpa_queue_take(rpa_queue_t *queue, void **data, uint32_t *gap)
+{
+  *data = queue->data[queue->out];
+  if (gap) {
+    *gap = queue->gaps[queue->out] & ~RPA_GAP_PINNED;
+  }
+  queue->nelts--;
+  rpa_queue_notify_empty(queue);
+
+  queue->out++;
+  if (queue->out >= queue->bounds) {
+    queue->out -= queue->bounds;
+  }
+}
+
+/**
+ * Closes the notification descriptors of the queue, if any.
+ */
+static void rpa_queue_close_notify_fd(rpa_queue_t *queue)
+{
+#ifndef TON_WINDOWS
+  if (queue->notify_read_fd >= 0) {
+    close(queue->notify_read_fd);
+  }
+  if (queue->notify_write_fd >= 0 && queue->notify_write_fd != queue->notify_read_fd) {
+    close(queue->notify_write_fd);
+  }
+#endif
+  queue->notify_read_fd = queue->notify_write_fd = -1;
 }
 
 /**
@@ -118,6 +172,46 @@ void rpa_queue_destroy(rpa_queue_t * queue)
   pthread_cond_destroy(queue->not_empty);
   pthread_cond_destroy(queue->not_full);
   pthread_mutex_destroy(queue->one_big_mutex);
+  rpa_queue_close_notify_fd(queue);
+  free(queue->not_empty);
+  free(queue->not_full);
+  free(queue->one_big_mutex);
+  free(queue->data);
+  free(queue->gaps);
+  free(queue);
+}
+
+bool rpa_queue_reset(rpa_queue_t *queue)
+{
+  if (pthread_mutex_lock(queue->one_big_mutex) != 0) {
+    return false;
+  }
+  if (!rpa_queue_empty(queue) || queue->full_waiters || queue->empty_waiters) {
+    pthread_mutex_unlock(queue->one_big_mutex);
+    return false;
+  }
+  if (queue->bounds != queue->initial_bounds) {
+    /* shrink back after RPA_OVERFLOW_GROW; the data is gone anyway */
+    void **data = realloc(queue->data, queue->initial_bounds * sizeof(void*));
+    uint32_t *gaps = realloc(queue->gaps, queue->initial_bounds * sizeof(uint32_t));
+    if (data) {
+      queue->data = data;
+    }
+    if (gaps) {
+      queue->gaps = gaps;
+    }
+    queue->bounds = queue->initial_bounds;
+  }
+  queue->in = 0;
+  queue->out = 0;
+  queue->terminated = 0;
+  queue->pending_gap = 0;
+  queue->overflow_policy = RPA_OVERFLOW_BLOCK;
+  queue->overflow_wait_ms = RPA_WAIT_FOREVER;
+  queue->max_bounds = queue->initial_bounds;
+  rpa_queue_close_notify_fd(queue);
+  pthread_mutex_unlock(queue->one_big_mutex);
+  return true;
 }
 
 /**
@@ -160,13 +254,21 @@ bool rpa_queue_create(rpa_queue_t **q, uint32_t queue_capacity)
 
   /* Set all the data in the queue to NULL */
   queue->data = malloc(queue_capacity * sizeof(void*));
+  queue->gaps = malloc(queue_capacity * sizeof(uint32_t));
   queue->bounds = queue_capacity;
+  queue->initial_bounds = queue_capacity;
+  queue->max_bounds = queue_capacity;
+  queue->pending_gap = 0;
+  queue->overflow_policy = RPA_OVERFLOW_BLOCK;
+  queue->overflow_wait_ms = RPA_WAIT_FOREVER;
   queue->nelts = 0;
   queue->in = 0;
   queue->out = 0;
   queue->terminated = 0;
   queue->full_waiters = 0;
   queue->empty_waiters = 0;
+  queue->notify_read_fd = -1;
+  queue->notify_write_fd = -1;
 
   return true;
 
@@ -232,12 +334,7 @@ bool rpa_queue_timedpush(rpa_queue_t *queue, void *data, int wait_ms)
     }
   }
 
-  queue->data[queue->in] = data;
-  queue->in++;
-  if (queue->in >= queue->bounds) {
-    queue->in -= queue->bounds;
-  }
-  queue->nelts++;
+  rpa_queue_put(queue, data, false);
 
   if (queue->empty_waiters) {
     Q_DBG("sig !empty", queue);
@@ -275,12 +372,7 @@ bool rpa_queue_trypush(rpa_queue_t *queue, void *data)
     return false; //EAGAIN;
   }
 
-  queue->data[queue->in] = data;
-  queue->in++;
-  if (queue->in >= queue->bounds) {
-    queue->in -= queue->bounds;
-  }
-  queue->nelts++;
+  rpa_queue_put(queue, data, false);
 
   if (queue->empty_waiters) {
     Q_DBG("sig !empty", queue);
@@ -295,6 +387,226 @@ bool rpa_queue_trypush(rpa_queue_t *queue, void *data)
   return true;
 }
 
+bool rpa_queue_set_overflow(rpa_queue_t *queue, rpa_queue_overflow_t policy, int wait_ms, uint32_t max_capacity)
+{
+  if (pthread_mutex_lock(queue->one_big_mutex) != 0) {
+    return false;
+  }
+  queue->overflow_policy = policy;
+  queue->overflow_wait_ms = wait_ms;
+  queue->max_bounds = max_capacity > queue->bounds ? max_capacity : queue->bounds;
+  pthread_mutex_unlock(queue->one_big_mutex);
+  return true;
+}
+
+/**
+ * Grows the capacity of the queue to the given bounds. Expected to be
+ * called from within critical sections.
+ */
+static bool rpa_queue_resize(rpa_queue_t *queue, uint32_t bounds)
+{
+  void **data = malloc(bounds * sizeof(void*));
+  uint32_t *gaps = malloc(bounds * sizeof(uint32_t));
+  if (!data || !gaps) {
+    free(data);
+    free(gaps);
+    return false;
+  }
+  /* unwrap the ring, so the objects start at 0 */
+  uint32_t first = queue->bounds - queue->out;
+  if (first > queue->nelts) {
+    first = queue->nelts;
+  }
+  memcpy(data, queue->data + queue->out, first * sizeof(void*));
+  memcpy(data + first, queue->data, (queue->nelts - first) * sizeof(void*));
+  memcpy(gaps, queue->gaps + queue->out, first * sizeof(uint32_t));
+  memcpy(gaps + first, queue->gaps, (queue->nelts - first) * sizeof(uint32_t));
+  free(queue->data);
+  free(queue->gaps);
+  queue->data = data;
+  queue->gaps = gaps;
+  queue->out = 0;
+  queue->in = queue->nelts;
+  queue->bounds = bounds;
+  Q_DBG("grown", queue);
+  if (queue->full_waiters) {
+    pthread_cond_broadcast(queue->not_full);
+  }
+  return true;
+}
+
+/**
+ * Doubles the capacity of the queue, up to max_bounds. Expected to be
+ * called from within critical sections.
+ */
+static bool rpa_queue_grow(rpa_queue_t *queue)
+{
+  uint32_t bounds = queue->bounds > queue->max_bounds / 2 ? queue->max_bounds : queue->bounds * 2;
+  return bounds > queue->bounds && rpa_queue_resize(queue, bounds);
+}
+
+/**
+ * Evicts the oldest object which is not pinned (see rpa_queue_push_final) to free
+ * the slot at the head; the object following it inherits its gap. Expected to be
+ * called from within critical sections.
+ * @returns false if all the objects are pinned
+ */
+static bool rpa_queue_evict(rpa_queue_t *queue, void **evicted)
+{
+  uint32_t pos = queue->out, skipped = 0;
+  while (queue->gaps[pos] & RPA_GAP_PINNED) {
+    if (++skipped == queue->nelts) {
+      return false;
+    }
+    pos = pos + 1 < queue->bounds ? pos + 1 : 0;
+  }
+  uint32_t gap = queue->gaps[pos];
+  uint32_t next = pos + 1 < queue->bounds ? pos + 1 : 0;
+  bool last = skipped + 1 == queue->nelts;
+  *evicted = queue->data[pos];
+  /* pinned objects before it move one slot towards the tail */
+  for (; skipped > 0; skipped--) {
+    uint32_t prev = pos > 0 ? pos - 1 : queue->bounds - 1;
+    queue->data[pos] = queue->data[prev];
+    queue->gaps[pos] = queue->gaps[prev];
+    pos = prev;
+  }
+  queue->nelts--;
+  queue->out = queue->out + 1 < queue->bounds ? queue->out + 1 : 0;
+  if (last) {
+    queue->pending_gap += gap + 1;
+  } else {
+    queue->gaps[next] += gap + 1;
+  }
+  rpa_queue_notify_empty(queue);
+  return true;
+}
+
+rpa_queue_push_result_t rpa_queue_push_ex(rpa_queue_t *queue, void *data, void **evicted)
+{
+  rpa_queue_push_result_t result = RPA_PUSH_OK;
+
+  if (queue->terminated) {
+    return RPA_PUSH_FAILED; /* no more elements ever again */
+  }
+
+  if (pthread_mutex_lock(queue->one_big_mutex) != 0) {
+    return RPA_PUSH_FAILED;
+  }
+
+  if (rpa_queue_full(queue)) {
+    switch (queue->overflow_policy) {
+      case RPA_OVERFLOW_DROP_NEWEST:
+        queue->pending_gap++;
+        pthread_mutex_unlock(queue->one_big_mutex);
+        return RPA_PUSH_DROPPED;
+
+      case RPA_OVERFLOW_DROP_OLDEST:
+        if (rpa_queue_evict(queue, evicted)) {
+          result = RPA_PUSH_EVICTED;
+          break;
+        }
+        /* nothing but pinned objects to evict */
+        queue->pending_gap++;
+        pthread_mutex_unlock(queue->one_big_mutex);
+        return RPA_PUSH_DROPPED;
+
+      case RPA_OVERFLOW_GROW:
+        if (rpa_queue_grow(queue)) {
+          result = RPA_PUSH_GROWN;
+          break;
+        }
+        /* fall through - can't grow anymore, so block */
+
+      case RPA_OVERFLOW_BLOCK:
+      default: {
+        struct timespec abstime;
+        uint64_t wait_start = 0;
+        if (queue->overflow_wait_ms > 0) {
+          abstime = get_future_timespec(queue->overflow_wait_ms);
+        }
+        if (queue->overflow_wait_ms != RPA_WAIT_NONE) {
+          wait_start = ton_stats_now_ns();
+          ton_stats_add(TON_STAT_PUSH_WAITS, 1);
+          TON_PROBE_QUEUE_FULL(queue);
+        }
+        while (rpa_queue_full(queue) && !queue->terminated && queue->overflow_wait_ms != RPA_WAIT_NONE) {
+          int rv;
+          queue->full_waiters++;
+          if (queue->overflow_wait_ms == RPA_WAIT_FOREVER) {
+            rv = pthread_cond_wait(queue->not_full, queue->one_big_mutex);
+          } else {
+            rv = pthread_cond_timedwait(queue->not_full, queue->one_big_mutex, &abstime);
+          }
+          queue->full_waiters--;
+          if (rv != 0) {
+            break;
+          }
+        }
+        if (wait_start) {
+          uint64_t wait_ns = ton_stats_now_ns() - wait_start;
+          ton_stats_add(TON_STAT_PUSH_WAIT_NS, wait_ns);
+          TON_PROBE_QUEUE_UNBLOCKED(queue, wait_ns);
+        }
+        if (queue->terminated) {
+          pthread_mutex_unlock(queue->one_big_mutex);
+          return RPA_PUSH_FAILED;
+        }
+        if (rpa_queue_full(queue)) {
+          queue->pending_gap++;
+          pthread_mutex_unlock(queue->one_big_mutex);
+          return RPA_PUSH_TIMEOUT;
+        }
+        result = RPA_PUSH_WAITED;
+        break;
+      }
+    }
+  }
+
+  rpa_queue_put(queue, data, false);
+  if (queue->empty_waiters) {
+    Q_DBG("sig !empty", queue);
+    pthread_cond_signal(queue->not_empty);
+  }
+
+  pthread_mutex_unlock(queue->one_big_mutex);
+  return result;
+}
+
+rpa_queue_push_result_t rpa_queue_push_final(rpa_queue_t *queue, void *data, void **evicted)
+{
+  rpa_queue_push_result_t result = RPA_PUSH_OK;
+
+  if (queue->terminated) {
+    return RPA_PUSH_FAILED; /* no more elements ever again */
+  }
+
+  if (pthread_mutex_lock(queue->one_big_mutex) != 0) {
+    return RPA_PUSH_FAILED;
+  }
+
+  /* one slot past max_bounds if nothing can be evicted; the queue shrinks back on reset */
+  if (rpa_queue_full(queue)) {
+    if (queue->overflow_policy == RPA_OVERFLOW_DROP_OLDEST && rpa_queue_evict(queue, evicted)) {
+      result = RPA_PUSH_EVICTED;
+    } else if (rpa_queue_resize(queue, queue->bounds + 1)) {
+      result = RPA_PUSH_GROWN;
+    } else {
+      pthread_mutex_unlock(queue->one_big_mutex);
+      return RPA_PUSH_FAILED;
+    }
+  }
+
+  rpa_queue_put(queue, data, true);
+  if (queue->empty_waiters) {
+    Q_DBG("sig !empty", queue);
+    pthread_cond_signal(queue->not_empty);
+  }
+
+  pthread_mutex_unlock(queue->one_big_mutex);
+  return result;
+}
+
 /**
  * not thread safe
  */
@@ -314,10 +626,21 @@ bool rpa_queue_pop(rpa_queue_t *queue, void **data)
 }
 
 bool rpa_queue_timedpop(rpa_queue_t *queue, void **data, int wait_ms)
+{
+  return rpa_queue_timedpop_gap(queue, data, wait_ms, NULL);
+}
+
+/**
+ * Retrieves the next item from the queue, without blocking if wait_ms is
+ * RPA_WAIT_NONE, along with the number of items dropped right before it.
+ */
+static bool rpa_queue_trypop_gap(rpa_queue_t *queue, void **data, uint32_t *gap);
+
+bool rpa_queue_timedpop_gap(rpa_queue_t *queue, void **data, int wait_ms, uint32_t *gap)
 {
   bool rv;
 
-  if (wait_ms == RPA_WAIT_NONE) return rpa_queue_trypop(queue, data);
+  if (wait_ms == RPA_WAIT_NONE) return rpa_queue_trypop_gap(queue, data, gap);
 
   if (queue->terminated) {
     return false; /* no more elements ever again */
@@ -331,6 +654,7 @@ bool rpa_queue_timedpop(rpa_queue_t *queue, void **data, int wait_ms)
   /* Keep waiting until we wake up and find that the queue is not empty. */
   if (rpa_queue_empty(queue)) {
     if (!queue->terminated) {
+      ton_stats_add(TON_STAT_POP_WAITS, 1);
       queue->empty_waiters++;
       if (wait_ms == RPA_WAIT_FOREVER) {
         rv = pthread_cond_wait(queue->not_empty, queue->one_big_mutex);
@@ -341,6 +665,7 @@ bool rpa_queue_timedpop(rpa_queue_t *queue, void **data, int wait_ms)
       }
       queue->empty_waiters--;
       if (rv != 0) {
+        ton_stats_add(TON_STAT_POP_TIMEOUTS, 1);
         pthread_mutex_unlock(queue->one_big_mutex);
         return false;
       }
@@ -360,13 +685,7 @@ bool rpa_queue_timedpop(rpa_queue_t *queue, void **data, int wait_ms)
     }
   }
 
-  *data = queue->data[queue->out];
-  queue->nelts--;
-
-  queue->out++;
-  if (queue->out >= queue->bounds) {
-    queue->out -= queue->bounds;
-  }
+  rpa_queue_take(queue, data, gap);
   if (queue->full_waiters) {
     Q_DBG("signal !full", queue);
     rv = pthread_cond_signal(queue->not_full);
@@ -380,6 +699,95 @@ bool rpa_queue_timedpop(rpa_queue_t *queue, void **data, int wait_ms)
   return true;
 }
 
+uint32_t rpa_queue_timedpopn(rpa_queue_t *queue, void **data, uint32_t *gaps, uint32_t max, int wait_ms,
+                             rpa_queue_stop_fn stop, void *stop_arg)
+{
+  uint32_t n, scanned = 0;
+  bool stopped = false, waited = false;
+  struct timespec abstime;
+
+  if (max == 0 || queue->terminated) {
+    return 0;
+  }
+
+  if (pthread_mutex_lock(queue->one_big_mutex) != 0) {
+    return 0;
+  }
+
+  if (wait_ms > 0) {
+    abstime = get_future_timespec(wait_ms);
+  }
+
+  /* Linger until the batch is filled, the stop object arrives or time is out. */
+  while (wait_ms != RPA_WAIT_NONE && !queue->terminated) {
+    while (stop && !stopped && scanned < queue->nelts) {
+      uint32_t i = queue->out + scanned;
+      if (i >= queue->bounds) {
+        i -= queue->bounds;
+      }
+      stopped = stop(queue->data[i], stop_arg);
+      scanned++;
+    }
+    /* a full queue won't get any more */
+    if (stopped || queue->nelts >= max || rpa_queue_full(queue)) {
+      break;
+    }
+    int rv;
+    waited = true;
+    queue->empty_waiters++;
+    if (wait_ms == RPA_WAIT_FOREVER) {
+      rv = pthread_cond_wait(queue->not_empty, queue->one_big_mutex);
+    } else {
+      rv = pthread_cond_timedwait(queue->not_empty, queue->one_big_mutex,
+        &abstime);
+    }
+    queue->empty_waiters--;
+    if (rv != 0) {
+      break; /* timed out, take what we have */
+    }
+  }
+
+  n = queue->nelts < max ? queue->nelts : max;
+  if (waited) {
+    /* lingering for a fuller batch only counts as a timeout if nothing has come */
+    ton_stats_add(TON_STAT_POP_WAITS, 1);
+    if (n == 0) {
+      ton_stats_add(TON_STAT_POP_TIMEOUTS, 1);
+    }
+  }
+  if (n > 0) {
+    /* at most two chunks since the buffer is circular */
+    uint32_t first = queue->bounds - queue->out;
+    if (first > n) {
+      first = n;
+    }
+    memcpy(data, queue->data + queue->out, first * sizeof(void*));
+    memcpy(data + first, queue->data, (n - first) * sizeof(void*));
+    if (gaps) {
+      memcpy(gaps, queue->gaps + queue->out, first * sizeof(uint32_t));
+      memcpy(gaps + first, queue->gaps, (n - first) * sizeof(uint32_t));
+      for (uint32_t i = 0; i < n; i++) {
+        gaps[i] &= ~RPA_GAP_PINNED;
+      }
+    }
+
+    queue->nelts -= n;
+    rpa_queue_notify_empty(queue);
+
+    queue->out += n;
+    if (queue->out >= queue->bounds) {
+      queue->out -= queue->bounds;
+    }
+    if (queue->full_waiters) {
+      Q_DBG("broadcast !full", queue);
+      pthread_cond_broadcast(queue->not_full);
+    }
+  }
+
+  pthread_mutex_unlock(queue->one_big_mutex);
+  return n;
+}
+
 /**
  * Retrieves the next item from the queue. If there are no
  * items available, return RPA_EAGAIN.  Once retrieved,
@@ -387,12 +795,14 @@ bool rpa_queue_timedpop(rpa_queue_t *queue, void **data, int wait_ms)
  */
 bool rpa_queue_trypop(rpa_queue_t *queue, void **data)
 {
-  bool rv;
+  return rpa_queue_trypop_gap(queue, data, NULL);
+}
 
-  if (queue->terminated) {
-    return false; /* no more elements ever again */
-  }
+static bool rpa_queue_trypop_gap(rpa_queue_t *queue, void **data, uint32_t *gap)
+{
+  bool rv;
 
+  /* elements left in the terminated queue are still returned, so that it can be drained */
   rv = pthread_mutex_lock(queue->one_big_mutex);
   if (rv != 0) {
     return false;
@@ -403,13 +813,7 @@ bool rpa_queue_trypop(rpa_queue_t *queue, void **data)
     return false; //EAGAIN;
   }
 
-  *data = queue->data[queue->out];
-  queue->nelts--;
-
-  queue->out++;
-  if (queue->out >= queue->bounds) {
-    queue->out -= queue->bounds;
-  }
+  rpa_queue_take(queue, data, gap);
   if (queue->full_waiters) {
     Q_DBG("signal !full", queue);
     rv = pthread_cond_signal(queue->not_full);
@@ -423,6 +827,35 @@ bool rpa_queue_trypop(rpa_queue_t *queue, void **data)
   return true;
 }
 
+bool rpa_queue_set_notify_fd(rpa_queue_t *queue, int read_fd, int write_fd)
+{
+#ifdef TON_WINDOWS
+  return false;
+#else
+  if (pthread_mutex_lock(queue->one_big_mutex) != 0) {
+    return false;
+  }
+  if (queue->notify_read_fd >= 0) {
+    pthread_mutex_unlock(queue->one_big_mutex);
+    return false;
+  }
+  queue->notify_read_fd = read_fd;
+  queue->notify_write_fd = write_fd;
+  if (!rpa_queue_empty(queue)) {
+    uint64_t one = 1;
+    ssize_t rv = write(write_fd, &one, sizeof(one));
+    (void) rv;
+  }
+  pthread_mutex_unlock(queue->one_big_mutex);
+  return true;
+#endif
+}
+
+int rpa_queue_notify_fd(rpa_queue_t *queue)
+{
+  return queue->notify_read_fd;
+}
+
 bool rpa_queue_interrupt_all(rpa_queue_t *queue)
 {
   bool rv;
@@ -20,10 +20,34 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <time.h>
 
 #define RPA_WAIT_NONE     0
 #define RPA_WAIT_FOREVER  -1
 
+/**
+ * What rpa_queue_push_ex does when the queue is full
+ */
+typedef enum rpa_queue_overflow {
+  RPA_OVERFLOW_BLOCK = 0,       /**< wait for a free slot (up to wait_ms), drop the object on timeout */
+  RPA_OVERFLOW_GROW = 1,        /**< double the capacity (up to max_capacity), then block */
+  RPA_OVERFLOW_DROP_OLDEST = 2, /**< evict the oldest object to make room */
+  RPA_OVERFLOW_DROP_NEWEST = 3  /**< drop the object being pushed */
+} rpa_queue_overflow_t;
+
+/**
+ * Outcome of rpa_queue_push_ex
+ */
+typedef enum rpa_queue_push_result {
+  RPA_PUSH_OK = 0,      /**< pushed right away */
+  RPA_PUSH_WAITED,      /**< pushed after waiting for a free slot */
+  RPA_PUSH_GROWN,       /**< pushed after growing the queue */
+  RPA_PUSH_EVICTED,     /**< pushed after evicting the oldest object (returned via evicted) */
+  RPA_PUSH_DROPPED,     /**< not pushed, dropped according to the policy */
+  RPA_PUSH_TIMEOUT,     /**< not pushed, no free slot within wait_ms */
+  RPA_PUSH_FAILED       /**< not pushed, the queue is terminated */
+} rpa_queue_push_result_t;
+
 /**
  * @file rpa_queue.h
  * @brief Thread Safe FIFO bounded queue
@@ -74,6 +98,48 @@ bool rpa_queue_push(rpa_queue_t *queue, void *data);
  */
 bool rpa_queue_timedpush(rpa_queue_t *queue, void *data, int wait_ms);
 
+/**
+ * set the overflow policy used by rpa_queue_push_ex; by default it's
+ * RPA_OVERFLOW_BLOCK with no timeout
+ *
+ * @param queue         the queue
+ * @param policy        the policy
+ * @param wait_ms       how long RPA_OVERFLOW_BLOCK (and RPA_OVERFLOW_GROW once
+ *                      max_capacity is reached) waits for a free slot
+ * @param max_capacity  capacity limit for RPA_OVERFLOW_GROW
+ * @returns false if the policy isn't supported by the queue implementation
+ */
+bool rpa_queue_set_overflow(rpa_queue_t *queue, rpa_queue_overflow_t policy, int wait_ms, uint32_t max_capacity);
+
+/**
+ * push/add an object to the queue, handling the full queue according to its
+ * overflow policy (see rpa_queue_set_overflow). Objects which are dropped or
+ * evicted are counted, and the count is reported by the pop of the object
+ * which follows them (see rpa_queue_timedpop_gap).
+ *
+ * @param queue     the queue
+ * @param data      the data
+ * @param evicted   receives the evicted object if RPA_PUSH_EVICTED is returned
+ * @returns the outcome; the caller owns data unless it has been pushed
+ */
+rpa_queue_push_result_t rpa_queue_push_ex(rpa_queue_t *queue, void *data, void **evicted);
+
+/**
+ * push/add an object which must not be lost (e.g. the last one of a stream the
+ * consumer waits for), which is never dropped: if the queue is full, it evicts
+ * the oldest object with RPA_OVERFLOW_DROP_OLDEST policy, and otherwise grows by
+ * one slot past the capacity limit (or waits for a free slot if the queue
+ * implementation can't grow). Once pushed, the object is never evicted.
+ * The count of objects dropped before it is reported by its pop, as usual.
+ *
+ * @param queue     the queue
+ * @param data      the data
+ * @param evicted   receives the evicted object if RPA_PUSH_EVICTED is returned
+ * @returns the outcome, which is never RPA_PUSH_DROPPED or RPA_PUSH_TIMEOUT;
+ *          the caller owns data unless it has been pushed
+ */
+rpa_queue_push_result_t rpa_queue_push_final(rpa_queue_t *queue, void *data, void **evicted);
+
 /**
  * pop/get an object from the queue, blocking if the queue is already empty
  *
@@ -97,6 +163,45 @@ bool rpa_queue_pop(rpa_queue_t *queue, void **data);
  */
 bool rpa_queue_timedpop(rpa_queue_t *queue, void **data, int wait_ms);
 
+/**
+ * same as rpa_queue_timedpop, also returning the number of objects dropped
+ * right before the popped one because of the overflow policy
+ *
+ * @param queue     the queue
+ * @param data      the data
+ * @param wait_ms   milliseconds to wait
+ * @param gap       receives the number of dropped objects (optional)
+ */
+bool rpa_queue_timedpop_gap(rpa_queue_t *queue, void **data, int wait_ms, uint32_t *gap);
+
+/**
+ * predicate telling rpa_queue_timedpopn to stop waiting for more objects,
+ * e.g. when the last object expected is already in the queue
+ */
+typedef bool (*rpa_queue_stop_fn)(void *data, void *arg);
+
+/**
+ * pop/get up to max objects from the queue under a single lock acquisition.
+ * Waits (up to wait_ms) until there are max objects in the queue, an object
+ * matching the stop predicate is queued, or the queue is terminated;
+ * then returns whatever has been collected, which may be fewer than max.
+ * Intended for a single consumer per queue.
+ *
+ * @param queue     the queue
+ * @param data      array receiving up to max objects
+ * @param gaps      array receiving dropped objects count for each of them,
+ *                  see rpa_queue_timedpop_gap (optional)
+ * @param max       max number of objects to pop
+ * @param wait_ms   milliseconds to wait for the batch to fill; RPA_WAIT_NONE
+ *                  pops whatever is available, RPA_WAIT_FOREVER waits for the
+ *                  full batch or the stop predicate
+ * @param stop      stop predicate (optional)
+ * @param stop_arg  argument passed to the stop predicate
+ * @returns the number of objects popped
+ */
+uint32_t rpa_queue_timedpopn(rpa_queue_t *queue, void **data, uint32_t *gaps, uint32_t max, int wait_ms,
+                             rpa_queue_stop_fn stop, void *stop_arg);
+
 /**
  * push/add an object to the queue, returning immediately if the queue is full
  *
@@ -116,8 +221,8 @@ bool rpa_queue_trypush(rpa_queue_t *queue, void *data);
  * @param data the data
  * @returns RPA_EINTR the blocking operation was interrupted (try again)
  * @returns RPA_EAGAIN the queue is empty
- * @returns RPA_EOF the queue has been terminated
- * @returns RPA_SUCCESS on a successful pop
+ * @returns RPA_SUCCESS on a successful pop; elements left in the terminated
+ *          queue are still returned, so that it can be drained
  */
 bool rpa_queue_trypop(rpa_queue_t *queue, void **data);
 
@@ -147,9 +252,55 @@ bool rpa_queue_interrupt_all(rpa_queue_t *queue);
 bool rpa_queue_term(rpa_queue_t *queue);
 
 /**
- * destroy queue
+ * attach a notification descriptor to the queue: it becomes readable
+ * while the queue is not empty, and is drained when the queue becomes empty.
+ * Descriptors are owned by the queue and closed by rpa_queue_destroy.
+ *
+ * @param queue     the queue
+ * @param read_fd   descriptor to be drained (eventfd or read end of a pipe)
+ * @param write_fd  descriptor to be signalled (same eventfd or write end of the pipe)
+ * @returns false if the queue already has a notification descriptor,
+ *          or descriptors are not supported on this platform
+ */
+bool rpa_queue_set_notify_fd(rpa_queue_t *queue, int read_fd, int write_fd);
+
+/**
+ * returns the readable notification descriptor of the queue,
+ * or -1 if there's none (see rpa_queue_set_notify_fd)
+ *
+ * @param queue the queue
+ */
+int rpa_queue_notify_fd(rpa_queue_t *queue);
+
+/**
+ * returns the absolute time, suitable for pthread_cond_timedwait,
+ * which is the given number of milliseconds ahead of now
+ *
+ * @param ms    milliseconds from now
+ */
+struct timespec get_future_timespec(int ms);
+
+/**
+ * returns the number of milliseconds left until the given absolute time
+ * (see get_future_timespec), or 0 if it has already passed
+ *
+ * @param deadline  absolute time
+ */
+int get_remaining_ms(struct timespec deadline);
+
+/**
+ * reset the empty queue to its initial state (including capacity and overflow
+ * policy), so it can be reused instead of being destroyed and created again;
+ * closes the notification descriptor
+ *
+ * @param queue the queue
+ * @returns false if the queue is not empty or there are threads blocked on it
+ */
+bool rpa_queue_reset(rpa_queue_t *queue);
+
+/**
+ * destroy queue and free all the memory it holds
  * @param  queue
- * @return     always true
  */
 void rpa_queue_destroy(rpa_queue_t * queue);
 
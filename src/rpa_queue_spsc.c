@@ -0,0 +1,550 @@
+/*
+ * Lock-free single-producer/single-consumer implementation of the rpa_queue API,
+ * selected at build time instead of rpa_queue.c (see --enable-ton_client_spsc_queue).
+ *
+ * Callbacks of a request are normally pushed by a single SDK thread and popped by
+ * a single PHP thread, so the ring only synchronizes through the head and tail
+ * indices kept on separate cache lines. Producers still serialize on a mutex,
+ * since joined requests and completion queues may have several of them, but it's
+ * never contended with the consumer. Both sides park on condition variables only
+ * when the ring is empty (consumer) or full (producer).
+ *
+ * Since the producer never touches the consumer side, RPA_OVERFLOW_GROW and
+ * RPA_OVERFLOW_DROP_OLDEST policies are not supported, and rpa_queue_push_final
+ * waits for a free slot.
+ */
+
+#include "rpa_queue.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "os.h"
+#include "ton_atomic.h"
+#include "ton_stats.h"
+#include "ton_probes.h"
+
+#ifndef TON_WINDOWS
+#include <unistd.h>
+#endif
+
+#define RPA_CACHE_LINE 64
+
+struct rpa_queue_t {
+  /* consumer side */
+  volatile uint32_t head;       /**< next filled location, free-running */
+  uint32_t cached_tail;         /**< last seen value of tail */
+  char pad1[RPA_CACHE_LINE - 2 * sizeof(uint32_t)];
+
+  /* producer side */
+  volatile uint32_t tail;       /**< next empty location, free-running */
+  uint32_t cached_head;         /**< last seen value of head */
+  char pad2[RPA_CACHE_LINE - 2 * sizeof(uint32_t)];
+
+  /* rarely written */
+  void **data;
+  uint32_t *gaps;               /**< # objects dropped right before each one */
+  uint32_t mask;                /**< ring size (power of 2) - 1 */
+  uint32_t bounds;              /**< max size of queue */
+  uint32_t pending_gap;         /**< # objects dropped since the last push */
+  rpa_queue_overflow_t overflow_policy;
+  int overflow_wait_ms;
+  volatile uint32_t consumer_waiting;  /**< consumer is parked */
+  volatile uint32_t producer_waiting;  /**< # parked producers */
+  volatile uint32_t terminated;
+  int notify_read_fd;           /**< readable while the queue is not empty */
+  int notify_write_fd;
+  pthread_mutex_t producer_mutex;
+  pthread_mutex_t park_mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+};
+
+static bool rpa_queue_deadline_passed(const struct timespec *deadline)
+{
+  struct timespec now = get_future_timespec(0);
+  return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+static uint32_t rpa_queue_ring_size(uint32_t capacity)
+{
+  uint32_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  return size;
+}
+
+/**
+ * Signals the notification descriptor. Called by the producer which has seen
+ * the queue going from empty to non-empty, and by the consumer which has
+ * drained the descriptor concurrently with such a push.
+ */
+static void rpa_queue_notify_signal(rpa_queue_t *queue)
+{
+#ifndef TON_WINDOWS
+  uint64_t one = 1;
+  ssize_t rv = write(queue->notify_write_fd, &one, sizeof(one));
+  (void) rv; /* may only fail if it's already readable */
+#endif
+}
+
+/**
+ * Drains the notification descriptor once the consumer has found the queue
+ * empty, then re-checks the tail: a push may have signalled the descriptor
+ * between the two, and that signal must not get lost.
+ */
+static void rpa_queue_notify_empty(rpa_queue_t *queue, uint32_t head)
+{
+#ifndef TON_WINDOWS
+  if (queue->notify_read_fd >= 0) {
+    char buf[64];
+    while (read(queue->notify_read_fd, buf, sizeof(buf)) > 0);
+    ton_atomic_fence();
+    if (ton_atomic_load_u32(&queue->tail) != head) {
+      rpa_queue_notify_signal(queue);
+    }
+  }
+#endif
+}
+
+/**
+ * Wakes up the parked consumer, if any. Must follow a tail update
+ * with a full fence in between, pairing with rpa_queue_park_consumer.
+ * The flag is cleared here, so that subsequent pushes don't signal again
+ * before the consumer gets to run.
+ */
+static void rpa_queue_wake_consumer(rpa_queue_t *queue)
+{
+  if (ton_atomic_load_u32(&queue->consumer_waiting)) {
+    pthread_mutex_lock(&queue->park_mutex);
+    if (queue->consumer_waiting) {
+      queue->consumer_waiting = 0;
+      pthread_cond_signal(&queue->not_empty);
+    }
+    pthread_mutex_unlock(&queue->park_mutex);
+  }
+}
+
+/**
+ * Wakes up the parked producers, if any. Producers only ever increment the
+ * counter, and it's reset here, so one pop wakes up all of them at once.
+ */
+static void rpa_queue_wake_producer(rpa_queue_t *queue)
+{
+  if (ton_atomic_load_u32(&queue->producer_waiting)) {
+    pthread_mutex_lock(&queue->park_mutex);
+    if (queue->producer_waiting) {
+      queue->producer_waiting = 0;
+      pthread_cond_broadcast(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->park_mutex);
+  }
+}
+
+/**
+ * Parks the consumer until the tail moves away from the given value,
+ * the queue is interrupted or the deadline (if any) is reached.
+ */
+static void rpa_queue_park_consumer(rpa_queue_t *queue, uint32_t tail, const struct timespec *deadline)
+{
+  pthread_mutex_lock(&queue->park_mutex);
+  ton_atomic_store_u32(&queue->consumer_waiting, 1);
+  ton_atomic_fence();
+  if (ton_atomic_load_u32(&queue->tail) == tail && !queue->terminated) {
+    if (deadline) {
+      pthread_cond_timedwait(&queue->not_empty, &queue->park_mutex, deadline);
+    } else {
+      pthread_cond_wait(&queue->not_empty, &queue->park_mutex);
+    }
+  }
+  ton_atomic_store_u32(&queue->consumer_waiting, 0);
+  pthread_mutex_unlock(&queue->park_mutex);
+}
+
+/**
+ * Parks the producer until the head moves away from the given value,
+ * the queue is interrupted or the deadline (if any) is reached.
+ */
+static void rpa_queue_park_producer(rpa_queue_t *queue, uint32_t head, const struct timespec *deadline)
+{
+  pthread_mutex_lock(&queue->park_mutex);
+  ton_atomic_store_u32(&queue->producer_waiting, queue->producer_waiting + 1);
+  ton_atomic_fence();
+  if (ton_atomic_load_u32(&queue->head) == head && !queue->terminated) {
+    if (deadline) {
+      pthread_cond_timedwait(&queue->not_full, &queue->park_mutex, deadline);
+    } else {
+      pthread_cond_wait(&queue->not_full, &queue->park_mutex);
+    }
+  }
+  pthread_mutex_unlock(&queue->park_mutex);
+}
+
+static void rpa_queue_close_notify_fd(rpa_queue_t *queue)
+{
+#ifndef TON_WINDOWS
+  if (queue->notify_read_fd >= 0) {
+    close(queue->notify_read_fd);
+  }
+  if (queue->notify_write_fd >= 0 && queue->notify_write_fd != queue->notify_read_fd) {
+    close(queue->notify_write_fd);
+  }
+#endif
+  queue->notify_read_fd = queue->notify_write_fd = -1;
+}
+
+void rpa_queue_destroy(rpa_queue_t *queue)
+{
+  pthread_cond_destroy(&queue->not_empty);
+  pthread_cond_destroy(&queue->not_full);
+  pthread_mutex_destroy(&queue->park_mutex);
+  pthread_mutex_destroy(&queue->producer_mutex);
+  rpa_queue_close_notify_fd(queue);
+  free(queue->data);
+  free(queue->gaps);
+  free(queue);
+}
+
+bool rpa_queue_create(rpa_queue_t **q, uint32_t queue_capacity)
+{
+  rpa_queue_t *queue;
+  if (queue_capacity == 0 || queue_capacity > (UINT32_MAX >> 1) + 1) {
+    return false;
+  }
+  if (!(queue = calloc(1, sizeof(rpa_queue_t)))) {
+    return false;
+  }
+  uint32_t size = rpa_queue_ring_size(queue_capacity);
+  queue->data = malloc(size * sizeof(void*));
+  queue->gaps = malloc(size * sizeof(uint32_t));
+  if (!queue->data || !queue->gaps) {
+    free(queue->data);
+    free(queue->gaps);
+    free(queue);
+    return false;
+  }
+  queue->mask = size - 1;
+  queue->bounds = queue_capacity;
+  queue->overflow_policy = RPA_OVERFLOW_BLOCK;
+  queue->overflow_wait_ms = RPA_WAIT_FOREVER;
+  queue->notify_read_fd = -1;
+  queue->notify_write_fd = -1;
+  pthread_mutex_init(&queue->producer_mutex, NULL);
+  pthread_mutex_init(&queue->park_mutex, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+  pthread_cond_init(&queue->not_full, NULL);
+  *q = queue;
+  return true;
+}
+
+/**
+ * Pushes the data, parking while the queue is full until wait_ms is out,
+ * or dropping it right away if drop is set.
+ */
+static rpa_queue_push_result_t rpa_queue_push_internal(rpa_queue_t *queue, void *data, int wait_ms, bool drop)
+{
+  rpa_queue_push_result_t result = RPA_PUSH_OK;
+  struct timespec deadline;
+  uint64_t wait_start = 0;
+
+  if (queue->terminated) {
+    return RPA_PUSH_FAILED; /* no more elements ever again */
+  }
+
+  pthread_mutex_lock(&queue->producer_mutex);
+  uint32_t tail = queue->tail;
+  if (tail - queue->cached_head >= queue->bounds) {
+    queue->cached_head = ton_atomic_load_u32(&queue->head);
+    if (wait_ms > 0) {
+      deadline = get_future_timespec(wait_ms);
+    }
+    while (tail - queue->cached_head >= queue->bounds) {
+      if (queue->terminated) {
+        pthread_mutex_unlock(&queue->producer_mutex);
+        return RPA_PUSH_FAILED;
+      }
+      if (drop || wait_ms == RPA_WAIT_NONE || (wait_ms > 0 && rpa_queue_deadline_passed(&deadline))) {
+        queue->pending_gap++;
+        pthread_mutex_unlock(&queue->producer_mutex);
+        if (wait_start) {
+          uint64_t wait_ns = ton_stats_now_ns() - wait_start;
+          ton_stats_add(TON_STAT_PUSH_WAIT_NS, wait_ns);
+          TON_PROBE_QUEUE_UNBLOCKED(queue, wait_ns);
+        }
+        return drop ? RPA_PUSH_DROPPED : RPA_PUSH_TIMEOUT;
+      }
+      if (!wait_start) {
+        wait_start = ton_stats_now_ns();
+        ton_stats_add(TON_STAT_PUSH_WAITS, 1);
+        TON_PROBE_QUEUE_FULL(queue);
+      }
+      rpa_queue_park_producer(queue, queue->cached_head,
+                              wait_ms == RPA_WAIT_FOREVER ? NULL : &deadline);
+      result = RPA_PUSH_WAITED;
+      queue->cached_head = ton_atomic_load_u32(&queue->head);
+    }
+  }
+
+  queue->data[tail & queue->mask] = data;
+  queue->gaps[tail & queue->mask] = queue->pending_gap;
+  queue->pending_gap = 0;
+  ton_atomic_store_u32(&queue->tail, tail + 1);
+  ton_atomic_fence();
+
+  if (queue->notify_write_fd >= 0 && tail == ton_atomic_load_u32(&queue->head)) {
+    rpa_queue_notify_signal(queue);
+  }
+  pthread_mutex_unlock(&queue->producer_mutex);
+
+  if (wait_start) {
+    uint64_t wait_ns = ton_stats_now_ns() - wait_start;
+    ton_stats_add(TON_STAT_PUSH_WAIT_NS, wait_ns);
+    TON_PROBE_QUEUE_UNBLOCKED(queue, wait_ns);
+  }
+  rpa_queue_wake_consumer(queue);
+  return result;
+}
+
+bool rpa_queue_timedpush(rpa_queue_t *queue, void *data, int wait_ms)
+{
+  rpa_queue_push_result_t result = rpa_queue_push_internal(queue, data, wait_ms, false);
+  return result == RPA_PUSH_OK || result == RPA_PUSH_WAITED;
+}
+
+bool rpa_queue_set_overflow(rpa_queue_t *queue, rpa_queue_overflow_t policy, int wait_ms, uint32_t max_capacity)
+{
+  (void) max_capacity;
+  if (policy != RPA_OVERFLOW_BLOCK && policy != RPA_OVERFLOW_DROP_NEWEST) {
+    return false;
+  }
+  pthread_mutex_lock(&queue->producer_mutex);
+  queue->overflow_policy = policy;
+  queue->overflow_wait_ms = wait_ms;
+  pthread_mutex_unlock(&queue->producer_mutex);
+  return true;
+}
+
+rpa_queue_push_result_t rpa_queue_push_ex(rpa_queue_t *queue, void *data, void **evicted)
+{
+  (void) evicted;
+  return rpa_queue_push_internal(queue, data, queue->overflow_wait_ms,
+                                 queue->overflow_policy == RPA_OVERFLOW_DROP_NEWEST);
+}
+
+rpa_queue_push_result_t rpa_queue_push_final(rpa_queue_t *queue, void *data, void **evicted)
+{
+  /* the ring can't grow, and nothing is evicted from it */
+  (void) evicted;
+  return rpa_queue_push_internal(queue, data, RPA_WAIT_FOREVER, false);
+}
+
+bool rpa_queue_push(rpa_queue_t *queue, void *data)
+{
+  return rpa_queue_timedpush(queue, data, RPA_WAIT_FOREVER);
+}
+
+bool rpa_queue_trypush(rpa_queue_t *queue, void *data)
+{
+  return rpa_queue_timedpush(queue, data, RPA_WAIT_NONE);
+}
+
+/**
+ * Returns the number of elements available to the consumer,
+ * refreshing the cached tail only when the cached one shows none.
+ */
+static uint32_t rpa_queue_available(rpa_queue_t *queue, uint32_t head)
+{
+  if (queue->cached_tail == head) {
+    queue->cached_tail = ton_atomic_load_u32(&queue->tail);
+  }
+  return queue->cached_tail - head;
+}
+
+/**
+ * Moves the head past the popped elements and lets the producer know.
+ */
+static void rpa_queue_consume(rpa_queue_t *queue, uint32_t head)
+{
+  ton_atomic_store_u32(&queue->head, head);
+  ton_atomic_fence();
+  if (queue->notify_read_fd >= 0 && ton_atomic_load_u32(&queue->tail) == head) {
+    rpa_queue_notify_empty(queue, head);
+  }
+  rpa_queue_wake_producer(queue);
+}
+
+bool rpa_queue_timedpop(rpa_queue_t *queue, void **data, int wait_ms)
+{
+  return rpa_queue_timedpop_gap(queue, data, wait_ms, NULL);
+}
+
+bool rpa_queue_timedpop_gap(rpa_queue_t *queue, void **data, int wait_ms, uint32_t *gap)
+{
+  struct timespec deadline;
+
+  /* elements left in the terminated queue are still returned without waiting, so that it can be drained */
+  if (queue->terminated && wait_ms != RPA_WAIT_NONE) {
+    return false; /* no more elements ever again */
+  }
+
+  uint32_t head = queue->head;
+  if (rpa_queue_available(queue, head) == 0) {
+    if (queue->notify_read_fd >= 0) {
+      /* clears the descriptor if it's been signalled spuriously */
+      rpa_queue_notify_empty(queue, head);
+    }
+    /* same as rpa_queue.c: wait once, then give up if it's still empty */
+    if (wait_ms == RPA_WAIT_NONE) {
+      return false;
+    }
+    if (wait_ms != RPA_WAIT_FOREVER) {
+      deadline = get_future_timespec(wait_ms);
+    }
+    ton_stats_add(TON_STAT_POP_WAITS, 1);
+    rpa_queue_park_consumer(queue, head, wait_ms == RPA_WAIT_FOREVER ? NULL : &deadline);
+    if (queue->terminated || rpa_queue_available(queue, head) == 0) {
+      ton_stats_add(TON_STAT_POP_TIMEOUTS, 1);
+      return false;
+    }
+  }
+
+  *data = queue->data[head & queue->mask];
+  if (gap) {
+    *gap = queue->gaps[head & queue->mask];
+  }
+  rpa_queue_consume(queue, head + 1);
+  return true;
+}
+
+bool rpa_queue_pop(rpa_queue_t *queue, void **data)
+{
+  return rpa_queue_timedpop(queue, data, RPA_WAIT_FOREVER);
+}
+
+bool rpa_queue_trypop(rpa_queue_t *queue, void **data)
+{
+  return rpa_queue_timedpop(queue, data, RPA_WAIT_NONE);
+}
+
+uint32_t rpa_queue_timedpopn(rpa_queue_t *queue, void **data, uint32_t *gaps, uint32_t max, int wait_ms,
+                             rpa_queue_stop_fn stop, void *stop_arg)
+{
+  struct timespec deadline;
+  uint32_t scanned = 0, n;
+  bool stopped = false, waited = false;
+
+  if (max == 0 || queue->terminated) {
+    return 0;
+  }
+
+  if (wait_ms > 0) {
+    deadline = get_future_timespec(wait_ms);
+  }
+
+  uint32_t head = queue->head;
+  /* Linger until the batch is filled, the stop object arrives or time is out. */
+  for (;;) {
+    uint32_t tail = ton_atomic_load_u32(&queue->tail);
+    while (stop && !stopped && head + scanned != tail) {
+      stopped = stop(queue->data[(head + scanned) & queue->mask], stop_arg);
+      scanned++;
+    }
+    /* a full queue won't get any more */
+    if (wait_ms == RPA_WAIT_NONE || stopped || tail - head >= max || tail - head >= queue->bounds ||
+        queue->terminated) {
+      break;
+    }
+    if (wait_ms > 0 && rpa_queue_deadline_passed(&deadline)) {
+      break;
+    }
+    waited = true;
+    rpa_queue_park_consumer(queue, tail, wait_ms == RPA_WAIT_FOREVER ? NULL : &deadline);
+  }
+
+  queue->cached_tail = ton_atomic_load_u32(&queue->tail);
+  n = queue->cached_tail - head < max ? queue->cached_tail - head : max;
+  if (waited) {
+    /* lingering for a fuller batch only counts as a timeout if nothing has come */
+    ton_stats_add(TON_STAT_POP_WAITS, 1);
+    if (n == 0) {
+      ton_stats_add(TON_STAT_POP_TIMEOUTS, 1);
+    }
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    data[i] = queue->data[(head + i) & queue->mask];
+    if (gaps) {
+      gaps[i] = queue->gaps[(head + i) & queue->mask];
+    }
+  }
+  if (n > 0) {
+    rpa_queue_consume(queue, head + n);
+  }
+  return n;
+}
+
+uint32_t rpa_queue_size(rpa_queue_t *queue)
+{
+  return ton_atomic_load_u32(&queue->tail) - ton_atomic_load_u32(&queue->head);
+}
+
+bool rpa_queue_set_notify_fd(rpa_queue_t *queue, int read_fd, int write_fd)
+{
+#ifdef TON_WINDOWS
+  return false;
+#else
+  pthread_mutex_lock(&queue->producer_mutex);
+  if (queue->notify_read_fd >= 0) {
+    pthread_mutex_unlock(&queue->producer_mutex);
+    return false;
+  }
+  queue->notify_read_fd = read_fd;
+  queue->notify_write_fd = write_fd;
+  if (rpa_queue_size(queue) > 0) {
+    rpa_queue_notify_signal(queue);
+  }
+  pthread_mutex_unlock(&queue->producer_mutex);
+  return true;
+#endif
+}
+
+int rpa_queue_notify_fd(rpa_queue_t *queue)
+{
+  return queue->notify_read_fd;
+}
+
+bool rpa_queue_reset(rpa_queue_t *queue)
+{
+  pthread_mutex_lock(&queue->producer_mutex);
+  if (rpa_queue_size(queue) > 0) {
+    pthread_mutex_unlock(&queue->producer_mutex);
+    return false;
+  }
+  queue->head = queue->tail = 0;
+  queue->cached_head = queue->cached_tail = 0;
+  queue->consumer_waiting = queue->producer_waiting = 0;
+  queue->terminated = 0;
+  queue->pending_gap = 0;
+  queue->overflow_policy = RPA_OVERFLOW_BLOCK;
+  queue->overflow_wait_ms = RPA_WAIT_FOREVER;
+  rpa_queue_close_notify_fd(queue);
+  pthread_mutex_unlock(&queue->producer_mutex);
+  return true;
+}
+
+bool rpa_queue_interrupt_all(rpa_queue_t *queue)
+{
+  pthread_mutex_lock(&queue->park_mutex);
+  pthread_cond_broadcast(&queue->not_empty);
+  pthread_cond_broadcast(&queue->not_full);
+  pthread_mutex_unlock(&queue->park_mutex);
+  return true;
+}
+
+bool rpa_queue_term(rpa_queue_t *queue)
+{
+  /* set under park_mutex, so that parking threads either see it or get woken up */
+  pthread_mutex_lock(&queue->park_mutex);
+  ton_atomic_store_u32(&queue->terminated, 1);
+  pthread_mutex_unlock(&queue->park_mutex);
+  return rpa_queue_interrupt_all(queue);
+}
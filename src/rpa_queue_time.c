@@ -0,0 +1,78 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rpa_queue.h"
+#include <assert.h>
+#include <limits.h>
+#include "os.h"
+
+#ifdef TON_APPLE
+#include <sys/time.h>
+#ifdef __MACH__
+#include <mach/clock.h>
+#include <mach/mach.h>
+#endif
+#else
+
+#include <time.h>
+
+#endif
+
+struct timespec get_current_timespec() {
+    struct timespec now;
+#if defined(TON_APPLE)
+    #ifdef __MACH__ // OS X does not have clock_gettime, use clock_get_time
+    clock_serv_t cclock;
+    mach_timespec_t mts;
+    host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
+    clock_get_time(cclock, &mts);
+    mach_port_deallocate(mach_task_self(), cclock);
+    now.tv_sec = mts.tv_sec;
+    now.tv_nsec = mts.tv_nsec;
+#else
+    int result = gettimeofday(&now, NULL);
+    assert(result == 0);
+    (void) result;  // unused if NDEBUG
+#endif
+#else
+    int result = timespec_get(&now, TIME_UTC);
+    assert(result != 0);
+    (void) result;  // unused if NDEBUG
+#endif
+    return now;
+}
+
+struct timespec get_future_timespec(int ms) {
+    struct timespec now = get_current_timespec(), due;
+    due.tv_sec = now.tv_sec + ms / 1000;
+    due.tv_nsec = now.tv_nsec + (ms % 1000) * 1000000;
+    if (due.tv_nsec >= 1000000000) {
+        due.tv_nsec -= 1000000000;
+        due.tv_sec++;
+    }
+    return due;
+}
+
+int get_remaining_ms(struct timespec deadline) {
+    struct timespec now = get_current_timespec();
+    if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+        return 0;
+    }
+    long long ns = (long long) (deadline.tv_sec - now.tv_sec) * 1000000000 + (deadline.tv_nsec - now.tv_nsec);
+    // rounding up, so that waiting for the result doesn't end before the deadline
+    long long ms = (ns + 999999) / 1000000;
+    return ms > INT_MAX ? INT_MAX : (int) ms;
+}
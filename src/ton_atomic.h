@@ -0,0 +1,119 @@
+#ifndef TON_ATOMIC_H
+#define TON_ATOMIC_H
+
+#include <stdint.h>
+#include "os.h"
+
+/**
+ * Minimal set of atomic operations used by lock-free code of the extension.
+ * GCC/Clang builtins are used everywhere except MSVC, which still lacks C11 atomics;
+ * there plain volatile accesses are relied upon to have acquire/release semantics,
+ * which is true for x86 and x64, the only Windows targets supported.
+ */
+
+#if defined(_MSC_VER)
+
+#include <windows.h>
+#include <intrin.h>
+
+static __forceinline uint32_t ton_atomic_load_u32(volatile uint32_t *ptr) {
+    uint32_t value = *ptr;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static __forceinline void ton_atomic_store_u32(volatile uint32_t *ptr, uint32_t value) {
+    _ReadWriteBarrier();
+    *ptr = value;
+}
+
+static __forceinline uint32_t ton_atomic_add_u32(volatile uint32_t *ptr, uint32_t value) {
+    return (uint32_t) InterlockedExchangeAdd((volatile LONG *) ptr, (LONG) value) + value;
+}
+
+static __forceinline uint32_t ton_atomic_sub_u32(volatile uint32_t *ptr, uint32_t value) {
+    return (uint32_t) InterlockedExchangeAdd((volatile LONG *) ptr, -(LONG) value) - value;
+}
+
+static __forceinline uint32_t ton_atomic_or_u32(volatile uint32_t *ptr, uint32_t value) {
+    return (uint32_t) InterlockedOr((volatile LONG *) ptr, (LONG) value);
+}
+
+static __forceinline void *ton_atomic_exchange_ptr(void *volatile *ptr, void *value) {
+    return InterlockedExchangePointer(ptr, value);
+}
+
+static __forceinline uint64_t ton_atomic_load_u64(volatile uint64_t *ptr) {
+    return (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) ptr, 0, 0);
+}
+
+static __forceinline uint64_t ton_atomic_add_u64(volatile uint64_t *ptr, uint64_t value) {
+    return (uint64_t) InterlockedExchangeAdd64((volatile LONG64 *) ptr, (LONG64) value) + value;
+}
+
+static __forceinline void ton_atomic_max_u64(volatile uint64_t *ptr, uint64_t value) {
+    uint64_t current = ton_atomic_load_u64(ptr);
+    while (current < value) {
+        uint64_t prev = (uint64_t) InterlockedCompareExchange64((volatile LONG64 *) ptr, (LONG64) value, (LONG64) current);
+        if (prev == current) {
+            break;
+        }
+        current = prev;
+    }
+}
+
+static __forceinline void ton_atomic_fence(void) {
+    MemoryBarrier();
+}
+
+#else
+
+static inline uint32_t ton_atomic_load_u32(volatile uint32_t *ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void ton_atomic_store_u32(volatile uint32_t *ptr, uint32_t value) {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t ton_atomic_add_u32(volatile uint32_t *ptr, uint32_t value) {
+    return __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t ton_atomic_sub_u32(volatile uint32_t *ptr, uint32_t value) {
+    return __atomic_sub_fetch(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+// Returns the previous value.
+
+static inline uint32_t ton_atomic_or_u32(volatile uint32_t *ptr, uint32_t value) {
+    return __atomic_fetch_or(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+// Returns the previous value.
+
+static inline void *ton_atomic_exchange_ptr(void *volatile *ptr, void *value) {
+    return __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+static inline uint64_t ton_atomic_load_u64(volatile uint64_t *ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t ton_atomic_add_u64(volatile uint64_t *ptr, uint64_t value) {
+    return __atomic_add_fetch(ptr, value, __ATOMIC_RELAXED);
+}
+
+static inline void ton_atomic_max_u64(volatile uint64_t *ptr, uint64_t value) {
+    uint64_t current = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+    while (current < value &&
+           !__atomic_compare_exchange_n(ptr, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void ton_atomic_fence(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif
+
+#endif /* TON_ATOMIC_H */
@@ -0,0 +1,182 @@
+#include "ton_broadcast.h"
+#include "os.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct ton_broadcast_slot {
+    void *item;
+    uint32_t pending;   // consumers which haven't read the item yet
+} ton_broadcast_slot_t;
+
+// Items are numbered by the sequence they are pushed in; the ones in [head, tail)
+// are kept in the ring, at slots[seq % capacity].
+
+struct ton_broadcast {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ton_broadcast_slot_t *slots;
+    uint32_t capacity;
+    uint32_t retention;
+    uint64_t head;
+    uint64_t tail;
+    uint32_t consumers;
+    uint32_t refcount;  // source and consumers
+    bool closed;
+    ton_broadcast_item_fn ref_fn;
+    ton_broadcast_item_fn free_fn;
+};
+
+struct ton_broadcast_consumer {
+    ton_broadcast_t *broadcast;
+    uint64_t cursor;    // sequence of the next item to read
+};
+
+static inline ton_broadcast_slot_t *ton_broadcast_slot(ton_broadcast_t *broadcast, uint64_t seq) {
+    return &broadcast->slots[seq % broadcast->capacity];
+}
+
+// Frees the oldest items which are neither needed by any consumer nor retained.
+
+static void ton_broadcast_trim(ton_broadcast_t *broadcast) {
+    while (broadcast->tail - broadcast->head > broadcast->retention) {
+        ton_broadcast_slot_t *slot = ton_broadcast_slot(broadcast, broadcast->head);
+        if (slot->pending) {
+            break;
+        }
+        broadcast->free_fn(slot->item);
+        slot->item = NULL;
+        broadcast->head++;
+    }
+}
+
+ton_broadcast_t *ton_broadcast_create(uint32_t capacity, uint32_t retention,
+                                      ton_broadcast_item_fn ref_fn, ton_broadcast_item_fn free_fn) {
+    if (capacity == 0 || capacity <= retention) {
+        return NULL;
+    }
+    ton_broadcast_t *broadcast = calloc(1, sizeof(ton_broadcast_t));
+    if (!broadcast) {
+        return NULL;
+    }
+    if ((broadcast->slots = calloc(capacity, sizeof(ton_broadcast_slot_t))) == NULL) {
+        free(broadcast);
+        return NULL;
+    }
+    pthread_mutex_init(&broadcast->mutex, NULL);
+    pthread_cond_init(&broadcast->cond, NULL);
+    broadcast->capacity = capacity;
+    broadcast->retention = retention;
+    broadcast->refcount = 1;
+    broadcast->ref_fn = ref_fn;
+    broadcast->free_fn = free_fn;
+    return broadcast;
+}
+
+void ton_broadcast_release(ton_broadcast_t *broadcast) {
+    pthread_mutex_lock(&broadcast->mutex);
+    uint32_t refcount = --broadcast->refcount;
+    pthread_mutex_unlock(&broadcast->mutex);
+    if (refcount) {
+        return;
+    }
+    for (uint64_t seq = broadcast->head; seq < broadcast->tail; seq++) {
+        broadcast->free_fn(ton_broadcast_slot(broadcast, seq)->item);
+    }
+    pthread_cond_destroy(&broadcast->cond);
+    pthread_mutex_destroy(&broadcast->mutex);
+    free(broadcast->slots);
+    free(broadcast);
+}
+
+void ton_broadcast_push(ton_broadcast_t *broadcast, void *item, bool last) {
+    pthread_mutex_lock(&broadcast->mutex);
+    if (broadcast->closed) {
+        pthread_mutex_unlock(&broadcast->mutex);
+        broadcast->free_fn(item);
+        return;
+    }
+    if (broadcast->tail - broadcast->head == broadcast->capacity) {
+        // the slowest consumers lose the oldest item; they notice it by their cursors
+        ton_broadcast_slot_t *slot = ton_broadcast_slot(broadcast, broadcast->head);
+        broadcast->free_fn(slot->item);
+        broadcast->head++;
+    }
+    ton_broadcast_slot_t *slot = ton_broadcast_slot(broadcast, broadcast->tail);
+    slot->item = item;
+    slot->pending = broadcast->consumers;
+    broadcast->tail++;
+    broadcast->closed = last;
+    ton_broadcast_trim(broadcast);
+    pthread_cond_broadcast(&broadcast->cond);
+    pthread_mutex_unlock(&broadcast->mutex);
+}
+
+void ton_broadcast_close(ton_broadcast_t *broadcast) {
+    pthread_mutex_lock(&broadcast->mutex);
+    broadcast->closed = true;
+    pthread_cond_broadcast(&broadcast->cond);
+    pthread_mutex_unlock(&broadcast->mutex);
+}
+
+ton_broadcast_consumer_t *ton_broadcast_subscribe(ton_broadcast_t *broadcast, bool replay) {
+    ton_broadcast_consumer_t *consumer = malloc(sizeof(ton_broadcast_consumer_t));
+    if (!consumer) {
+        return NULL;
+    }
+    consumer->broadcast = broadcast;
+    pthread_mutex_lock(&broadcast->mutex);
+    broadcast->refcount++;
+    broadcast->consumers++;
+    consumer->cursor = replay ? broadcast->head : broadcast->tail;
+    for (uint64_t seq = consumer->cursor; seq < broadcast->tail; seq++) {
+        ton_broadcast_slot(broadcast, seq)->pending++;
+    }
+    pthread_mutex_unlock(&broadcast->mutex);
+    return consumer;
+}
+
+void ton_broadcast_unsubscribe(ton_broadcast_consumer_t *consumer) {
+    ton_broadcast_t *broadcast = consumer->broadcast;
+    pthread_mutex_lock(&broadcast->mutex);
+    uint64_t seq = consumer->cursor > broadcast->head ? consumer->cursor : broadcast->head;
+    for (; seq < broadcast->tail; seq++) {
+        ton_broadcast_slot(broadcast, seq)->pending--;
+    }
+    broadcast->consumers--;
+    ton_broadcast_trim(broadcast);
+    pthread_mutex_unlock(&broadcast->mutex);
+    ton_broadcast_release(broadcast);
+    free(consumer);
+}
+
+bool ton_broadcast_next(ton_broadcast_consumer_t *consumer, const struct timespec *deadline,
+                        void **item, uint32_t *lost) {
+    ton_broadcast_t *broadcast = consumer->broadcast;
+    bool result = false;
+    pthread_mutex_lock(&broadcast->mutex);
+    while (consumer->cursor == broadcast->tail && !broadcast->closed) {
+        int rv = deadline
+                ? pthread_cond_timedwait(&broadcast->cond, &broadcast->mutex, deadline)
+                : pthread_cond_wait(&broadcast->cond, &broadcast->mutex);
+        if (rv == ETIMEDOUT) {
+            break;
+        }
+    }
+    *lost = 0;
+    if (consumer->cursor < broadcast->head) {
+        *lost = (uint32_t) (broadcast->head - consumer->cursor);
+        consumer->cursor = broadcast->head;
+    }
+    if (consumer->cursor < broadcast->tail) {
+        ton_broadcast_slot_t *slot = ton_broadcast_slot(broadcast, consumer->cursor);
+        broadcast->ref_fn(slot->item);
+        *item = slot->item;
+        slot->pending--;
+        consumer->cursor++;
+        ton_broadcast_trim(broadcast);
+        result = true;
+    }
+    pthread_mutex_unlock(&broadcast->mutex);
+    return result;
+}
@@ -0,0 +1,75 @@
+#ifndef TON_BROADCAST_H
+#define TON_BROADCAST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Ring of items produced by a single source and read by any number of consumers,
+ * each with its own cursor. Items are stored once; the ring keeps a reference to
+ * every item until all the consumers which were subscribed when it was pushed
+ * have read it (or unsubscribed), and the retention window has moved past it.
+ *
+ * Retention window is the number of the latest items kept even if nobody needs
+ * them anymore, so that consumers subscribed later can replay them.
+ *
+ * If the ring is full, the oldest item is evicted, and the consumers which
+ * haven't read it yet are told how many items they have lost.
+ *
+ * Ring is owned by the source and by every consumer; it's freed with the items
+ * left once all of them have released it.
+ */
+typedef struct ton_broadcast ton_broadcast_t;
+
+typedef struct ton_broadcast_consumer ton_broadcast_consumer_t;
+
+/**
+ * takes (ref) or releases (free) a reference to the item
+ */
+typedef void (*ton_broadcast_item_fn)(void *item);
+
+/**
+ * creates ring of the given capacity, owned by the caller (the source);
+ * capacity must be greater than retention
+ */
+ton_broadcast_t *ton_broadcast_create(uint32_t capacity, uint32_t retention,
+                                      ton_broadcast_item_fn ref_fn, ton_broadcast_item_fn free_fn);
+
+/**
+ * releases the reference to the ring taken by ton_broadcast_create()
+ */
+void ton_broadcast_release(ton_broadcast_t *broadcast);
+
+/**
+ * takes over the item reference; once the last item is pushed the ring is closed,
+ * and nothing can be pushed anymore
+ */
+void ton_broadcast_push(ton_broadcast_t *broadcast, void *item, bool last);
+
+/**
+ * closes the ring before the last item is pushed; consumers read the items left,
+ * and nothing can be pushed anymore
+ */
+void ton_broadcast_close(ton_broadcast_t *broadcast);
+
+/**
+ * adds the consumer, which reads the items retained by the ring if replay is true,
+ * or only the ones pushed from now on otherwise
+ */
+ton_broadcast_consumer_t *ton_broadcast_subscribe(ton_broadcast_t *broadcast, bool replay);
+
+/**
+ * removes the consumer, releasing the items it hasn't read yet
+ */
+void ton_broadcast_unsubscribe(ton_broadcast_consumer_t *consumer);
+
+/**
+ * waits until the deadline (forever if it's NULL) for the next item, and takes a reference to it;
+ * lost is set to the number of items evicted before the consumer could read them
+ * @returns false on timeout, or if the ring is closed and the consumer has read all its items
+ */
+bool ton_broadcast_next(ton_broadcast_consumer_t *consumer, const struct timespec *deadline,
+                        void **item, uint32_t *lost);
+
+#endif /* TON_BROADCAST_H */
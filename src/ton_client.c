@@ -11,12 +11,31 @@
 #include "os.h"
 #include "php.h"
 #include "ext/standard/info.h"
+#include "zend_smart_str.h"
+#include "zend_interfaces.h"
+#if PHP_VERSION_ID >= 80100
+#include "zend_fibers.h"
+#endif
 #include "php_ton_client.h"
 #include <stdbool.h>
 #include "tonclient.h"
 #include "rpa_queue.h"
+#include "ton_notifier.h"
+#include "ton_pool.h"
+#include "ton_atomic.h"
+#include "ton_json.h"
+#include "ton_shm_cache.h"
+#include "ton_broadcast.h"
+#include "ton_stats.h"
+#include "ton_trace.h"
+#include "ton_probes.h"
 #include "debug.h"
 
+#ifndef TON_WINDOWS
+#include <sched.h>
+#include <unistd.h>
+#endif
+
 // MAX number of unprocessed callback handler calls per single TON request.
 // In other words, its the MAX number of times the callback can be received
 // before previous callbacks have been processes via calling function ton_request_next.
@@ -24,87 +43,649 @@
 
 #define CALLBACK_QUEUE_CAPACITY 1024
 
+// Default MAX number of unprocessed callbacks of all the requests
+// bound to a single completion queue (see ton_completion_queue_create).
+
+#define COMPLETION_QUEUE_CAPACITY 16384
+
+// Default MAX number of finished request records (and their callback queues)
+// kept for reuse by subsequent ton_request_start calls; see ton_client.request_pool_size.
+
+#define REQUEST_POOL_SIZE "256"
+
+// Default limit for queues growing with TON_OVERFLOW_GROW policy,
+// relative to their initial capacity.
+
+#define OVERFLOW_GROW_FACTOR 16
+
+// MAX number of the latest events kept by the broadcast request for the consumers subscribed later
+// (see ton_request_start option "retention").
+
+#define BROADCAST_MAX_RETENTION 65536
+
+// Buffer used to encode params passed as arrays is kept for the next call
+// unless it has grown larger than that.
+
+#define PARAMS_BUFFER_KEEP_SIZE (1024 * 1024)
+
+// MAX nesting level of params passed as arrays.
+
+#define PARAMS_MAX_DEPTH 512
+
+// Default MAX number of persistent contexts (see ton_create_context) kept by every process (thread),
+// and the number of seconds they are kept for after the last use.
+
+#define PERSISTENT_CONTEXTS_MAX "16"
+#define PERSISTENT_CONTEXT_IDLE_TIMEOUT "300"
+
+// Default MAX size of ton_request_sync result cache, in bytes (disabled by default),
+// and the functions it's used for; see ton_client.result_cache_functions.
+// Functions returning key material (e.g. crypto.mnemonic_derive_sign_keys) are left out, since the cache
+// outlives the request, and so are the ones which aren't deterministic unless all their params are given
+// (e.g. abi.encode_message_body, whose header time defaults to the current one).
+
+#define RESULT_CACHE_SIZE "0"
+
+#define RESULT_CACHE_FUNCTIONS "boc.get_boc_hash,utils.convert_address," \
+        "crypto.sha256,crypto.sha512,crypto.ton_crc16,crypto.factorize,crypto.modular_power," \
+        "crypto.convert_public_key_to_ton_safe_format"
+
+// Default size of the shared memory cache of ton_request_sync results, in bytes (disabled by default),
+// the functions it's used for, and TTL of the results in seconds; see ton_client.shared_cache_functions.
+
+#define SHARED_CACHE_SIZE "0"
+#define SHARED_CACHE_FUNCTIONS "net.query_collection,net.aggregate_collection,net.get_endpoints"
+#define SHARED_CACHE_TTL "1"
+
+// Request lifecycle tracing is off by default; see ton_client.trace and ton_trace_dump.
+
+#define TRACE "0"
+
+ZEND_DECLARE_MODULE_GLOBALS(ton_client)
+
 static zend_long TON_REQUEST_NEXT_ID = 1;
-static zend_llist unused_requests;
+
+// Notified every time a callback is queued for any request;
+// used by ton_request_wait_any / ton_request_wait_all.
+static ton_notifier_t request_notifier;
+
+// Recycled request records and callback queues (CALLBACK_QUEUE_CAPACITY sized).
+static ton_pool_t request_pool;
+static ton_pool_t queue_pool;
+
+// The notifier and the pools above are held by the module and by the globals of every thread,
+// since the persistent contexts destroyed by GSHUTDOWN (which may run after MSHUTDOWN) may still
+// deliver final callbacks of their requests; see ton_client_shared_release.
+static volatile uint32_t shared_holders;
+
+// Functions allowed to be cached by ton_request_sync (ton_client.result_cache_functions)
+// and the cache size limit (ton_client.result_cache_size); both are read-only after MINIT.
+static HashTable result_cache_functions;
+static size_t result_cache_max_size;
+
+// Cache of ton_request_sync results in shared memory (ton_client.shared_cache_size), mapped in MINIT,
+// so that all the processes forked after that (e.g. PHP-FPM workers) share it; functions it's used for
+// (ton_client.shared_cache_functions) are listed with their TTLs. Read-only after MINIT as well.
+static ton_shm_cache_t *shared_cache;
+static HashTable shared_cache_functions;
+static zend_long shared_cache_ttl;
+
+// Number of times callbacks hit a full queue, by outcome (see ton_client_stats).
+static volatile uint64_t overflow_waited;
+static volatile uint64_t overflow_timeouts;
+static volatile uint64_t overflow_grown;
+static volatile uint64_t overflow_evicted;
+static volatile uint64_t overflow_dropped;
+
+// Number of requests started as followers of identical single-flight requests (see ton_client_stats).
+static volatile uint64_t single_flight_followers;
+
+// What to do when callbacks are coming faster than they are fetched,
+// see ton_overflow_options_parse.
+
+typedef struct ton_overflow_options {
+    rpa_queue_overflow_t policy;
+    int timeout;
+    uint32_t max_capacity;
+    bool is_set;
+} ton_overflow_options_t;
+
+// Completion queue is shared by many requests, so that one queue (and one pop)
+// serves all of them instead of allocating a separate queue per request.
+// Owned by its resource and by every request bound to it.
+
+typedef struct ton_completion_queue {
+    rpa_queue_t *queue;
+    volatile uint32_t refcount; // released by SDK thread if the request is the last one to let go of it
+} ton_completion_queue_t;
+
+// Lifecycle of the request record, which is shared by the PHP thread (through the request handle),
+// the SDK thread (until the final callback is delivered), and the requests joined to it (until their
+// final callbacks are delivered, see ton_request_join): whoever lets go of it last frees it,
+// see ton_request_data_release, ton_request_data_sdk_done and ton_request_data_unref.
+
+#define TON_REQUEST_RELEASED 1      // handle is released
+#define TON_REQUEST_SDK_DONE 2      // final callback is delivered (or dropped)
+#define TON_REQUEST_CANCELLED 4     // see ton_request_data_cancel
 
 typedef struct ton_request_data {
     zend_long id;
     rpa_queue_t * queue;
-    bool finished;
-    bool unused;
+    ton_completion_queue_t *cq;
+    // set by SDK thread once the final callback (of the request, or of the one joined to it) is queued
+    volatile uint32_t finished;
+    bool decode;
+    volatile uint32_t state;
+    volatile uint32_t refcount;
+    // callbacks being delivered to the request are counted, so that its queue isn't freed under them
+    volatile uint32_t delivering;
     int last_status;
-    struct ton_request_data *joined_to;
+    // request receiving the callbacks, and the one referenced by this request (the same one,
+    // unless the reference is dropped once the final callback is delivered); callbacks reading
+    // joined_to are counted, so that it's not dropped under them (see ton_request_join_target)
+    struct ton_request_data *volatile joined_to;
+    struct ton_request_data *volatile join_ref;
+    volatile uint32_t joining;
+    struct ton_request_flight *flight;
+    ton_broadcast_t *broadcast;
+    // monotonic time (ns) the request is started at and its events are received at, see ton_request_timings
+    uint64_t started_at;
+    uint64_t first_event_at;
+    uint64_t last_event_at;
+    uint64_t finished_at;
+    // time events spend in the queue until they are fetched
+    uint32_t fetched;
+    uint64_t lag_total;
+    uint64_t lag_max;
 } ton_request_data_t;
 
-static ton_request_data_t *ton_request_data_create() {
-    ton_request_data_t *data = calloc(1, sizeof(ton_request_data_t));
+// Request started with 'single_flight' option (see ton_request_begin). Requests started later
+// with the same context, function, params and decode option don't make TON SDK calls of their own
+// while it's in flight, but follow it instead: every callback is delivered to all of them,
+// sharing the same queue element.
+
+typedef struct ton_request_flight {
+    pthread_mutex_t mutex;
+    bool started;       // first callback is received, so followers can't be added anymore
+    uint32_t count;
+    uint32_t capacity;
+    ton_request_data_t **followers;
+    zend_string *key;   // persistent; copied into the single_flights registry
+} ton_request_flight_t;
+
+static ton_request_data_t *ton_request_data_create(ton_completion_queue_t *cq) {
+    ton_request_data_t *data = ton_pool_get(&request_pool);
+    if (data) {
+        memset(data, 0, sizeof(ton_request_data_t));
+    } else {
+        data = calloc(1, sizeof(ton_request_data_t));
+    }
     data->id = TON_REQUEST_NEXT_ID++;
     data->last_status = -1;
-    rpa_queue_create(&data->queue, CALLBACK_QUEUE_CAPACITY);
+    // held by the handle and SDK thread
+    data->refcount = 2;
+    if (cq) {
+        data->cq = cq;
+        ton_atomic_add_u32(&cq->refcount, 1);
+    } else if ((data->queue = ton_pool_get(&queue_pool)) == NULL) {
+        rpa_queue_create(&data->queue, CALLBACK_QUEUE_CAPACITY);
+    }
     return data;
 }
 
+// Returns the queue which the request callbacks are delivered to.
+
+static rpa_queue_t *ton_request_data_queue(ton_request_data_t *data) {
+    return data->cq ? data->cq->queue : data->queue;
+}
+
 // Queue element structure.
 // Blocking queue is used to operate with the core ton client callbacks.
 // PHP client calls ton_request_next func which blocks until the next callback
 // JSON is pushed to the queue.
+// JSON is stored right after the element, so that it takes a single allocation.
+// If the request is started with 'decode' option, JSON is parsed right away
+// (on the SDK thread) and only the parse tree is stored.
+// Single-flight requests push the same element to the queues of all the followers
+// fetching it in the same format (see ton_request_event_t),
+// and broadcast requests keep it in the ring read by all the consumers, so it's refcounted;
+// lost is only set by the (single) PHP thread fetching the element.
 
 typedef struct ton_callback_queue_element {
-    char *json;
+    uint32_t refcount;
+    uint32_t size; // memory taken by the element and its parse tree, see TON_GAUGE_QUEUED_BYTES
     uint32_t len;
     uint32_t status;
     bool finished;
-    ton_request_data_t *data;
+    bool decode;
+    zend_long request_id;
+    uint32_t lost; // number of callbacks dropped right before this one
+    uint64_t queued_at; // monotonic time (ns) the callback is received at
+    ton_json_t *tree;
+    char json[];
 } ton_callback_queue_element_t;
 
 static ton_callback_queue_element_t *ton_callback_queue_element_create(
         tc_string_data_t params_json,
         int response_type,
         bool finished,
-        ton_request_data_t *data) {
-    ton_callback_queue_element_t *e = malloc(sizeof(ton_callback_queue_element_t));
-    e->json = malloc(params_json.len);
-    e->len = params_json.len;
-    memcpy(e->json, params_json.content, params_json.len);
+        zend_long request_id,
+        bool decode) {
+    ton_json_t *tree = decode && params_json.len > 0 ? ton_json_parse(params_json.content, params_json.len) : NULL;
+    uint32_t len = tree ? 0 : params_json.len;
+    ton_callback_queue_element_t *e = malloc(sizeof(ton_callback_queue_element_t) + len);
+    e->len = len;
+    memcpy(e->json, params_json.content, len);
     e->status = response_type;
     e->finished = finished;
-    e->data = data;
+    e->decode = decode;
+    e->request_id = request_id;
+    e->lost = 0;
+    e->tree = tree;
+    e->refcount = 1;
+    e->queued_at = ton_stats_now_ns();
+    e->size = sizeof(ton_callback_queue_element_t) + len;
+    if (tree) {
+        e->size += tree->node_count * sizeof(ton_json_node_t) + tree->key_count * sizeof(ton_json_key_t) +
+                   tree->strings_len + sizeof(ton_json_t);
+    }
+    ton_stats_add(TON_STAT_BYTES_COPIED, tree ? tree->strings_len : len);
+    ton_gauge_add(TON_GAUGE_QUEUED_EVENTS, 1);
+    ton_gauge_add(TON_GAUGE_QUEUED_BYTES, e->size);
     return e;
 }
 
+static void ton_callback_queue_element_ref(void *element) {
+    ton_atomic_add_u32(&((ton_callback_queue_element_t *) element)->refcount, 1);
+}
+
 static void ton_callback_queue_element_free(ton_callback_queue_element_t *e) {
-    free(e->json);
+    if (ton_atomic_load_u32(&e->refcount) != 1 && ton_atomic_sub_u32(&e->refcount, 1) != 0) {
+        return;
+    }
+    ton_gauge_add(TON_GAUGE_QUEUED_EVENTS, -1);
+    ton_gauge_add(TON_GAUGE_QUEUED_BYTES, -(int64_t) e->size);
+    if (e->tree) {
+        ton_json_free(e->tree);
+    }
     free(e);
 }
 
-static void ton_request_data_shutdown_queue(ton_request_data_t *data) {
-    TON_DBG_MSG("freeing queue for request %p; size is %d\n", data, rpa_queue_size(data->queue));
-    rpa_queue_term(data->queue);
+static void ton_callback_queue_element_unref(void *element) {
+    ton_callback_queue_element_free((ton_callback_queue_element_t *) element);
+}
+
+static uint32_t ton_callback_queue_drain(rpa_queue_t *queue) {
     ton_callback_queue_element_t *e;
-    while (rpa_queue_trypop(data->queue, (void**)&e)) {
+    uint32_t count = 0;
+    while (rpa_queue_trypop(queue, (void**)&e)) {
         ton_callback_queue_element_free(e);
+        count++;
+    }
+    return count;
+}
+
+static void ton_callback_queue_shutdown(rpa_queue_t *queue) {
+    ton_callback_queue_drain(queue);
+    rpa_queue_term(queue);
+    rpa_queue_destroy(queue);
+}
+
+static ton_completion_queue_t *ton_completion_queue_create(uint32_t capacity) {
+    ton_completion_queue_t *cq = calloc(1, sizeof(ton_completion_queue_t));
+    cq->refcount = 1;
+    rpa_queue_create(&cq->queue, capacity);
+    return cq;
+}
+
+static void ton_completion_queue_release(ton_completion_queue_t *cq) {
+    if (ton_atomic_sub_u32(&cq->refcount, 1) == 0) {
+        TON_DBG_MSG("freeing completion queue %p; size is %d\n", cq, rpa_queue_size(cq->queue));
+        ton_callback_queue_shutdown(cq->queue);
+        free(cq);
+    }
+}
+
+// Returns the number of callbacks left in the queue.
+
+static uint32_t ton_request_data_shutdown_queue(ton_request_data_t *data) {
+    TON_DBG_MSG("freeing queue for request %p; size is %d\n", data, rpa_queue_size(data->queue));
+    uint32_t count = ton_callback_queue_drain(data->queue);
+    if (!rpa_queue_reset(data->queue) || !ton_pool_put(&queue_pool, data->queue)) {
+        ton_callback_queue_shutdown(data->queue);
     }
-    rpa_queue_destroy(data->queue);
-    free(data->queue);
     data->queue = NULL;
+    return count;
+}
+
+// Starts single-flight request, registering it as the one to be followed by the identical requests.
+
+static void ton_request_flight_lead(ton_request_data_t *data, zend_string *key) {
+    ton_request_flight_t *flight = calloc(1, sizeof(ton_request_flight_t));
+    pthread_mutex_init(&flight->mutex, NULL);
+    flight->key = key;
+    data->flight = flight;
+    // replaces the request which has already started receiving callbacks, if any;
+    // the registry keeps a copy of the key, since the flight may be freed by SDK thread
+    zend_hash_str_update_ptr(&TON_CLIENT_G(single_flights), ZSTR_VAL(key), ZSTR_LEN(key), data);
+}
+
+// Adds the follower to the single-flight request.
+// Returns false if it's too late, since the request has already started receiving callbacks.
+
+static bool ton_request_flight_follow(ton_request_flight_t *flight, ton_request_data_t *follower) {
+    bool result = false;
+    pthread_mutex_lock(&flight->mutex);
+    if (!flight->started) {
+        if (flight->count == flight->capacity) {
+            flight->capacity = flight->capacity ? flight->capacity * 2 : 4;
+            flight->followers = realloc(flight->followers, flight->capacity * sizeof(ton_request_data_t *));
+        }
+        flight->followers[flight->count++] = follower;
+        result = true;
+    }
+    pthread_mutex_unlock(&flight->mutex);
+    return result;
 }
 
+// Removes the single-flight request from the registry, so that nobody follows it anymore.
+// Registry is kept by PHP thread, so it's done when the request handle is released.
+
+static void ton_request_flight_unregister(ton_request_data_t *data) {
+    if (zend_hash_find_ptr(&TON_CLIENT_G(single_flights), data->flight->key) == data) {
+        zend_hash_del(&TON_CLIENT_G(single_flights), data->flight->key);
+    }
+}
+
+static void ton_request_flight_free(ton_request_data_t *data) {
+    ton_request_flight_t *flight = data->flight;
+    pthread_mutex_destroy(&flight->mutex);
+    free(flight->followers);
+    zend_string_release_ex(flight->key, 1);
+    free(flight);
+    data->flight = NULL;
+}
+
+// Frees the request record; called by ton_request_data_unref once nobody holds it
+// (or right away if the request is never started).
+
 static void ton_request_data_free(ton_request_data_t *data) {
     TON_DBG_MSG("in ton_request_data_free: %p\n", data);
-    if (!data->finished) {
-        TON_DBG_MSG("WARNING: request %p is not finished yet. Possible cause of segfault. Skipping.\n", data);
-        return;
+    TON_TRACE(TON_TRACE_FREE, data->id, data->fetched);
+    TON_PROBE_REQUEST_FREE(data->id, data->fetched);
+    if (data->flight) {
+        ton_request_flight_free(data);
     }
     if (data->queue) {
         ton_request_data_shutdown_queue(data);
     }
-    free(data);
+    if (data->cq) {
+        ton_completion_queue_release(data->cq);
+    }
+    if (data->broadcast) {
+        // consumers may still read the events retained by the ring
+        ton_broadcast_release(data->broadcast);
+    }
+    if (!ton_pool_put(&request_pool, data)) {
+        free(data);
+    }
 }
 
-static void ton_free_unused_request_data(void **ptr)
-{
-    TON_DBG_MSG("freeing unused request data ptr\n");
-    ton_request_data_free((ton_request_data_t *)*ptr);
+static void ton_pooled_queue_free(void *queue) {
+    rpa_queue_destroy((rpa_queue_t *) queue);
+}
+
+static void ton_thread_yield(void) {
+#ifdef TON_WINDOWS
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+// Called by SDK thread before touching the queue of the request; returns false if the request
+// is cancelled, so the queue may be gone. Pairs with ton_request_delivery_leave.
+
+static bool ton_request_delivery_enter(ton_request_data_t *data) {
+    ton_atomic_add_u32(&data->delivering, 1);
+    ton_atomic_fence();
+    if (ton_atomic_load_u32(&data->state) & TON_REQUEST_CANCELLED) {
+        ton_atomic_sub_u32(&data->delivering, 1);
+        return false;
+    }
+    return true;
+}
+
+static void ton_request_delivery_leave(ton_request_data_t *data) {
+    ton_atomic_sub_u32(&data->delivering, 1);
+}
+
+// Stops delivering callbacks to the request, and frees the ones queued along with the queue
+// (or closes the broadcast ring), so that only the request record (tombstone) is left until
+// the final callback is received. Callbacks already pushed to a completion queue stay there,
+// since the queue is shared with other requests.
+// Returns the number of callbacks freed. Called by PHP thread.
+
+static uint32_t ton_request_data_stop(ton_request_data_t *data) {
+    ton_atomic_or_u32(&data->state, TON_REQUEST_CANCELLED);
+    ton_atomic_fence();
+    uint32_t dropped = 0;
+    if (data->queue || data->broadcast) {
+        if (data->queue) {
+            // wakes up the callback waiting for a free slot in the full queue, so that it gives up;
+            // the callbacks already queued are still drained below
+            rpa_queue_term(data->queue);
+        }
+        while (ton_atomic_load_u32(&data->delivering)) {
+            ton_thread_yield();
+        }
+    }
+    if (data->queue) {
+        dropped = ton_request_data_shutdown_queue(data);
+    }
+    if (data->broadcast) {
+        // consumers read the events left in the ring, and then get nothing
+        ton_broadcast_close(data->broadcast);
+        ton_broadcast_release(data->broadcast);
+        data->broadcast = NULL;
+    }
+    return dropped;
+}
+
+// Cancels the request (see ton_request_data_stop).
+// Returns false if the request is already finished or cancelled. Called by PHP thread.
+
+static bool ton_request_data_cancel(ton_request_data_t *data) {
+    if (ton_atomic_load_u32(&data->state) & (TON_REQUEST_SDK_DONE | TON_REQUEST_CANCELLED)) {
+        return false;
+    }
+    uint32_t dropped = ton_request_data_stop(data);
+    TON_DBG_MSG("request %p cancelled; %u queued callbacks dropped\n", data, dropped);
+    TON_TRACE(TON_TRACE_CANCEL, data->id, dropped);
+    ton_stats_add(TON_STAT_REQUESTS_CANCELLED, 1);
+    return true;
+}
+
+// Drops the callback of the cancelled request (or of the one it's joined to).
+
+static void ton_request_drop(ton_request_data_t *data, ton_callback_queue_element_t *e,
+                             uint32_t response_type, bool finished) {
+    TON_DBG_MSG("request %p is cancelled\n", data);
+    TON_TRACE(TON_TRACE_ENQUEUE, data->id, TON_TRACE_ENQUEUE_ARG(response_type, finished, TON_TRACE_NOT_QUEUED));
+    data->last_status = response_type;
+    ton_callback_queue_element_free(e);
+    if (finished) {
+        ton_atomic_store_u32(&data->finished, 1);
+        ton_notifier_notify(&request_notifier);
+    }
+}
+
+// Pushes the callback of the request with the given id to the queue (or the ring) of the data,
+// taking over the element reference, which is released if the element is not queued.
+
+static void ton_request_push(ton_request_data_t *data, zend_long id, ton_callback_queue_element_t *e,
+                             uint32_t response_type, bool finished) {
+    data->last_status = response_type;
+    if (data->broadcast) {
+        TON_TRACE(TON_TRACE_ENQUEUE, id, TON_TRACE_ENQUEUE_ARG(response_type, finished, RPA_PUSH_OK));
+        ton_broadcast_push(data->broadcast, e, finished);
+        TON_DBG_MSG("request %p callback data pushed to the broadcast ring\n", data);
+    } else {
+        rpa_queue_t *queue = ton_request_data_queue(data);
+        ton_callback_queue_element_t *evicted = NULL;
+        // the final callback bypasses the overflow policy, since the consumer waits for it;
+        // it also reports the callbacks dropped right before it
+        rpa_queue_push_result_t result = finished ? rpa_queue_push_final(queue, e, (void**)&evicted)
+                                                  : rpa_queue_push_ex(queue, e, (void**)&evicted);
+        TON_TRACE(TON_TRACE_ENQUEUE, id, TON_TRACE_ENQUEUE_ARG(response_type, finished, result));
+        switch (result) {
+            case RPA_PUSH_OK:
+                break;
+            case RPA_PUSH_WAITED:
+                ton_atomic_add_u64(&overflow_waited, 1);
+                break;
+            case RPA_PUSH_GROWN:
+                ton_atomic_add_u64(&overflow_grown, 1);
+                break;
+            case RPA_PUSH_EVICTED:
+                ton_atomic_add_u64(&overflow_evicted, 1);
+                ton_callback_queue_element_free(evicted);
+                break;
+            case RPA_PUSH_TIMEOUT:
+                ton_atomic_add_u64(&overflow_timeouts, 1);
+                TON_DBG_MSG("request %p callback data dropped on timeout\n", data);
+                ton_callback_queue_element_free(e);
+                break;
+            case RPA_PUSH_DROPPED:
+                ton_atomic_add_u64(&overflow_dropped, 1);
+                // fall through
+            case RPA_PUSH_FAILED:
+            default:
+                TON_DBG_MSG("request %p callback data dropped; queue size is: %d\n", data, rpa_queue_size(queue));
+                ton_callback_queue_element_free(e);
+                break;
+        }
+        TON_DBG_MSG("request %p queue size is: %d\n", data, rpa_queue_size(queue));
+    }
+    if (finished) {
+        // set after the final callback is queued, so that it's there once the request is seen finished
+        ton_atomic_store_u32(&data->finished, 1);
+    }
+    ton_notifier_notify(&request_notifier);
+}
+
+// Lets go of the request record, freeing it if it's the last holder.
+// Called by either PHP or SDK thread.
+
+static void ton_request_data_unref(ton_request_data_t *data) {
+    if (ton_atomic_sub_u32(&data->refcount, 1) == 0) {
+        ton_request_data_free(data);
+    }
+}
+
+// Called by SDK thread while delivering the callback of the request joined to another one;
+// returns the request receiving the callback (if still joined), referenced until it's unref'd
+// by the caller, so that neither disconnecting nor releasing the target frees it in the meantime.
+
+static ton_request_data_t *ton_request_join_target(ton_request_data_t *data) {
+    ton_atomic_add_u32(&data->joining, 1);
+    ton_atomic_fence();
+    ton_request_data_t *target = data->joined_to;
+    if (target) {
+        ton_atomic_add_u32(&target->refcount, 1);
+    }
+    ton_atomic_sub_u32(&data->joining, 1);
+    return target;
+}
+
+// Drops the reference on the request the given one is joined to, if it's not dropped yet.
+
+static void ton_request_join_unref(ton_request_data_t *data) {
+    ton_request_data_t *target = ton_atomic_exchange_ptr((void *volatile *) &data->join_ref, NULL);
+    if (target) {
+        ton_request_data_unref(target);
+    }
+}
+
+// Called by SDK thread once the final callback of the request is delivered;
+// lets go of the request, and of the one it's joined to.
+
+static void ton_request_data_sdk_done(ton_request_data_t *data) {
+    uint32_t state = ton_atomic_or_u32(&data->state, TON_REQUEST_SDK_DONE);
+    ton_request_join_unref(data);
+    if (state & TON_REQUEST_RELEASED) {
+        TON_DBG_MSG("request %p is finished after its handle is released\n", data);
+        ton_gauge_add(TON_GAUGE_ABANDONED_REQUESTS, -1);
+    }
+    ton_request_data_unref(data);
+}
+
+// Callback received by the request, shared with its single-flight followers. Every consumer gets
+// the element in the format it fetches (see ton_request_event_element), since the decode option
+// of the requests (or of the ones they're joined to) may differ.
+
+typedef struct {
+    tc_string_data_t json;
+    uint32_t response_type;
+    bool finished;
+    zend_long request_id;
+    uint64_t queued_at;
+    ton_callback_queue_element_t *elements[2]; // raw and decoded, created on demand
+} ton_request_event_t;
+
+// Returns the element of the callback in the given format, referenced by the caller.
+
+static ton_callback_queue_element_t *ton_request_event_element(ton_request_event_t *event, bool decode) {
+    ton_callback_queue_element_t *e = event->elements[decode];
+    if (!e) {
+        // the event holds a reference of its own until all the consumers get theirs
+        e = event->elements[decode] = ton_callback_queue_element_create(
+                event->json, event->response_type, event->finished, event->request_id, decode);
+        e->queued_at = event->queued_at;
+    }
+    ton_callback_queue_element_ref(e);
+    return e;
+}
+
+// Delivers the callback to the request, or to the one it's joined to.
+
+static void ton_request_deliver(ton_request_data_t *data, ton_request_event_t *event) {
+    uint32_t response_type = event->response_type;
+    bool finished = event->finished;
+    if (!data->first_event_at) {
+        data->first_event_at = event->queued_at;
+    }
+    data->last_event_at = event->queued_at;
+    if (finished) {
+        data->finished_at = event->queued_at;
+        ton_stats_add(TON_STAT_REQUESTS_FINISHED, 1);
+    }
+    ton_callback_queue_element_t *e;
+    ton_request_data_t *target;
+    if (!ton_request_delivery_enter(data)) {
+        e = ton_request_event_element(event, data->decode);
+        ton_request_drop(data, e, response_type, finished);
+    } else if (!(target = ton_request_join_target(data))) {
+        e = ton_request_event_element(event, data->decode);
+        ton_request_push(data, data->id, e, response_type, finished);
+        ton_request_delivery_leave(data);
+    } else {
+        e = ton_request_event_element(event, target->decode);
+        // the queue of the request is not used while it's joined, so cancelling it doesn't have to wait
+        // for the callback blocked by the full queue of the target
+        ton_request_delivery_leave(data);
+        if (ton_request_delivery_enter(target)) {
+            ton_request_push(target, data->id, e, response_type, finished);
+            ton_request_delivery_leave(target);
+        } else {
+            ton_request_drop(data, e, response_type, finished);
+        }
+        ton_request_data_unref(target);
+    }
+    if (finished) {
+        // the request may be freed from now on
+        ton_request_data_sdk_done(data);
+    }
 }
 
 static void response_queueing_handler(
@@ -117,26 +698,122 @@ static void response_queueing_handler(
                 request_ptr, response_type, finished);
 
     ton_request_data_t *data = request_ptr;
-    if (data->unused) {
-        TON_DBG_MSG("request %p is not used anymore\n", request_ptr);
+    ton_request_flight_t *flight = data->flight;
+    ton_stats_add(TON_STAT_EVENTS_RECEIVED, 1);
+    TON_PROBE_REQUEST_ENQUEUE(data->id, params_json.len, response_type, finished);
+    if ((ton_atomic_load_u32(&data->state) & TON_REQUEST_CANCELLED) && !flight) {
+        TON_DBG_MSG("request %p is cancelled\n", request_ptr);
+        TON_TRACE(TON_TRACE_ENQUEUE, data->id, TON_TRACE_ENQUEUE_ARG(response_type, finished, TON_TRACE_NOT_QUEUED));
         data->last_status = response_type;
-        data->finished = finished;
-        // Don't queue unused request data
+        // Don't queue cancelled request data
+        if (finished) {
+            ton_stats_add(TON_STAT_REQUESTS_FINISHED, 1);
+            ton_atomic_store_u32(&data->finished, 1);
+            ton_request_data_sdk_done(data);
+        }
         return;
     }
 
-    ton_callback_queue_element_t *e = ton_callback_queue_element_create(
-            params_json, response_type, finished, data);
+    ton_request_event_t event = {params_json, response_type, finished, data->id, ton_stats_now_ns(), {NULL, NULL}};
+    if (flight) {
+        // followers can't be added from now on, so the list can be read without locking
+        pthread_mutex_lock(&flight->mutex);
+        flight->started = true;
+        pthread_mutex_unlock(&flight->mutex);
+        for (uint32_t i = 0; i < flight->count; i++) {
+            ton_request_deliver(flight->followers[i], &event);
+        }
+    }
+    ton_request_deliver(data, &event);
+    // consumers have their own references by now
+    for (int i = 0; i < 2; i++) {
+        if (event.elements[i]) {
+            ton_callback_queue_element_free(event.elements[i]);
+        }
+    }
+}
+
+static bool ton_request_has_events(ton_request_data_t *data) {
+    return data->queue && rpa_queue_size(data->queue) > 0;
+}
+
+// Blocks until any (or all, if all == true) of the given requests are ready.
+// Request is ready for wait_any if it has queued callbacks, and for wait_all if it's finished.
+// wait_any also returns when all the requests are finished and drained, since nothing
+// is going to arrive for them anymore.
 
-    if (data->joined_to) {
-        data = data->joined_to;
+static bool ton_request_wait(ton_request_data_t **requests, uint32_t count, zend_long timeout, bool all) {
+    struct timespec deadline;
+    if (timeout > 0) {
+        deadline = get_future_timespec((int) timeout);
+    }
+    bool result;
+    uint64_t seq = ton_notifier_begin_wait(&request_notifier);
+    for (;;) {
+        uint32_t ready = 0, drained = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            // final callback is queued before the request is marked finished
+            bool finished = ton_atomic_load_u32(&requests[i]->finished);
+            bool has_events = ton_request_has_events(requests[i]);
+            if (all ? finished : has_events) {
+                ready++;
+            }
+            if (finished && !has_events) {
+                drained++;
+            }
+        }
+        if (all ? ready == count : (ready > 0 || drained == count)) {
+            result = true;
+            break;
+        }
+        if (timeout == 0 || !ton_notifier_wait(&request_notifier, &seq, timeout > 0 ? &deadline : NULL)) {
+            result = false;
+            break;
+        }
     }
+    ton_notifier_end_wait(&request_notifier);
+    return result;
+}
 
-    data->last_status = response_type;
-    data->finished = finished;
-    rpa_queue_push(data->queue, e);
-    TON_DBG_MSG("request %p callback data pushed to the queue; queue size is: %d\n", request_ptr,
-                rpa_queue_size(data->queue));
+// Reads overflow policy from the options array passed to ton_request_start or
+// ton_completion_queue_create. Returns false if any of the options is invalid.
+
+static bool ton_overflow_options_parse(HashTable *options, uint32_t capacity, ton_overflow_options_t *result) {
+    zval *value;
+    result->policy = RPA_OVERFLOW_BLOCK;
+    result->timeout = RPA_WAIT_FOREVER;
+    result->max_capacity = capacity > UINT32_MAX / OVERFLOW_GROW_FACTOR ? UINT32_MAX : capacity * OVERFLOW_GROW_FACTOR;
+    result->is_set = false;
+    if (!options) {
+        return true;
+    }
+    if ((value = zend_hash_str_find(options, ZEND_STRL("overflow"))) != NULL) {
+        if (Z_TYPE_P(value) != IS_LONG || Z_LVAL_P(value) < RPA_OVERFLOW_BLOCK || Z_LVAL_P(value) > RPA_OVERFLOW_DROP_NEWEST) {
+            return false;
+        }
+        result->policy = (rpa_queue_overflow_t) Z_LVAL_P(value);
+        result->is_set = true;
+    }
+    if ((value = zend_hash_str_find(options, ZEND_STRL("overflow_timeout"))) != NULL) {
+        if (Z_TYPE_P(value) != IS_LONG || Z_LVAL_P(value) > INT_MAX) {
+            return false;
+        }
+        result->timeout = Z_LVAL_P(value) < 0 ? RPA_WAIT_FOREVER : (int) Z_LVAL_P(value);
+        result->is_set = true;
+    }
+    if ((value = zend_hash_str_find(options, ZEND_STRL("max_capacity"))) != NULL) {
+        if (Z_TYPE_P(value) != IS_LONG || Z_LVAL_P(value) <= 0 || Z_LVAL_P(value) > UINT32_MAX) {
+            return false;
+        }
+        result->max_capacity = (uint32_t) Z_LVAL_P(value);
+        result->is_set = true;
+    }
+    return true;
+}
+
+static bool ton_overflow_options_apply(ton_overflow_options_t *options, rpa_queue_t *queue) {
+    return !options->is_set ||
+           rpa_queue_set_overflow(queue, options->policy, options->timeout, options->max_capacity);
 }
 
 /* For compatibility with older PHP versions */
@@ -148,118 +825,1068 @@ static void response_queueing_handler(
 
 /* True global resources - no need for thread safety here */
 static int res_num;
+static int cq_res_num;
+static int broadcast_res_num;
+static zend_class_entry *ton_request_ce;
+static zend_class_entry *ton_response_ce;
+static zend_object_handlers ton_request_handlers;
+static zend_object_handlers ton_response_handlers;
 /* }}} */
 
+/* For compatibility with older PHP versions */
+#if PHP_VERSION_ID >= 80000
+# define TON_PROPERTY_TYPE(code) ZEND_TYPE_INIT_CODE(code, 0, 0)
+# define TON_OBJECT_HANDLER_ARG zend_object *object
+# define TON_PROPERTY_NAME_ARG zend_string *name
+# define TON_PROPERTY_NAME_VAL ZSTR_VAL(name)
+#else
+# define TON_PROPERTY_TYPE(code) ZEND_TYPE_ENCODE(code, 0)
+# define TON_OBJECT_HANDLER_ARG zval *object
+# define TON_PROPERTY_NAME_ARG zval *name
+# define TON_PROPERTY_NAME_VAL (Z_TYPE_P(name) == IS_STRING ? Z_STRVAL_P(name) : "")
+#endif
+
+// TonRequest object holding the request data; the same data as ton_request_data_t resource holds.
+
+typedef struct ton_request_object {
+    ton_request_data_t *data;
+    zend_object std;
+} ton_request_object_t;
+
+static inline ton_request_object_t *ton_request_object_from(zend_object *object) {
+    return (ton_request_object_t *) ((char *) object - XtOffsetOf(ton_request_object_t, std));
+}
+
+#define Z_TON_REQUEST_DATA_P(zv) ton_request_object_from(Z_OBJ_P(zv))->data
+
+// TonResponse properties, in the order of declaration (see ton_response_register_class).
+
+#define TON_RESPONSE_JSON 0
+#define TON_RESPONSE_STATUS 1
+#define TON_RESPONSE_FINISHED 2
+#define TON_RESPONSE_REQUEST_ID 3
+#define TON_RESPONSE_LOST 4
+
+// Called when the request handle (resource or TonRequest object) is released.
+// Request data can't be freed until the final callback is delivered, since callbacks are still coming,
+// so the unfinished request is cancelled, and its tombstone is freed by SDK thread later
+// (or by the last of the requests joined to it).
+
+static void ton_request_data_release(ton_request_data_t *data) {
+    if (data->flight) {
+        ton_request_flight_unregister(data);
+    }
+    uint32_t state = ton_atomic_load_u32(&data->state);
+    if (!data->broadcast) {
+        // nobody can fetch its callbacks anymore; consumers of the broadcast ring still can
+        if (!(state & TON_REQUEST_SDK_DONE)) {
+            ton_request_data_cancel(data);
+        } else if (!(state & TON_REQUEST_CANCELLED)) {
+            // finished, but the requests joined to it may still be delivering callbacks
+            ton_request_data_stop(data);
+        }
+    }
+    ton_gauge_add(TON_GAUGE_ABANDONED_REQUESTS, 1);
+    if (ton_atomic_or_u32(&data->state, TON_REQUEST_RELEASED) & TON_REQUEST_SDK_DONE) {
+        ton_gauge_add(TON_GAUGE_ABANDONED_REQUESTS, -1);
+    } else {
+        TON_DBG_MSG("%p request is left to SDK thread\n", data);
+        TON_TRACE(TON_TRACE_ABANDON, data->id, 0);
+    }
+    ton_request_data_unref(data);
+}
+
 static void ton_resource_destructor(zend_resource *rsrc) /* {{{ */
 {
     TON_DBG_MSG("in ton_resource_destructor: %p\n", rsrc->ptr);
     if (rsrc->ptr) {
-        ton_request_data_t *data = (ton_request_data_t *) rsrc->ptr;
-        if (data->finished) {
-            ton_request_data_free(data);
-        } else {
-            TON_DBG_MSG("%p request marked as unused\n", rsrc->ptr);
-            data->unused = true;
-            zend_llist_add_element(&unused_requests, &data);
-        }
+        ton_request_data_release((ton_request_data_t *) rsrc->ptr);
         rsrc->ptr = NULL;
     }
 }
 /* }}} */
 
-/* {{{ string ton_create_context( string $config_json )
- */
-PHP_FUNCTION(ton_create_context)
+static void ton_completion_queue_resource_destructor(zend_resource *rsrc) /* {{{ */
 {
-    zend_string *config_json;
-
-    ZEND_PARSE_PARAMETERS_START(1, 1)
-    Z_PARAM_STR(config_json)
-    ZEND_PARSE_PARAMETERS_END();
+    TON_DBG_MSG("in ton_completion_queue_resource_destructor: %p\n", rsrc->ptr);
+    if (rsrc->ptr) {
+        ton_completion_queue_release((ton_completion_queue_t *) rsrc->ptr);
+        rsrc->ptr = NULL;
+    }
+}
+/* }}} */
 
-    TON_DBG_MSG("ton_create_context is called with config %s\n", ZSTR_VAL(config_json));
+static void ton_broadcast_consumer_resource_destructor(zend_resource *rsrc) /* {{{ */
+{
+    TON_DBG_MSG("in ton_broadcast_consumer_resource_destructor: %p\n", rsrc->ptr);
+    if (rsrc->ptr) {
+        ton_broadcast_unsubscribe((ton_broadcast_consumer_t *) rsrc->ptr);
+        rsrc->ptr = NULL;
+    }
+}
+/* }}} */
 
-    tc_string_data_t str = {ZSTR_VAL(config_json), ZSTR_LEN(config_json)};
-    tc_string_handle_t *result = tc_create_context(str);
-    tc_string_data_t json = tc_read_string(result);
-    zend_string *return_str = zend_string_init(json.content, json.len, 0);
-    tc_destroy_string(result);
+// Converts the parse tree node (and its members) into zval.
+// Object keys are created (and hashed) once per tree, and shared by all the objects having them; they are
+// not interned, since keys come from the network (e.g. addresses) and the interned table would keep growing.
+
+static void ton_json_node_to_zval(ton_json_t *tree, uint32_t *index, zend_string **keys, zval *result) {
+    ton_json_node_t *node = &tree->nodes[(*index)++];
+    uint32_t i;
+    switch (node->type) {
+        case TON_JSON_FALSE:
+            ZVAL_FALSE(result);
+            break;
+        case TON_JSON_TRUE:
+            ZVAL_TRUE(result);
+            break;
+        case TON_JSON_INT:
+#if SIZEOF_ZEND_LONG < 8
+            if (node->value.integer < ZEND_LONG_MIN || node->value.integer > ZEND_LONG_MAX) {
+                ZVAL_DOUBLE(result, (double) node->value.integer);
+                break;
+            }
+#endif
+            ZVAL_LONG(result, (zend_long) node->value.integer);
+            break;
+        case TON_JSON_DOUBLE:
+            ZVAL_DOUBLE(result, zend_strtod(tree->strings + node->value.offset, NULL));
+            break;
+        case TON_JSON_STRING:
+            if (node->len == 0) {
+                ZVAL_EMPTY_STRING(result);
+            } else {
+                ZVAL_STRINGL(result, tree->strings + node->value.offset, node->len);
+            }
+            break;
+        case TON_JSON_ARRAY:
+            array_init_size(result, node->len);
+            for (i = 0; i < node->len; i++) {
+                zval member;
+                ton_json_node_to_zval(tree, index, keys, &member);
+                zend_hash_next_index_insert_new(Z_ARRVAL_P(result), &member);
+            }
+            break;
+        case TON_JSON_OBJECT:
+            array_init_size(result, node->len);
+            for (i = 0; i < node->len; i++) {
+                zval member;
+                uint32_t key = tree->nodes[*index].key;
+                if (!keys[key]) {
+                    ton_json_key_t *k = &tree->keys[key];
+                    keys[key] = zend_string_init(tree->strings + k->offset, k->len, 0);
+                    zend_string_hash_val(keys[key]);
+                }
+                ton_json_node_to_zval(tree, index, keys, &member);
+                zend_symtable_update(Z_ARRVAL_P(result), keys[key], &member);
+            }
+            break;
+        case TON_JSON_NULL:
+        default:
+            ZVAL_NULL(result);
+            break;
+    }
+}
 
-    TON_DBG_MSG("tc_create_context returned %s\n", ZSTR_VAL(return_str));
+// Converts the parse tree into PHP value, like json_decode($json, true) does.
 
-    RETURN_STR(return_str);
+static void ton_json_to_zval(ton_json_t *tree, zval *result) {
+    zend_string **keys = tree->key_count ? ecalloc(tree->key_count, sizeof(zend_string *)) : NULL;
+    uint32_t index = 0;
+    ton_json_node_to_zval(tree, &index, keys, result);
+    for (uint32_t i = 0; i < tree->key_count; i++) {
+        if (keys[i]) {
+            zend_string_release(keys[i]);
+        }
+    }
+    if (keys) {
+        efree(keys);
+    }
 }
-/* }}} */
 
-/* {{{ void ton_destroy_context( int $context )
- */
-PHP_FUNCTION(ton_destroy_context)
-{
-    zend_long context = -1;
+// Returns callback data of the queue element; it's decoded if the request is started with 'decode' option.
+
+static void ton_callback_queue_element_data_to_zval(ton_callback_queue_element_t *e, zval *json) {
+    // Note that JSON has to be copied once more here: strings passed to the userland
+    // are freed by the engine allocator, which can't be used by the SDK threads.
+    if (e->tree) {
+        ton_stats_add(TON_STAT_BYTES_COPIED, e->tree->strings_len);
+        ton_json_to_zval(e->tree, json);
+    } else if (e->len == 0 && e->decode) {
+        ZVAL_NULL(json);
+    } else if (e->len == 0) {
+        ZVAL_EMPTY_STRING(json);
+    } else {
+        ton_stats_add(TON_STAT_BYTES_COPIED, e->len);
+        ZVAL_STRINGL(json, e->json, e->len);
+    }
+}
 
-    ZEND_PARSE_PARAMETERS_START(1, 1)
-    Z_PARAM_LONG(context)
-    ZEND_PARSE_PARAMETERS_END();
+// Converts the queue element into a tuple [json, status, finished, id, lost].
 
-    TON_DBG_MSG("calling tc_destroy_context with argument %d\n", (int)context);
-    tc_destroy_context(context);
-    TON_DBG_MSG("tc_destroy_context succeeded\n");
+static void ton_callback_queue_element_to_zval(ton_callback_queue_element_t *e, zval *tuple) {
+    zval json, status, finished, id, lost;
+    ton_callback_queue_element_data_to_zval(e, &json);
+    ZVAL_LONG(&status, e->status);
+    ZVAL_BOOL(&finished, e->finished);
+    ZVAL_LONG(&id, e->request_id);
+    ZVAL_LONG(&lost, e->lost);
+    array_init_size(tuple, 5);
+    zend_hash_next_index_insert(Z_ARRVAL_P(tuple), &json);
+    zend_hash_next_index_insert(Z_ARRVAL_P(tuple), &status);
+    zend_hash_next_index_insert(Z_ARRVAL_P(tuple), &finished);
+    zend_hash_next_index_insert(Z_ARRVAL_P(tuple), &id);
+    zend_hash_next_index_insert(Z_ARRVAL_P(tuple), &lost);
 }
-/* }}} */
 
-/* {{{ string ton_request_sync( int $context, string $function_name, string $params_json )
- */
-PHP_FUNCTION(ton_request_sync)
-{
-    zend_long context;
-    zend_string *function_name;
-    zend_string *params_json;
+// Converts the queue element into TonResponse object. Properties are set by their slots,
+// so that no property table has to be built.
+
+static void ton_callback_queue_element_to_object(ton_callback_queue_element_t *e, zval *result) {
+    object_init_ex(result, ton_response_ce);
+    zend_object *object = Z_OBJ_P(result);
+    ton_callback_queue_element_data_to_zval(e, OBJ_PROP_NUM(object, TON_RESPONSE_JSON));
+    ZVAL_LONG(OBJ_PROP_NUM(object, TON_RESPONSE_STATUS), e->status);
+    ZVAL_BOOL(OBJ_PROP_NUM(object, TON_RESPONSE_FINISHED), e->finished);
+    ZVAL_LONG(OBJ_PROP_NUM(object, TON_RESPONSE_REQUEST_ID), e->request_id);
+    ZVAL_LONG(OBJ_PROP_NUM(object, TON_RESPONSE_LOST), e->lost);
+}
 
-    ZEND_PARSE_PARAMETERS_START(3, 3)
-    Z_PARAM_LONG(context)
-    Z_PARAM_STR(function_name)
-    Z_PARAM_STR(params_json)
-    ZEND_PARSE_PARAMETERS_END();
+// Accounts the time the fetched callback has spent in the queue of the request.
 
-    TON_DBG_MSG("ton_request_sync is called with arguments %ld, %s, %s\n",
-                context,
-                ZSTR_VAL(function_name),
-                ZSTR_VAL(params_json));
+static void ton_request_data_fetched(ton_request_data_t *data, ton_callback_queue_element_t *e, uint64_t now) {
+    uint64_t lag = now > e->queued_at ? now - e->queued_at : 0;
+    TON_TRACE(TON_TRACE_DEQUEUE, data->id, lag);
+    TON_PROBE_REQUEST_DEQUEUE(data->id, lag);
+    data->fetched++;
+    data->lag_total += lag;
+    if (lag > data->lag_max) {
+        data->lag_max = lag;
+    }
+}
 
-    tc_string_data_t f_name = {ZSTR_VAL(function_name), ZSTR_LEN(function_name)};
-    tc_string_data_t f_params = {ZSTR_VAL(params_json), ZSTR_LEN(params_json)};
-    tc_string_handle_t * response_handle = tc_request_sync(context, f_name, f_params);
-    tc_string_data_t json = tc_read_string(response_handle);
-    zend_string *response_json = zend_string_init(json.content, json.len, 0);
-    tc_destroy_string(response_handle);
+// Pops the next callback from the given queue and returns it as a tuple
+// [json, status, finished, id, lost] (or TonResponse object if as_object is true)
+// via return_value, or NULL if nothing is popped. Timings of the request (if any) are updated.
 
-    RETURN_STR(response_json);
+static void ton_callback_queue_next(rpa_queue_t *queue, ton_request_data_t *data, bool has_timeout, zend_long timeout,
+                                    bool as_object, zval *return_value) {
+    TON_DBG_MSG("Calling rpa_queue_pop for queue %p; timeout = %ld\n", queue, timeout);
+    ton_callback_queue_element_t *e;
+    uint32_t lost;
+    bool result = rpa_queue_timedpop_gap(queue, (void**)&e, has_timeout ? (int)timeout : RPA_WAIT_FOREVER, &lost);
+    if (!result) {
+        TON_DBG_MSG("rpa_queue_pop for queue %p returned false\n", queue);
+        RETURN_NULL();
+    }
+
+#ifdef TON_DEBUG
+    zend_string *str = zend_string_init(e->json, e->len, 0);
+    TON_DBG_MSG("queue %p: return %s\n", queue, ZSTR_VAL(str));
+    zend_string_release(str);
+#endif
+
+    if (data) {
+        ton_request_data_fetched(data, e, ton_stats_now_ns());
+    } else {
+        TON_TRACE(TON_TRACE_DEQUEUE, e->request_id, ton_stats_now_ns() - e->queued_at);
+        TON_PROBE_REQUEST_DEQUEUE(e->request_id, ton_stats_now_ns() - e->queued_at);
+    }
+
+    // returning tuple [json, status, finished, id, lost]
+    e->lost = lost;
+    if (as_object) {
+        ton_callback_queue_element_to_object(e, return_value);
+    } else {
+        ton_callback_queue_element_to_zval(e, return_value);
+    }
+    ton_callback_queue_element_free(e);
+}
+
+// Stops batch lingering once the final callback of the request is queued,
+// since nothing is going to arrive after it.
+
+static bool ton_callback_queue_element_is_last(void *element, void *request_id) {
+    ton_callback_queue_element_t *e = element;
+    return e->finished && e->request_id == *(zend_long *)request_id;
+}
+
+static bool ton_params_encode(smart_str *buf, zval *value, int depth);
+
+static void ton_params_encode_string(smart_str *buf, const char *str, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    const char *end = str + len;
+    smart_str_appendc_ex(buf, '"', 1);
+    while (str < end) {
+        const char *start = str;
+        while (str < end && (unsigned char) *str >= 0x20 && *str != '"' && *str != '\\') {
+            str++;
+        }
+        if (str > start) {
+            smart_str_appendl_ex(buf, start, str - start, 1);
+        }
+        if (str == end) {
+            break;
+        }
+        unsigned char c = (unsigned char) *str++;
+        switch (c) {
+            case '"':
+                smart_str_appendl_ex(buf, "\\\"", 2, 1);
+                break;
+            case '\\':
+                smart_str_appendl_ex(buf, "\\\\", 2, 1);
+                break;
+            case '\n':
+                smart_str_appendl_ex(buf, "\\n", 2, 1);
+                break;
+            case '\r':
+                smart_str_appendl_ex(buf, "\\r", 2, 1);
+                break;
+            case '\t':
+                smart_str_appendl_ex(buf, "\\t", 2, 1);
+                break;
+            default: {
+                char escaped[6] = {'\\', 'u', '0', '0', digits[c >> 4], digits[c & 0xF]};
+                smart_str_appendl_ex(buf, escaped, 6, 1);
+                break;
+            }
+        }
+    }
+    smart_str_appendc_ex(buf, '"', 1);
+}
+
+// Arrays with keys 0, 1, 2... are encoded as JSON arrays, others as objects.
+
+static bool ton_params_is_list(HashTable *ht) {
+    zend_ulong expected = 0;
+    zend_ulong index;
+    zend_string *key;
+    ZEND_HASH_FOREACH_KEY(ht, index, key) {
+        if (key || index != expected++) {
+            return false;
+        }
+    } ZEND_HASH_FOREACH_END();
+    return true;
+}
+
+static bool ton_params_encode_hash(smart_str *buf, HashTable *ht, bool as_object, int depth) {
+    zend_ulong index;
+    zend_string *key;
+    zval *value;
+    bool first = true;
+    smart_str_appendc_ex(buf, as_object ? '{' : '[', 1);
+    ZEND_HASH_FOREACH_KEY_VAL_IND(ht, index, key, value) {
+        if (as_object) {
+            if (key && ZSTR_LEN(key) > 0 && ZSTR_VAL(key)[0] == '\0') {
+                // private and protected properties
+                continue;
+            }
+            if (!first) {
+                smart_str_appendc_ex(buf, ',', 1);
+            }
+            if (key) {
+                ton_params_encode_string(buf, ZSTR_VAL(key), ZSTR_LEN(key));
+            } else {
+                smart_str_appendc_ex(buf, '"', 1);
+                smart_str_append_unsigned_ex(buf, index, 1);
+                smart_str_appendc_ex(buf, '"', 1);
+            }
+            smart_str_appendc_ex(buf, ':', 1);
+        } else if (!first) {
+            smart_str_appendc_ex(buf, ',', 1);
+        }
+        first = false;
+        if (!ton_params_encode(buf, value, depth + 1)) {
+            return false;
+        }
+    } ZEND_HASH_FOREACH_END();
+    smart_str_appendc_ex(buf, as_object ? '}' : ']', 1);
+    return true;
+}
+
+// Encodes PHP value as JSON, like json_encode($value, JSON_UNESCAPED_UNICODE | JSON_UNESCAPED_SLASHES) does.
+// Returns false for values which have no JSON representation (resources, INF, NAN, recursive arrays).
+
+static bool ton_params_encode(smart_str *buf, zval *value, int depth) {
+    if (depth > PARAMS_MAX_DEPTH) {
+        return false;
+    }
+    ZVAL_DEREF(value);
+    switch (Z_TYPE_P(value)) {
+        case IS_NULL:
+            smart_str_appendl_ex(buf, "null", 4, 1);
+            return true;
+        case IS_FALSE:
+            smart_str_appendl_ex(buf, "false", 5, 1);
+            return true;
+        case IS_TRUE:
+            smart_str_appendl_ex(buf, "true", 4, 1);
+            return true;
+        case IS_LONG:
+            smart_str_append_long_ex(buf, Z_LVAL_P(value), 1);
+            return true;
+        case IS_DOUBLE:
+            if (!zend_finite(Z_DVAL_P(value))) {
+                return false;
+            }
+            // same as json_encode: shortest round-trip representation with serialize_precision=-1
+#if PHP_VERSION_ID >= 80100
+            smart_str_append_double(buf, Z_DVAL_P(value), (int) PG(serialize_precision), false);
+#else
+            {
+                char num[ZEND_DOUBLE_MAX_LENGTH];
+                php_gcvt(Z_DVAL_P(value), (int) PG(serialize_precision), '.', 'e', num);
+                smart_str_appendl_ex(buf, num, strlen(num), 1);
+            }
+#endif
+            return true;
+        case IS_STRING:
+            ton_params_encode_string(buf, Z_STRVAL_P(value), Z_STRLEN_P(value));
+            return true;
+        case IS_ARRAY: {
+            HashTable *ht = Z_ARRVAL_P(value);
+            // params are always an object, even if empty
+            return ton_params_encode_hash(buf, ht, depth == 0 || !ton_params_is_list(ht), depth);
+        }
+        case IS_OBJECT:
+            return ton_params_encode_hash(buf, Z_OBJPROP_P(value), true, depth);
+        default:
+            return false;
+    }
+}
+
+// Returns params JSON for the SDK call. Strings are passed as is, arrays and objects
+// are encoded into the buffer reused by subsequent calls (see ton_params_release).
+// Returns false if params can't be encoded.
+
+static bool ton_params_json(zval *params, tc_string_data_t *result) {
+    if (Z_TYPE_P(params) == IS_STRING) {
+        result->content = Z_STRVAL_P(params);
+        result->len = (uint32_t) Z_STRLEN_P(params);
+        return true;
+    }
+    if (Z_TYPE_P(params) != IS_ARRAY && Z_TYPE_P(params) != IS_OBJECT) {
+        return false;
+    }
+    smart_str *buf = &TON_CLIENT_G(params_buffer);
+    if (buf->s) {
+        ZSTR_LEN(buf->s) = 0;
+    }
+    if (!ton_params_encode(buf, params, 0) || ZSTR_LEN(buf->s) > UINT32_MAX) {
+        return false;
+    }
+    result->content = ZSTR_VAL(buf->s);
+    result->len = (uint32_t) ZSTR_LEN(buf->s);
+    return true;
+}
+
+// Called once the SDK is done with the params; frees the buffer if it has grown too large.
+
+static void ton_params_release(void) {
+    smart_str *buf = &TON_CLIENT_G(params_buffer);
+    if (buf->a > PARAMS_BUFFER_KEEP_SIZE) {
+        smart_str_free_ex(buf, 1);
+    }
+}
+
+// Context created by ton_create_context with $persistent flag. Kept in the module globals
+// (keyed by the config JSON), so that subsequent requests served by the same process (thread)
+// reuse it instead of initializing a new SDK client every time.
+
+typedef struct ton_persistent_context {
+    zend_long context;
+    zend_string *response;  // tc_create_context result, returned as is when the context is reused
+    time_t last_used;
+    bool used;              // by the current request; such contexts are never evicted
+} ton_persistent_context_t;
+
+static void ton_persistent_context_dtor(zval *zv) {
+    ton_persistent_context_t *pc = Z_PTR_P(zv);
+    TON_DBG_MSG("destroying persistent context %d\n", (int) pc->context);
+    tc_destroy_context((uint32_t) pc->context);
+    zend_string_release_ex(pc->response, 1);
+    pefree(pc, 1);
+}
+
+// Extracts context ID from the tc_create_context result, which is {"result": <id>} on success.
+
+static bool ton_context_id_parse(zend_string *response, zend_long *context) {
+    ton_json_t *tree = ton_json_parse(ZSTR_VAL(response), ZSTR_LEN(response));
+    if (!tree) {
+        return false;
+    }
+    bool found = false;
+    if (tree->nodes[0].type == TON_JSON_OBJECT) {
+        uint32_t i = 1;
+        while (i < tree->nodes[0].value.next) {
+            ton_json_node_t *node = &tree->nodes[i];
+            ton_json_key_t *key = &tree->keys[node->key];
+            if (node->type == TON_JSON_INT && key->len == sizeof("result") - 1 &&
+                memcmp(tree->strings + key->offset, "result", key->len) == 0) {
+                *context = (zend_long) node->value.integer;
+                found = true;
+                break;
+            }
+            i = node->type == TON_JSON_ARRAY || node->type == TON_JSON_OBJECT ? node->value.next : i + 1;
+        }
+    }
+    ton_json_free(tree);
+    return found;
 }
-/* }}}*/
 
-/* {{{ resource ton_request_start( int $context, string $function_name, string $params_json )
+static ton_persistent_context_t *ton_persistent_context_find(zend_long context) {
+    ton_persistent_context_t *pc;
+    ZEND_HASH_FOREACH_PTR(&TON_CLIENT_G(persistent_contexts), pc) {
+        if (pc->context == context) {
+            return pc;
+        }
+    } ZEND_HASH_FOREACH_END();
+    return NULL;
+}
+
+// Makes room for one more persistent context by evicting the least recently used ones.
+// Returns false if there's no room, since all of them are used by the current request.
+
+static bool ton_persistent_contexts_reserve(zend_long max_size) {
+    HashTable *contexts = &TON_CLIENT_G(persistent_contexts);
+    while ((zend_long) zend_hash_num_elements(contexts) >= max_size) {
+        zend_string *key, *lru_key = NULL;
+        ton_persistent_context_t *pc;
+        time_t lru_time = 0;
+        ZEND_HASH_FOREACH_STR_KEY_PTR(contexts, key, pc) {
+            if (!pc->used && (!lru_key || pc->last_used < lru_time)) {
+                lru_key = key;
+                lru_time = pc->last_used;
+            }
+        } ZEND_HASH_FOREACH_END();
+        if (!lru_key) {
+            return false;
+        }
+        TON_DBG_MSG("evicting persistent context for config %s\n", ZSTR_VAL(lru_key));
+        zend_hash_del(contexts, lru_key);
+    }
+    return true;
+}
+
+// Called for every persistent context at the end of the request: contexts used by the request
+// are kept for the next ones, others are destroyed once they've been idle for too long.
+
+static int ton_persistent_context_release(zval *zv, void *arg) {
+    ton_persistent_context_t *pc = Z_PTR_P(zv);
+    time_t now = time(NULL);
+    zend_long idle_timeout = *(zend_long *) arg;
+    if (pc->used) {
+        pc->used = false;
+        pc->last_used = now;
+        return ZEND_HASH_APPLY_KEEP;
+    }
+    return idle_timeout > 0 && now - pc->last_used >= idle_timeout ? ZEND_HASH_APPLY_REMOVE : ZEND_HASH_APPLY_KEEP;
+}
+
+/* {{{ string ton_create_context( string $config_json, [ bool $persistent ] )
  */
-PHP_FUNCTION(ton_request_start)
+PHP_FUNCTION(ton_create_context)
+{
+    zend_string *config_json;
+    zend_bool persistent = 0;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+    Z_PARAM_STR(config_json)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_BOOL(persistent)
+    ZEND_PARSE_PARAMETERS_END();
+
+    TON_DBG_MSG("ton_create_context is called with config %s\n", ZSTR_VAL(config_json));
+
+    ton_persistent_context_t *pc;
+    if (persistent && (pc = zend_hash_find_ptr(&TON_CLIENT_G(persistent_contexts), config_json)) != NULL) {
+        TON_DBG_MSG("reusing persistent context %d\n", (int) pc->context);
+        pc->used = true;
+        pc->last_used = time(NULL);
+        RETURN_STRINGL(ZSTR_VAL(pc->response), ZSTR_LEN(pc->response));
+    }
+
+    tc_string_data_t str = {ZSTR_VAL(config_json), ZSTR_LEN(config_json)};
+    tc_string_handle_t *result = tc_create_context(str);
+    tc_string_data_t json = tc_read_string(result);
+    zend_string *return_str = zend_string_init(json.content, json.len, 0);
+    tc_destroy_string(result);
+
+    TON_DBG_MSG("tc_create_context returned %s\n", ZSTR_VAL(return_str));
+
+    zend_long context;
+    bool cached = shared_cache || result_cache_max_size > 0;
+    bool created = (persistent || cached) && ton_context_id_parse(return_str, &context);
+    if (created && cached) {
+        // context IDs may be reused once destroyed, so stale records are simply overwritten
+        zval config_hash;
+        ZVAL_LONG(&config_hash, (zend_long) zend_hash_func(ZSTR_VAL(config_json), ZSTR_LEN(config_json)));
+        zend_hash_index_update(&TON_CLIENT_G(context_configs), (zend_ulong) context, &config_hash);
+    }
+
+    // contexts failed to be created are not kept, and neither are the ones there's no room for
+    if (persistent && created && ton_persistent_contexts_reserve(INI_INT("ton_client.persistent_contexts_max"))) {
+        pc = pemalloc(sizeof(ton_persistent_context_t), 1);
+        pc->context = context;
+        pc->response = zend_string_init(ZSTR_VAL(return_str), ZSTR_LEN(return_str), 1);
+        pc->last_used = time(NULL);
+        pc->used = true;
+        zend_hash_str_update_ptr(&TON_CLIENT_G(persistent_contexts), ZSTR_VAL(config_json), ZSTR_LEN(config_json), pc);
+    }
+
+    RETURN_STR(return_str);
+}
+/* }}} */
+
+/* {{{ void ton_destroy_context( int $context )
+ */
+PHP_FUNCTION(ton_destroy_context)
+{
+    zend_long context = -1;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_LONG(context)
+    ZEND_PARSE_PARAMETERS_END();
+
+    if (ton_persistent_context_find(context)) {
+        TON_DBG_MSG("context %d is persistent, keeping it\n", (int)context);
+        return;
+    }
+
+    zend_hash_index_del(&TON_CLIENT_G(context_configs), (zend_ulong) context);
+    TON_DBG_MSG("calling tc_destroy_context with argument %d\n", (int)context);
+    tc_destroy_context(context);
+    TON_DBG_MSG("tc_destroy_context succeeded\n");
+}
+/* }}} */
+
+// Parses comma separated list of function names (ton_client.*_cache_functions settings),
+// each optionally followed by ":<number>", e.g. TTL of the results; the number is 0 if omitted.
+
+static void ton_function_list_init(HashTable *functions, const char *list) {
+    zend_hash_init(functions, 32, NULL, NULL, 1);
+    while (list && *list) {
+        const char *end = strchr(list, ',');
+        size_t len = end ? (size_t) (end - list) : strlen(list);
+        const char *name = list;
+        list = end ? end + 1 : NULL;
+        zend_long number = 0;
+        const char *colon = memchr(name, ':', len);
+        if (colon) {
+            number = ZEND_STRTOL(colon + 1, NULL, 10);
+            len = (size_t) (colon - name);
+        }
+        while (len > 0 && isspace((unsigned char) *name)) {
+            name++;
+            len--;
+        }
+        while (len > 0 && isspace((unsigned char) name[len - 1])) {
+            len--;
+        }
+        if (len > 0) {
+            zval value;
+            ZVAL_LONG(&value, number);
+            zend_hash_str_update(functions, name, len, &value);
+        }
+    }
+}
+
+// Looks up the function in the list, either by its name or as "module.*".
+// Returns the number it's listed with, or NULL if it's not listed.
+
+static zval *ton_function_list_find(HashTable *functions, zend_string *function_name) {
+    zval *result = zend_hash_find(functions, function_name);
+    if (result) {
+        return result;
+    }
+    const char *dot = memchr(ZSTR_VAL(function_name), '.', ZSTR_LEN(function_name));
+    char pattern[64];
+    size_t len = dot ? (size_t) (dot - ZSTR_VAL(function_name)) + 1 : 0;
+    if (!dot || len + 1 >= sizeof(pattern)) {
+        return NULL;
+    }
+    memcpy(pattern, ZSTR_VAL(function_name), len);
+    pattern[len] = '*';
+    return zend_hash_str_find(functions, pattern, len + 1);
+}
+
+// Only successful responses are cached, since errors are often transient.
+
+static bool ton_response_is_success(const char *json, size_t len) {
+    static const char success_prefix[] = "{\"result\"";
+    return len >= sizeof(success_prefix) - 1 && memcmp(json, success_prefix, sizeof(success_prefix) - 1) == 0;
+}
+
+// Cached response of ton_request_sync; entries are kept in the module globals
+// (result_cache, with the key made by ton_result_cache_key) and linked in LRU order.
+
+typedef struct ton_result_cache_entry {
+    zend_string *key;
+    zend_string *response;
+    size_t size;
+    struct ton_result_cache_entry *prev;
+    struct ton_result_cache_entry *next;
+} ton_result_cache_entry_t;
+
+static void ton_result_cache_entry_dtor(zval *zv) {
+    ton_result_cache_entry_t *entry = Z_PTR_P(zv);
+    zend_string_release_ex(entry->key, 1);
+    zend_string_release_ex(entry->response, 1);
+    pefree(entry, 1);
+}
+
+// Makes the key of the call cached by either cache: hash of the context config, function name and params JSON.
+// Results depend on the context config (e.g. network functions, or crypto ones falling back to
+// the config's mnemonic dictionary and derivation path), so they are kept separately for every config.
+
+static zend_string *ton_cache_key(zval *config_hash, zend_string *function_name, tc_string_data_t *params) {
+    zend_string *key = zend_string_alloc(sizeof(zend_long) + ZSTR_LEN(function_name) + 1 + params->len, 0);
+    char *p = ZSTR_VAL(key);
+    memcpy(p, &Z_LVAL_P(config_hash), sizeof(zend_long));
+    p += sizeof(zend_long);
+    memcpy(p, ZSTR_VAL(function_name), ZSTR_LEN(function_name));
+    p += ZSTR_LEN(function_name);
+    *p++ = '\n';
+    memcpy(p, params->content, params->len);
+    p[params->len] = '\0';
+    return key;
+}
+
+// Returns the cache key of the call, or NULL if it's not cacheable; calls made with contexts
+// created by other means (i.e. unknown config) are not cached.
+
+static zend_string *ton_result_cache_key(zend_long context, zend_string *function_name, tc_string_data_t *params) {
+    zval *config_hash;
+    if (result_cache_max_size == 0 || !ton_function_list_find(&result_cache_functions, function_name) ||
+        (config_hash = zend_hash_index_find(&TON_CLIENT_G(context_configs), (zend_ulong) context)) == NULL) {
+        return NULL;
+    }
+    return ton_cache_key(config_hash, function_name, params);
+}
+
+static void ton_result_cache_unlink(ton_result_cache_entry_t *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        TON_CLIENT_G(result_cache_head) = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        TON_CLIENT_G(result_cache_tail) = entry->prev;
+    }
+}
+
+static void ton_result_cache_link_head(ton_result_cache_entry_t *entry) {
+    entry->prev = NULL;
+    entry->next = TON_CLIENT_G(result_cache_head);
+    if (entry->next) {
+        entry->next->prev = entry;
+    } else {
+        TON_CLIENT_G(result_cache_tail) = entry;
+    }
+    TON_CLIENT_G(result_cache_head) = entry;
+}
+
+// Returns the cached response, or NULL if the call is not cached.
+
+static zend_string *ton_result_cache_get(zend_string *key) {
+    ton_result_cache_entry_t *entry = zend_hash_find_ptr(&TON_CLIENT_G(result_cache), key);
+    if (!entry) {
+        TON_CLIENT_G(result_cache_misses)++;
+        return NULL;
+    }
+    TON_CLIENT_G(result_cache_hits)++;
+    if (entry != TON_CLIENT_G(result_cache_head)) {
+        ton_result_cache_unlink(entry);
+        ton_result_cache_link_head(entry);
+    }
+    return entry->response;
+}
+
+// Caches successful response, evicting the least recently used ones
+// to keep the cache within ton_client.result_cache_size bytes.
+
+static void ton_result_cache_put(zend_string *key, const char *json, size_t len) {
+    size_t size = sizeof(ton_result_cache_entry_t) + ZSTR_LEN(key) + len;
+    if (size > result_cache_max_size || !ton_response_is_success(json, len)) {
+        return;
+    }
+    while (TON_CLIENT_G(result_cache_size) + size > result_cache_max_size) {
+        ton_result_cache_entry_t *lru = TON_CLIENT_G(result_cache_tail);
+        ton_result_cache_unlink(lru);
+        TON_CLIENT_G(result_cache_size) -= lru->size;
+        TON_CLIENT_G(result_cache_evictions)++;
+        zend_hash_del(&TON_CLIENT_G(result_cache), lru->key);
+    }
+    ton_result_cache_entry_t *entry = pemalloc(sizeof(ton_result_cache_entry_t), 1);
+    entry->key = zend_string_init(ZSTR_VAL(key), ZSTR_LEN(key), 1);
+    entry->response = zend_string_init(json, len, 1);
+    entry->size = size;
+    zend_hash_update_ptr(&TON_CLIENT_G(result_cache), entry->key, entry);
+    ton_result_cache_link_head(entry);
+    TON_CLIENT_G(result_cache_size) += size;
+}
+
+// Returns the shared cache key of the call, or NULL if it's not cacheable (see ton_result_cache_key).
+
+static zend_string *ton_shared_cache_key(zend_long context, zend_string *function_name, tc_string_data_t *params,
+                                         zend_long *ttl) {
+    zval *listed, *config_hash;
+    if (!shared_cache || (listed = ton_function_list_find(&shared_cache_functions, function_name)) == NULL ||
+        (config_hash = zend_hash_index_find(&TON_CLIENT_G(context_configs), (zend_ulong) context)) == NULL) {
+        return NULL;
+    }
+    *ttl = Z_LVAL_P(listed) > 0 ? Z_LVAL_P(listed) : shared_cache_ttl;
+    if (*ttl <= 0) {
+        return NULL;
+    }
+    return ton_cache_key(config_hash, function_name, params);
+}
+
+// Response found in the shared cache.
+
+typedef struct ton_shared_cache_value {
+    char *json;
+    size_t len;
+} ton_shared_cache_value_t;
+
+// Allocates the buffer for the response found in the shared cache. It's malloc'ed rather than emalloc'ed,
+// since emalloc may bail out (on memory_limit) while the cache stripe is locked.
+
+static char *ton_shared_cache_alloc(size_t len, void *arg) {
+    ton_shared_cache_value_t *value = arg;
+    value->len = len;
+    return value->json = malloc(len ? len : 1);
+}
+
+// Returns the response of ton_request_sync, decoded if requested.
+
+static void ton_request_sync_result(const char *json, size_t len, bool decode, zval *result) {
+    ton_json_t *tree;
+    if (decode && (tree = ton_json_parse(json, len)) != NULL) {
+        ton_json_to_zval(tree, result);
+        ton_json_free(tree);
+        return;
+    }
+    ZVAL_STRINGL(result, json, len);
+}
+
+/* {{{ mixed ton_request_sync( int $context, string $function_name, string|array $params, [ bool $decode ] )
+ */
+PHP_FUNCTION(ton_request_sync)
 {
     zend_long context;
     zend_string *function_name;
-    zend_string *params_json;
+    zval *params;
+    zend_bool decode = 0;
 
-    ZEND_PARSE_PARAMETERS_START(3, 3)
+    ZEND_PARSE_PARAMETERS_START(3, 4)
     Z_PARAM_LONG(context)
     Z_PARAM_STR(function_name)
-    Z_PARAM_STR(params_json)
+    Z_PARAM_ZVAL(params)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_BOOL(decode)
     ZEND_PARSE_PARAMETERS_END();
 
-    TON_DBG_MSG("ton_request_start is called with arguments %ld, %s, %s\n",
+    tc_string_data_t f_params;
+    if (!ton_params_json(params, &f_params)) {
+        TON_DBG_MSG("ton_request_sync: params can't be encoded as JSON\n");
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_request_sync is called with arguments %ld, %s, %.*s\n",
                 context,
                 ZSTR_VAL(function_name),
-                ZSTR_VAL(params_json));
+                (int) f_params.len, f_params.content);
+
+    zend_string *cache_key = ton_result_cache_key(context, function_name, &f_params);
+    zend_string *cached;
+    if (cache_key && (cached = ton_result_cache_get(cache_key)) != NULL) {
+        TON_DBG_MSG("ton_request_sync: returning cached response\n");
+        ton_params_release();
+        zend_string_efree(cache_key);
+        ton_request_sync_result(ZSTR_VAL(cached), ZSTR_LEN(cached), decode, return_value);
+        return;
+    }
 
-    ton_request_data_t* payload = ton_request_data_create();
+    zend_long shared_ttl;
+    zend_string *shared_key = ton_shared_cache_key(context, function_name, &f_params, &shared_ttl);
+    ton_shared_cache_value_t shared;
+    time_t now = time(NULL);
+    if (shared_key && ton_shm_cache_get(shared_cache, ZSTR_VAL(shared_key), ZSTR_LEN(shared_key), (int64_t) now,
+                                        ton_shared_cache_alloc, &shared)) {
+        TON_DBG_MSG("ton_request_sync: returning response from shared cache\n");
+        ton_params_release();
+        zend_string_efree(shared_key);
+        if (cache_key) {
+            ton_result_cache_put(cache_key, shared.json, shared.len);
+            zend_string_efree(cache_key);
+        }
+        ton_request_sync_result(shared.json, shared.len, decode, return_value);
+        free(shared.json);
+        return;
+    }
+
+    tc_string_data_t f_name = {ZSTR_VAL(function_name), ZSTR_LEN(function_name)};
+    tc_string_handle_t * response_handle = tc_request_sync(context, f_name, f_params);
+    ton_params_release();
+    tc_string_data_t json = tc_read_string(response_handle);
+    if (cache_key) {
+        ton_result_cache_put(cache_key, json.content, json.len);
+        zend_string_efree(cache_key);
+    }
+    if (shared_key) {
+        if (ton_response_is_success(json.content, json.len)) {
+            ton_shm_cache_put(shared_cache, ZSTR_VAL(shared_key), ZSTR_LEN(shared_key), json.content, json.len,
+                              (int64_t) now, (int64_t) now + shared_ttl);
+        }
+        zend_string_efree(shared_key);
+    }
+    ton_request_sync_result(json.content, json.len, decode, return_value);
+    tc_destroy_string(response_handle);
+}
+/* }}}*/
+
+// Key of the single-flight request in the registry (persistent, since single-flight requests
+// may outlive the PHP request which has started them).
+
+static zend_string *ton_request_flight_key(zend_long context, zend_string *function_name, tc_string_data_t *params,
+                                           bool decode) {
+    zend_string *key = zend_string_alloc(sizeof(zend_long) + 1 + ZSTR_LEN(function_name) + 1 + params->len, 1);
+    char *p = ZSTR_VAL(key);
+    memcpy(p, &context, sizeof(zend_long));
+    p += sizeof(zend_long);
+    *p++ = decode ? '1' : '0';
+    memcpy(p, ZSTR_VAL(function_name), ZSTR_LEN(function_name));
+    p += ZSTR_LEN(function_name);
+    *p++ = '\n';
+    memcpy(p, params->content, params->len);
+    p[params->len] = '\0';
+    return key;
+}
+
+// Starts TON SDK request; used by both ton_request_start and TonRequest::start.
+// Returns NULL if params or options are invalid, or if the broadcast ring can't be allocated (throwing Error).
+
+static ton_request_data_t *ton_request_begin(zend_long context, zend_string *function_name, zval *params,
+                                             ton_completion_queue_t *cq, HashTable *options) {
+    ton_overflow_options_t overflow;
+    if (!ton_overflow_options_parse(options, CALLBACK_QUEUE_CAPACITY, &overflow)) {
+        TON_DBG_MSG("ton_request_start: invalid options\n");
+        return NULL;
+    }
+    if (cq && overflow.is_set) {
+        TON_DBG_MSG("ton_request_start: overflow options must be set for the completion queue instead\n");
+        return NULL;
+    }
+    zval *decode = options ? zend_hash_str_find(options, ZEND_STRL("decode")) : NULL;
+    zval *single_flight = options ? zend_hash_str_find(options, ZEND_STRL("single_flight")) : NULL;
+    if (cq && single_flight && zend_is_true(single_flight)) {
+        TON_DBG_MSG("ton_request_start: single-flight requests can't be bound to the completion queue\n");
+        return NULL;
+    }
+    zval *broadcast = options ? zend_hash_str_find(options, ZEND_STRL("broadcast")) : NULL;
+    zval *retention = options ? zend_hash_str_find(options, ZEND_STRL("retention")) : NULL;
+    if (broadcast && zend_is_true(broadcast)) {
+        if (cq || overflow.is_set) {
+            TON_DBG_MSG("ton_request_start: broadcast requests have neither completion queue nor overflow policy\n");
+            return NULL;
+        }
+        if (retention && (Z_TYPE_P(retention) != IS_LONG || Z_LVAL_P(retention) < 0 ||
+                          Z_LVAL_P(retention) > BROADCAST_MAX_RETENTION)) {
+            TON_DBG_MSG("ton_request_start: invalid retention\n");
+            return NULL;
+        }
+    } else {
+        broadcast = NULL;
+    }
+
+    tc_string_data_t f_params;
+    if (!ton_params_json(params, &f_params)) {
+        TON_DBG_MSG("ton_request_start: params can't be encoded as JSON\n");
+        return NULL;
+    }
+
+    TON_DBG_MSG("ton_request_start is called with arguments %ld, %s, %.*s\n",
+                context,
+                ZSTR_VAL(function_name),
+                (int) f_params.len, f_params.content);
+
+    ton_request_data_t* payload = ton_request_data_create(cq);
+    payload->decode = decode && zend_is_true(decode);
+    payload->started_at = ton_stats_now_ns();
+    if (payload->queue && !ton_overflow_options_apply(&overflow, payload->queue)) {
+        TON_DBG_MSG("ton_request_start: overflow policy %d is not supported\n", overflow.policy);
+        ton_request_data_free(payload);
+        return NULL;
+    }
+    if (broadcast) {
+        // events are kept in the ring, where every consumer reads them (see ton_broadcast_subscribe)
+        uint32_t window = retention ? (uint32_t) Z_LVAL_P(retention) : 0;
+        payload->broadcast = ton_broadcast_create(window + CALLBACK_QUEUE_CAPACITY, window,
+                                                  ton_callback_queue_element_ref,
+                                                  ton_callback_queue_element_unref);
+        if (!payload->broadcast) {
+            ton_request_data_free(payload);
+            ton_params_release();
+            zend_throw_error(NULL, "Failed to allocate the broadcast ring of %u events", window + CALLBACK_QUEUE_CAPACITY);
+            return NULL;
+        }
+        ton_request_data_shutdown_queue(payload);
+    }
+    if (single_flight && zend_is_true(single_flight)) {
+        zend_string *key = ton_request_flight_key(context, function_name, &f_params, payload->decode);
+        ton_request_data_t *leader = zend_hash_find_ptr(&TON_CLIENT_G(single_flights), key);
+        if (leader && ton_request_flight_follow(leader->flight, payload)) {
+            TON_DBG_MSG("ton_request_start: request %p follows request %p\n", payload, leader);
+            ton_atomic_add_u64(&single_flight_followers, 1);
+            ton_stats_add(TON_STAT_REQUESTS_STARTED, 1);
+            TON_TRACE(TON_TRACE_START, payload->id, context);
+            TON_PROBE_REQUEST_START(payload->id, context);
+            zend_string_release_ex(key, 1);
+            ton_params_release();
+            return payload;
+        }
+        ton_request_flight_lead(payload, key);
+    }
     tc_string_data_t f_name = {ZSTR_VAL(function_name), ZSTR_LEN(function_name)};
-    tc_string_data_t f_params = {ZSTR_VAL(params_json), ZSTR_LEN(params_json)};
+    ton_stats_add(TON_STAT_REQUESTS_STARTED, 1);
+    TON_TRACE(TON_TRACE_START, payload->id, context);
+    TON_PROBE_REQUEST_START(payload->id, context);
     tc_request_ptr(context, f_name, f_params, payload, &response_queueing_handler);
+    ton_params_release();
+    return payload;
+}
+
+/* {{{ resource ton_request_start( int $context, string $function_name, string|array $params, [ ?resource $completion_queue, [ array $options ] ] )
+ */
+PHP_FUNCTION(ton_request_start)
+{
+    zend_long context;
+    zend_string *function_name;
+    zval *params;
+    zval *cq_res = NULL;
+    HashTable *options = NULL;
+
+    ZEND_PARSE_PARAMETERS_START(3, 5)
+    Z_PARAM_LONG(context)
+    Z_PARAM_STR(function_name)
+    Z_PARAM_ZVAL(params)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_RESOURCE_EX(cq_res, 1, 0)
+    Z_PARAM_ARRAY_HT(options)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_completion_queue_t *cq = NULL;
+    if (cq_res && (cq = (ton_completion_queue_t*)zend_fetch_resource(Z_RES_P(cq_res), "ton_completion_queue_t", cq_res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    ton_request_data_t* payload = ton_request_begin(context, function_name, params, cq, options);
+    if (!payload) {
+        RETURN_NULL();
+    }
 
     TON_DBG_MSG("ton_request_start returned with resource %p\n", payload);
 
@@ -274,185 +1901,1563 @@ PHP_FUNCTION(ton_request_id)
 {
     zval *res;
 
-    ZEND_PARSE_PARAMETERS_START(1, 1)
-    Z_PARAM_RESOURCE(res)
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_RESOURCE(res)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t * data;
+    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_request_id is called for request %p\n", data);
+    TON_DBG_MSG("ton_request_id (%p): return %ld\n", data, data->id);
+    RETURN_LONG(data->id);
+}
+/* }}}*/
+
+// Returns a stream (via return_value) which is readable while the queue has events,
+// creating the queue notification descriptor on the first call.
+
+static void ton_callback_queue_stream(rpa_queue_t *queue, zval *return_value) {
+#ifdef TON_WINDOWS
+    TON_DBG_MSG("notification streams are not supported on Windows\n");
+    RETURN_NULL();
+#else
+    if (rpa_queue_notify_fd(queue) < 0) {
+        int read_fd, write_fd;
+        if (!ton_notifier_fd_create(&read_fd, &write_fd)) {
+            TON_DBG_MSG("failed to create notification descriptor for queue %p\n", queue);
+            RETURN_NULL();
+        }
+        if (!rpa_queue_set_notify_fd(queue, read_fd, write_fd)) {
+            ton_notifier_fd_close(read_fd, write_fd);
+            RETURN_NULL();
+        }
+    }
+
+    // Stream owns a duplicate, so closing it doesn't affect the queue.
+    int fd = dup(rpa_queue_notify_fd(queue));
+    if (fd < 0) {
+        RETURN_NULL();
+    }
+    php_stream *stream = php_stream_fopen_from_fd(fd, "r", NULL);
+    if (!stream) {
+        close(fd);
+        RETURN_NULL();
+    }
+    TON_DBG_MSG("notification stream for queue %p uses descriptor %d\n", queue, fd);
+    php_stream_to_zval(stream, return_value);
+#endif
+}
+
+/* {{{ ?resource ton_request_stream( resource $request )
+ */
+PHP_FUNCTION(ton_request_stream)
+{
+    zval *res;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_RESOURCE(res)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t * data;
+    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_request_stream is called for request %p\n", data);
+    if (!data->queue) {
+        TON_DBG_MSG("request %p has no queue of its own\n", data);
+        RETURN_NULL();
+    }
+
+    ton_callback_queue_stream(data->queue, return_value);
+}
+/* }}}*/
+
+/* {{{ array ton_request_next( resource $request, int $timeout )
+ */
+PHP_FUNCTION(ton_request_next)
+{
+    zval *res;
+    zend_long timeout = -1;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+    Z_PARAM_RESOURCE(res)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(timeout)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t * data;
+    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_request_next is called for request %p\n", data);
+    if (!data->queue) {
+        TON_DBG_MSG("request %p has no queue of its own\n", data);
+        RETURN_NULL();
+    }
+
+    ton_callback_queue_next(data->queue, data, ZEND_NUM_ARGS() > 1, timeout, false, return_value);
+    TON_DBG_MSG("ton_request_next (%p) finished\n", data);
+}
+/* }}}*/
+
+// Fetches up to max_items callbacks of the request; see ton_request_next_batch.
+
+static void ton_request_next_batch_impl(ton_request_data_t *data, zend_long max_items, zend_long max_wait_ms,
+                                        bool as_object, zval *return_value) {
+    TON_DBG_MSG("ton_request_next_batch is called for request %p; max_items = %ld, max_wait_ms = %ld\n",
+                data, max_items, max_wait_ms);
+    if (!data->queue) {
+        TON_DBG_MSG("request %p has no queue of its own\n", data);
+        RETURN_NULL();
+    }
+    if (max_items <= 0) {
+        TON_DBG_MSG("ton_request_next_batch: invalid max_items %ld\n", max_items);
+        RETURN_NULL();
+    }
+
+    // Queue can't hold more than that anyway.
+    if (max_items > CALLBACK_QUEUE_CAPACITY) {
+        max_items = CALLBACK_QUEUE_CAPACITY;
+    }
+
+    ton_callback_queue_element_t *elements[CALLBACK_QUEUE_CAPACITY];
+    uint32_t lost[CALLBACK_QUEUE_CAPACITY];
+    uint32_t count = rpa_queue_timedpopn(data->queue, (void**)elements, lost, (uint32_t) max_items,
+                                         max_wait_ms < 0 ? RPA_WAIT_FOREVER : (int) max_wait_ms,
+                                         ton_callback_queue_element_is_last, &data->id);
+
+    uint64_t now = count ? ton_stats_now_ns() : 0;
+    array_init_size(return_value, count);
+    for (uint32_t i = 0; i < count; i++) {
+        zval tuple;
+        ton_request_data_fetched(data, elements[i], now);
+        elements[i]->lost = lost[i];
+        if (as_object) {
+            ton_callback_queue_element_to_object(elements[i], &tuple);
+        } else {
+            ton_callback_queue_element_to_zval(elements[i], &tuple);
+        }
+        ton_callback_queue_element_free(elements[i]);
+        zend_hash_next_index_insert(Z_ARRVAL_P(return_value), &tuple);
+    }
+
+    TON_DBG_MSG("ton_request_next_batch (%p) returning %d events\n", data, count);
+}
+
+/* {{{ ?array ton_request_next_batch( resource $request, int $max_items, [ int $max_wait_ms ] )
+ */
+PHP_FUNCTION(ton_request_next_batch)
+{
+    zval *res;
+    zend_long max_items;
+    zend_long max_wait_ms = 0;
+
+    ZEND_PARSE_PARAMETERS_START(2, 3)
+    Z_PARAM_RESOURCE(res)
+    Z_PARAM_LONG(max_items)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(max_wait_ms)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t * data;
+    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    ton_request_next_batch_impl(data, max_items, max_wait_ms, false, return_value);
+}
+/* }}}*/
+
+/* {{{ bool ton_request_join( resource $request, resource $request2 )
+ */
+PHP_FUNCTION(ton_request_join)
+{
+    zval *res;
+    zval *res2;
+
+    ZEND_PARSE_PARAMETERS_START(2, 2)
+    Z_PARAM_RESOURCE(res)
+    Z_PARAM_RESOURCE(res2)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t * data, *data2;
+    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL ||
+        (data2 = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res2), "ton_request_data_t", res_num)) == NULL) {
+        if (data == NULL) TON_DBG_MSG("Invalid resource for $request\n");
+        if (data2 == NULL) TON_DBG_MSG("Invalid resource for $request2\n");
+        RETURN_FALSE;
+    }
+
+    TON_DBG_MSG("ton_request_join is called for requests %p, %p\n", data, data2);
+    if (data == data2) {
+        TON_DBG_MSG("Request can't be joined to itself\n");
+        RETURN_FALSE;
+    }
+    if (data->broadcast || data2->broadcast) {
+        TON_DBG_MSG("Broadcast requests can't be joined\n");
+        RETURN_FALSE;
+    }
+    if ((data->state | data2->state) & TON_REQUEST_CANCELLED) {
+        TON_DBG_MSG("Cancelled requests can't be joined\n");
+        RETURN_FALSE;
+    }
+    if (!data2->joined_to) {
+        TON_TRACE(TON_TRACE_JOIN, data2->id, data->id);
+        // the joined request holds the target until its final callback is delivered
+        ton_atomic_add_u32(&data->refcount, 1);
+        data2->joined_to = data;
+        ton_atomic_exchange_ptr((void *volatile *) &data2->join_ref, data);
+        if (ton_atomic_load_u32(&data2->state) & TON_REQUEST_SDK_DONE) {
+            // already finished, so the reference may not be dropped by SDK thread
+            ton_request_join_unref(data2);
+        }
+        TON_DBG_MSG("request %p started to receive all events of request %p\n", data, data2);
+        RETURN_TRUE;
+    } else {
+        TON_DBG_MSG("Request %p already used for join", data2);
+        RETURN_FALSE;
+    }
+}
+/* }}}*/
+
+/* {{{ bool ton_request_disconnect( resource $request, resource $request2 )
+ */
+PHP_FUNCTION(ton_request_disconnect)
+{
+    zval *res;
+    zval *res2;
+
+    ZEND_PARSE_PARAMETERS_START(2, 2)
+    Z_PARAM_RESOURCE(res)
+    Z_PARAM_RESOURCE(res2)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t * data, *data2;
+    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL ||
+        (data2 = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res2), "ton_request_data_t", res_num)) == NULL) {
+        if (data == NULL) TON_DBG_MSG("Invalid resource for $request\n");
+        if (data2 == NULL) TON_DBG_MSG("Invalid resource for $request2\n");
+        RETURN_FALSE;
+    }
+
+    TON_DBG_MSG("ton_request_disconnect is called for requests %p, %p\n", data, data2);
+    if (data2->joined_to == data){
+        TON_TRACE(TON_TRACE_DISCONNECT, data2->id, data->id);
+        data2->joined_to = NULL;
+        ton_atomic_fence();
+        // callbacks which have read the target have referenced it as well
+        while (ton_atomic_load_u32(&data2->joining)) {
+            ton_thread_yield();
+        }
+        ton_request_join_unref(data2);
+        TON_DBG_MSG("request %p disconnected from %p\n", data, data2);
+        RETURN_TRUE;
+    } else {
+        TON_DBG_MSG("WARNING: request %p was not joined to %p\n", data, data2);
+        RETURN_FALSE;
+    }
+}
+/* }}}*/
+
+// Request is finished once its final callback is received and fetched.
+
+static bool ton_request_is_finished(ton_request_data_t *data) {
+    // final callback is queued before the request is marked finished
+    bool finished = ton_atomic_load_u32(&data->finished);
+    uint32_t size = data->queue ? rpa_queue_size(data->queue) : 0;
+    bool result = finished && size == 0;
+    TON_DBG_MSG("is_ton_request_finished returning %d for request %p (finished: %d, queue size: %d)\n",
+                result, data, data->finished, size);
+    return result;
+}
+
+/* {{{ ?bool is_ton_request_finished( resource $request )
+ */
+PHP_FUNCTION(is_ton_request_finished)
+{
+    zval *res;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+        Z_PARAM_RESOURCE(res)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t* data;
+    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("is_ton_request_finished is called for request %p\n", data);
+
+    RETURN_BOOL(ton_request_is_finished(data));
+}
+/* }}}*/
+
+/* {{{ ?int ton_request_last_status( resource $request )
+ */
+PHP_FUNCTION(ton_request_last_status)
+{
+    zval *res;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_RESOURCE(res)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t* data;
+    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_request_last_status is called for request %p\n", data);
+    TON_DBG_MSG("ton_request_last_status returning %d for request %p\n", data->last_status, data);
+
+    RETURN_LONG(data->last_status);
+}
+/* }}}*/
+
+// Fetches request data from all the resources (or TonRequest objects) in the given array
+// into a newly allocated (emalloc) array.
+// Returns NULL if any of the array elements is not a valid request resource, and throws Error
+// if any of the requests is bound to a completion queue, since their events are only tracked there
+// (see ton_completion_queue_next).
+
+static ton_request_data_t **ton_request_data_fetch_all(HashTable *requests, uint32_t *count) {
+    ton_request_data_t **result = safe_emalloc(zend_hash_num_elements(requests), sizeof(ton_request_data_t *), 0);
+    uint32_t n = 0;
+    zval *res;
+    ZEND_HASH_FOREACH_VAL(requests, res) {
+        ZVAL_DEREF(res);
+        if (Z_TYPE_P(res) == IS_OBJECT && Z_OBJCE_P(res) == ton_request_ce && Z_TON_REQUEST_DATA_P(res)) {
+            result[n] = Z_TON_REQUEST_DATA_P(res);
+        } else if (Z_TYPE_P(res) != IS_RESOURCE ||
+            (result[n] = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
+            efree(result);
+            return NULL;
+        }
+        if (result[n]->cq) {
+            efree(result);
+            zend_throw_error(NULL, "Requests bound to a completion queue can't be waited for");
+            return NULL;
+        }
+        n++;
+    } ZEND_HASH_FOREACH_END();
+    *count = n;
+    return result;
+}
+
+/* {{{ ?array ton_request_wait_any( array $requests, [ int $timeout ] )
+ */
+PHP_FUNCTION(ton_request_wait_any)
+{
+    HashTable *requests;
+    zend_long timeout = -1;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+    Z_PARAM_ARRAY_HT(requests)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(timeout)
+    ZEND_PARSE_PARAMETERS_END();
+
+    uint32_t count;
+    ton_request_data_t **data;
+    if ((data = ton_request_data_fetch_all(requests, &count)) == NULL) {
+        TON_DBG_MSG("ton_request_wait_any: invalid resource passed\n");
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_request_wait_any is called for %d requests; timeout = %ld\n", count, timeout);
+    ton_request_wait(data, count, timeout, false);
+
+    array_init(return_value);
+    uint32_t i = 0;
+    zend_string *key;
+    zend_ulong index;
+    zval *res;
+    ZEND_HASH_FOREACH_KEY_VAL(requests, index, key, res) {
+        if (ton_request_has_events(data[i++])) {
+            Z_TRY_ADDREF_P(res);
+            if (key) {
+                zend_hash_update(Z_ARRVAL_P(return_value), key, res);
+            } else {
+                zend_hash_index_update(Z_ARRVAL_P(return_value), index, res);
+            }
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    efree(data);
+    TON_DBG_MSG("ton_request_wait_any returning %d ready requests\n", zend_hash_num_elements(Z_ARRVAL_P(return_value)));
+}
+/* }}}*/
+
+/* {{{ ?bool ton_request_wait_all( array $requests, [ int $timeout ] )
+ */
+PHP_FUNCTION(ton_request_wait_all)
+{
+    HashTable *requests;
+    zend_long timeout = -1;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+    Z_PARAM_ARRAY_HT(requests)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(timeout)
+    ZEND_PARSE_PARAMETERS_END();
+
+    uint32_t count;
+    ton_request_data_t **data;
+    if ((data = ton_request_data_fetch_all(requests, &count)) == NULL) {
+        TON_DBG_MSG("ton_request_wait_all: invalid resource passed\n");
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_request_wait_all is called for %d requests; timeout = %ld\n", count, timeout);
+    bool result = ton_request_wait(data, count, timeout, true);
+    efree(data);
+
+    TON_DBG_MSG("ton_request_wait_all returning %d\n", result);
+    RETURN_BOOL(result);
+}
+/* }}}*/
+
+// Request can be awaited once it has a callback queued,
+// or once it's finished, since nothing is going to arrive for it anymore.
+
+static bool ton_request_await_ready(ton_request_data_t *data) {
+    return ton_request_has_events(data) || data->finished || (data->state & TON_REQUEST_CANCELLED);
+}
+
+#if PHP_VERSION_ID >= 80100
+
+// Fiber suspended by ton_await until its request is ready (or the deadline is reached);
+// resumed by the scheduler running in the main context, see ton_await_schedule.
+
+typedef struct ton_await_waiter {
+    zend_fiber *fiber;
+    ton_request_data_t *data;
+    bool has_deadline;
+    struct timespec deadline;
+} ton_await_waiter_t;
+
+static void ton_await_add(zend_fiber *fiber, ton_request_data_t *data, const struct timespec *deadline) {
+    if (TON_CLIENT_G(await_count) == TON_CLIENT_G(await_capacity)) {
+        uint32_t capacity = TON_CLIENT_G(await_capacity) ? TON_CLIENT_G(await_capacity) * 2 : 8;
+        TON_CLIENT_G(await_waiters) = safe_erealloc(
+                TON_CLIENT_G(await_waiters), capacity, sizeof(ton_await_waiter_t), 0);
+        TON_CLIENT_G(await_capacity) = capacity;
+    }
+    ton_await_waiter_t *w = &TON_CLIENT_G(await_waiters)[TON_CLIENT_G(await_count)++];
+    // the fiber must stay alive while it's waiting, even if nothing else references it
+    GC_ADDREF(&fiber->std);
+    w->fiber = fiber;
+    w->data = data;
+    w->has_deadline = deadline != NULL;
+    if (deadline) {
+        w->deadline = *deadline;
+    }
+}
+
+// Removes the waiter at the given position and returns its fiber,
+// which must be released by the caller.
+
+static zend_fiber *ton_await_remove_at(uint32_t i) {
+    ton_await_waiter_t *waiters = TON_CLIENT_G(await_waiters);
+    zend_fiber *fiber = waiters[i].fiber;
+    waiters[i] = waiters[--TON_CLIENT_G(await_count)];
+    return fiber;
+}
+
+static void ton_await_remove(zend_fiber *fiber) {
+    for (uint32_t i = 0; i < TON_CLIENT_G(await_count); i++) {
+        if (TON_CLIENT_G(await_waiters)[i].fiber == fiber) {
+            OBJ_RELEASE(&ton_await_remove_at(i)->std);
+            return;
+        }
+    }
+}
+
+// Resumes every waiting fiber whose request is ready or whose deadline is reached.
+// Resumed fibers may suspend in ton_await again, so the list is rescanned after each of them.
+// Returns the number of resumed fibers.
+
+static uint32_t ton_await_resume_ready(void) {
+    uint32_t resumed = 0;
+    uint32_t i = 0;
+    while (i < TON_CLIENT_G(await_count) && !EG(exception)) {
+        ton_await_waiter_t *w = &TON_CLIENT_G(await_waiters)[i];
+        if (!ton_request_await_ready(w->data) && !(w->has_deadline && get_remaining_ms(w->deadline) == 0)) {
+            i++;
+            continue;
+        }
+        // the last waiter is moved into the slot of the removed one
+        ton_request_data_t *data = w->data;
+        zend_fiber *fiber = ton_await_remove_at(i);
+        TON_DBG_MSG("resuming fiber %p awaiting request %p\n", fiber, data);
+        zval retval;
+        ZVAL_UNDEF(&retval);
+        zend_call_method(&fiber->std, zend_ce_fiber, NULL, ZEND_STRL("resume"), &retval, 0, NULL, NULL);
+        zval_ptr_dtor(&retval);
+        OBJ_RELEASE(&fiber->std);
+        resumed++;
+        i = 0;
+    }
+    return resumed;
+}
+
+// Earliest deadline of the waiting fibers, if any of them has one.
+
+static bool ton_await_next_deadline(struct timespec *result) {
+    bool found = false;
+    for (uint32_t i = 0; i < TON_CLIENT_G(await_count); i++) {
+        ton_await_waiter_t *w = &TON_CLIENT_G(await_waiters)[i];
+        if (w->has_deadline && (!found || w->deadline.tv_sec < result->tv_sec ||
+                                (w->deadline.tv_sec == result->tv_sec && w->deadline.tv_nsec < result->tv_nsec))) {
+            *result = w->deadline;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Scheduler of the fibers suspended by ton_await. Resumes them as their requests become ready,
+// and blocks the thread only when none of them can be resumed. Returns once the given request
+// is ready (or, if no request is given, once any fibers are resumed or none are waiting),
+// or the timeout expires. Returns the number of resumed fibers.
+
+static uint32_t ton_await_schedule(ton_request_data_t *data, zend_long timeout) {
+    struct timespec deadline;
+    if (timeout > 0) {
+        deadline = get_future_timespec((int) timeout);
+    }
+    uint32_t total = 0;
+    uint64_t seq = ton_notifier_begin_wait(&request_notifier);
+    for (;;) {
+        total += ton_await_resume_ready();
+        if (EG(exception)) {
+            break;
+        }
+        if (data ? ton_request_await_ready(data) : (total > 0 || TON_CLIENT_G(await_count) == 0)) {
+            break;
+        }
+        if (timeout == 0 || (timeout > 0 && get_remaining_ms(deadline) == 0)) {
+            break;
+        }
+        struct timespec wake;
+        bool has_wake = ton_await_next_deadline(&wake);
+        if (timeout > 0 && (!has_wake || deadline.tv_sec < wake.tv_sec ||
+                            (deadline.tv_sec == wake.tv_sec && deadline.tv_nsec < wake.tv_nsec))) {
+            wake = deadline;
+            has_wake = true;
+        }
+        // deadlines are checked on the next iteration, so the result doesn't matter here
+        ton_notifier_wait(&request_notifier, &seq, has_wake ? &wake : NULL);
+    }
+    ton_notifier_end_wait(&request_notifier);
+    return total;
+}
+
+#endif
+
+// Releases the fibers left waiting at the end of the request.
+
+static void ton_await_clean(void) {
+#if PHP_VERSION_ID >= 80100
+    while (TON_CLIENT_G(await_count) > 0) {
+        OBJ_RELEASE(&ton_await_remove_at(TON_CLIENT_G(await_count) - 1)->std);
+    }
+#endif
+    if (TON_CLIENT_G(await_waiters)) {
+        efree(TON_CLIENT_G(await_waiters));
+        TON_CLIENT_G(await_waiters) = NULL;
+    }
+    TON_CLIENT_G(await_capacity) = 0;
+}
+
+// Returns the next callback of the request like ton_request_next does, except that
+// inside a Fiber the fiber is suspended instead of blocking the thread, and outside of
+// fibers the suspended ones are resumed while waiting; see ton_await_schedule.
+
+static void ton_request_await(ton_request_data_t *data, zend_long timeout, bool as_object, zval *return_value) {
+    if (!data->queue) {
+        TON_DBG_MSG("request %p has no queue of its own\n", data);
+        RETURN_NULL();
+    }
+#if PHP_VERSION_ID >= 80100
+    zend_fiber *fiber = EG(active_fiber);
+    if (fiber) {
+        struct timespec deadline;
+        if (timeout > 0) {
+            deadline = get_future_timespec((int) timeout);
+        }
+        while (timeout != 0 && !ton_request_await_ready(data)) {
+            if (timeout > 0 && get_remaining_ms(deadline) == 0) {
+                break;
+            }
+            TON_DBG_MSG("suspending fiber %p awaiting request %p\n", fiber, data);
+            ton_await_add(fiber, data, timeout > 0 ? &deadline : NULL);
+            zval retval;
+            ZVAL_UNDEF(&retval);
+            zend_call_method(NULL, zend_ce_fiber, NULL, ZEND_STRL("suspend"), &retval, 0, NULL, NULL);
+            zval_ptr_dtor(&retval);
+            // still registered if resumed by anything other than the scheduler
+            ton_await_remove(fiber);
+            if (EG(exception)) {
+                RETURN_NULL();
+            }
+        }
+    } else {
+        ton_await_schedule(data, timeout);
+        if (EG(exception)) {
+            RETURN_NULL();
+        }
+    }
+    if (!data->queue) {
+        // cancelled while waiting
+        RETURN_NULL();
+    }
+    ton_callback_queue_next(data->queue, data, true, 0, as_object, return_value);
+#else
+    ton_callback_queue_next(data->queue, data, timeout >= 0, timeout, as_object, return_value);
+#endif
+}
+
+/* {{{ array|TonResponse|null ton_await( resource|TonRequest $request, [ int $timeout ] )
+ */
+PHP_FUNCTION(ton_await)
+{
+    zval *request;
+    zend_long timeout = -1;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+    Z_PARAM_ZVAL(request)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(timeout)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t *data;
+    bool as_object = Z_TYPE_P(request) == IS_OBJECT && Z_OBJCE_P(request) == ton_request_ce;
+    if (as_object) {
+        data = Z_TON_REQUEST_DATA_P(request);
+    } else if (Z_TYPE_P(request) == IS_RESOURCE) {
+        data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(request), "ton_request_data_t", res_num);
+    } else {
+        data = NULL;
+    }
+    if (!data) {
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_await is called for request %p; timeout = %ld\n", data, timeout);
+    ton_request_await(data, timeout, as_object, return_value);
+}
+/* }}}*/
+
+/* {{{ int ton_await_run( [ int $timeout ] )
+ */
+PHP_FUNCTION(ton_await_run)
+{
+    zend_long timeout = -1;
+
+    ZEND_PARSE_PARAMETERS_START(0, 1)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(timeout)
+    ZEND_PARSE_PARAMETERS_END();
+
+#if PHP_VERSION_ID >= 80100
+    TON_DBG_MSG("ton_await_run is called; %d fibers waiting, timeout = %ld\n", TON_CLIENT_G(await_count), timeout);
+    RETURN_LONG(ton_await_schedule(NULL, timeout));
+#else
+    RETURN_LONG(0);
+#endif
+}
+/* }}}*/
+
+// Call made by ton_request_all.
+
+typedef struct ton_request_all_call {
+    ton_request_data_t *data;
+    zval result;
+    bool done;
+} ton_request_all_call_t;
+
+// Converts the response of the call made by ton_request_all into the same form
+// as ton_request_sync returns: {"result": ...} or {"error": ...}.
+
+static void ton_request_all_result(ton_callback_queue_element_t *e, zval *result) {
+    const char *key = e->status == tc_response_error ? "error" : "result";
+    if (e->decode) {
+        zval data;
+        ton_callback_queue_element_data_to_zval(e, &data);
+        array_init_size(result, 1);
+        add_assoc_zval(result, key, &data);
+        return;
+    }
+    size_t key_len = strlen(key);
+    const char *json = e->len > 0 ? e->json : "null";
+    size_t len = e->len > 0 ? e->len : 4;
+    zend_string *str = zend_string_alloc(key_len + len + 5, 0);
+    char *p = ZSTR_VAL(str);
+    *p++ = '{';
+    *p++ = '"';
+    memcpy(p, key, key_len);
+    p += key_len;
+    *p++ = '"';
+    *p++ = ':';
+    memcpy(p, json, len);
+    p += len;
+    *p++ = '}';
+    *p = '\0';
+    ZVAL_STR(result, str);
+}
+
+/* {{{ ?array ton_request_all( int $context, array $calls, [ int $timeout, [ bool $decode ] ] )
+ */
+PHP_FUNCTION(ton_request_all)
+{
+    zend_long context;
+    HashTable *calls;
+    zend_long timeout = -1;
+    zend_bool decode = 0;
+
+    ZEND_PARSE_PARAMETERS_START(2, 4)
+    Z_PARAM_LONG(context)
+    Z_PARAM_ARRAY_HT(calls)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(timeout)
+    Z_PARAM_BOOL(decode)
+    ZEND_PARSE_PARAMETERS_END();
+
+    uint32_t count = zend_hash_num_elements(calls);
+    zval *call;
+    ZEND_HASH_FOREACH_VAL(calls, call) {
+        zval *function_name, *params;
+        ZVAL_DEREF(call);
+        if (Z_TYPE_P(call) != IS_ARRAY ||
+            (function_name = zend_hash_index_find(Z_ARRVAL_P(call), 0)) == NULL ||
+            (params = zend_hash_index_find(Z_ARRVAL_P(call), 1)) == NULL ||
+            Z_TYPE_P(function_name) != IS_STRING) {
+            TON_DBG_MSG("ton_request_all: calls must be [function_name, params] pairs\n");
+            RETURN_NULL();
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    TON_DBG_MSG("ton_request_all is called for %d calls; timeout = %ld\n", count, timeout);
+
+    // All the calls are delivered to a single queue, so that one wait serves all of them.
+    ton_completion_queue_t *cq = ton_completion_queue_create(
+            count > CALLBACK_QUEUE_CAPACITY ? count : CALLBACK_QUEUE_CAPACITY);
+    ton_request_all_call_t *state = safe_emalloc(count, sizeof(ton_request_all_call_t), 0);
+    uint32_t i = 0, pending = 0;
+    // call index by request ID; calls whose params fail to be encoded take no ID
+    HashTable ids;
+    zend_hash_init(&ids, count, NULL, NULL, 0);
+    ZEND_HASH_FOREACH_VAL(calls, call) {
+        ZVAL_DEREF(call);
+        zval *function_name = zend_hash_index_find(Z_ARRVAL_P(call), 0);
+        zval *params = zend_hash_index_find(Z_ARRVAL_P(call), 1);
+        tc_string_data_t f_params;
+        ZVAL_DEREF(params);
+        ZVAL_NULL(&state[i].result);
+        if (!ton_params_json(params, &f_params)) {
+            TON_DBG_MSG("ton_request_all: params of call %d can't be encoded as JSON\n", i);
+            state[i].data = NULL;
+            state[i].done = true;
+            i++;
+            continue;
+        }
+        state[i].data = ton_request_data_create(cq);
+        state[i].data->decode = decode;
+        state[i].done = false;
+        zval call_index;
+        ZVAL_LONG(&call_index, i);
+        zend_hash_index_add_new(&ids, (zend_ulong) state[i].data->id, &call_index);
+        tc_string_data_t f_name = {Z_STRVAL_P(function_name), Z_STRLEN_P(function_name)};
+        ton_stats_add(TON_STAT_REQUESTS_STARTED, 1);
+        TON_TRACE(TON_TRACE_START, state[i].data->id, context);
+        TON_PROBE_REQUEST_START(state[i].data->id, context);
+        tc_request_ptr(context, f_name, f_params, state[i].data, &response_queueing_handler);
+        ton_params_release();
+        pending++;
+        i++;
+    } ZEND_HASH_FOREACH_END();
+
+    struct timespec deadline;
+    if (timeout > 0) {
+        deadline = get_future_timespec((int) timeout);
+    }
+    while (pending > 0) {
+        ton_callback_queue_element_t *e;
+        int wait_ms = timeout < 0 ? RPA_WAIT_FOREVER : timeout == 0 ? 0 : get_remaining_ms(deadline);
+        if (!rpa_queue_timedpop(cq->queue, (void**)&e, wait_ms)) {
+            break;
+        }
+        zval *call_index = zend_hash_index_find(&ids, (zend_ulong) e->request_id);
+        if (call_index && !state[Z_LVAL_P(call_index)].done) {
+            ton_request_all_call_t *s = &state[Z_LVAL_P(call_index)];
+            if (e->status == tc_response_success || e->status == tc_response_error) {
+                zval_ptr_dtor(&s->result);
+                ton_request_all_result(e, &s->result);
+            }
+            if (e->finished) {
+                s->done = true;
+                pending--;
+            }
+        }
+        ton_callback_queue_element_free(e);
+    }
+
+    array_init_size(return_value, count);
+    i = 0;
+    zend_string *key;
+    zend_ulong index;
+    ZEND_HASH_FOREACH_KEY(calls, index, key) {
+        ton_request_all_call_t *s = &state[i++];
+        if (!s->done) {
+            // timed out
+            zval_ptr_dtor(&s->result);
+            ZVAL_NULL(&s->result);
+        }
+        if (s->data) {
+            ton_request_data_release(s->data);
+        }
+        if (key) {
+            zend_hash_update(Z_ARRVAL_P(return_value), key, &s->result);
+        } else {
+            zend_hash_index_update(Z_ARRVAL_P(return_value), index, &s->result);
+        }
+    } ZEND_HASH_FOREACH_END();
+
+    zend_hash_destroy(&ids);
+    efree(state);
+    ton_completion_queue_release(cq);
+    TON_DBG_MSG("ton_request_all returning; %d calls are not finished\n", pending);
+}
+/* }}}*/
+
+// Fetches request data from the resource or TonRequest object; NULL if it's neither.
+
+static ton_request_data_t *ton_request_data_from_zval(zval *request) {
+    if (Z_TYPE_P(request) == IS_OBJECT && Z_OBJCE_P(request) == ton_request_ce) {
+        return Z_TON_REQUEST_DATA_P(request);
+    }
+    if (Z_TYPE_P(request) == IS_RESOURCE) {
+        return (ton_request_data_t*)zend_fetch_resource(Z_RES_P(request), "ton_request_data_t", res_num);
+    }
+    return NULL;
+}
+
+/* {{{ bool ton_request_cancel( resource|TonRequest $request )
+ */
+PHP_FUNCTION(ton_request_cancel)
+{
+    zval *request;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_ZVAL(request)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t *data = ton_request_data_from_zval(request);
+    if (!data) {
+        RETURN_FALSE;
+    }
+
+    TON_DBG_MSG("ton_request_cancel is called for request %p\n", data);
+    RETURN_BOOL(ton_request_data_cancel(data));
+}
+/* }}}*/
+
+// Adds the time elapsed since the request start (in microseconds), or null if the moment hasn't come yet.
+
+static void ton_request_timing_to_zval(zval *timings, const char *name, uint64_t started_at, uint64_t at) {
+    if (at) {
+        add_assoc_long(timings, name, at > started_at ? (zend_long) ((at - started_at) / 1000) : 0);
+    } else {
+        add_assoc_null(timings, name);
+    }
+}
+
+static void ton_request_timings_impl(ton_request_data_t *data, zval *return_value) {
+    array_init(return_value);
+    add_assoc_long(return_value, "started_at", (zend_long) data->started_at);
+    ton_request_timing_to_zval(return_value, "first_event_us", data->started_at, data->first_event_at);
+    ton_request_timing_to_zval(return_value, "last_event_us", data->started_at, data->last_event_at);
+    ton_request_timing_to_zval(return_value, "finished_us", data->started_at, data->finished_at);
+    add_assoc_long(return_value, "events_fetched", data->fetched);
+    add_assoc_long(return_value, "lag_avg_us", data->fetched ? (zend_long) (data->lag_total / data->fetched / 1000) : 0);
+    add_assoc_long(return_value, "lag_max_us", (zend_long) (data->lag_max / 1000));
+}
+
+/* {{{ ?array ton_request_timings( resource|TonRequest $request )
+ */
+PHP_FUNCTION(ton_request_timings)
+{
+    zval *request;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_ZVAL(request)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t *data = ton_request_data_from_zval(request);
+    if (!data) {
+        RETURN_NULL();
+    }
+
+    ton_request_timings_impl(data, return_value);
+}
+/* }}}*/
+
+/* {{{ ?resource ton_broadcast_subscribe( resource|TonRequest $request, [ bool $replay = true ] )
+ */
+PHP_FUNCTION(ton_broadcast_subscribe)
+{
+    zval *request;
+    zend_bool replay = 1;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+    Z_PARAM_ZVAL(request)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_BOOL(replay)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t *data = ton_request_data_from_zval(request);
+    if (!data || !data->broadcast) {
+        TON_DBG_MSG("ton_broadcast_subscribe: not a broadcast request\n");
+        RETURN_NULL();
+    }
+
+    ton_broadcast_consumer_t *consumer = ton_broadcast_subscribe(data->broadcast, replay);
+    if (!consumer) {
+        RETURN_NULL();
+    }
+    TON_DBG_MSG("ton_broadcast_subscribe: consumer %p subscribed to request %p\n", consumer, data);
+    RETURN_RES(zend_register_resource(consumer, broadcast_res_num));
+}
+/* }}}*/
+
+/* {{{ ?array ton_broadcast_next( resource $consumer, [ int $timeout ] )
+ */
+PHP_FUNCTION(ton_broadcast_next)
+{
+    zval *res;
+    zend_long timeout = -1;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+    Z_PARAM_RESOURCE(res)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(timeout)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_broadcast_consumer_t *consumer;
+    if ((consumer = (ton_broadcast_consumer_t*)zend_fetch_resource(
+            Z_RES_P(res), "ton_broadcast_consumer_t", broadcast_res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    struct timespec deadline;
+    if (timeout >= 0) {
+        deadline = get_future_timespec((int) timeout);
+    }
+    ton_callback_queue_element_t *e;
+    uint32_t lost;
+    if (!ton_broadcast_next(consumer, timeout >= 0 ? &deadline : NULL, (void**)&e, &lost)) {
+        TON_DBG_MSG("ton_broadcast_next: nothing is read by consumer %p\n", consumer);
+        RETURN_NULL();
+    }
+
+    // returning tuple [json, status, finished, id, lost]
+    e->lost = lost;
+    ton_callback_queue_element_to_zval(e, return_value);
+    ton_callback_queue_element_free(e);
+}
+/* }}}*/
+
+/* {{{ resource ton_completion_queue_create( [ int $capacity, [ array $options ] ] )
+ */
+PHP_FUNCTION(ton_completion_queue_create)
+{
+    zend_long capacity = COMPLETION_QUEUE_CAPACITY;
+    HashTable *options = NULL;
+
+    ZEND_PARSE_PARAMETERS_START(0, 2)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(capacity)
+    Z_PARAM_ARRAY_HT(options)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_overflow_options_t overflow;
+    if (capacity <= 0 || capacity > UINT32_MAX ||
+        !ton_overflow_options_parse(options, (uint32_t) capacity, &overflow)) {
+        TON_DBG_MSG("ton_completion_queue_create: invalid capacity %ld or options\n", capacity);
+        RETURN_NULL();
+    }
+
+    ton_completion_queue_t *cq = ton_completion_queue_create((uint32_t) capacity);
+    if (!ton_overflow_options_apply(&overflow, cq->queue)) {
+        TON_DBG_MSG("ton_completion_queue_create: overflow policy %d is not supported\n", overflow.policy);
+        ton_completion_queue_release(cq);
+        RETURN_NULL();
+    }
+    TON_DBG_MSG("ton_completion_queue_create returned %p\n", cq);
+
+    zend_resource *resource = zend_register_resource(cq, cq_res_num);
+    RETURN_RES(resource);
+}
+/* }}}*/
+
+/* {{{ ?array ton_completion_queue_next( resource $completion_queue, [ int $timeout ] )
+ */
+PHP_FUNCTION(ton_completion_queue_next)
+{
+    zval *res;
+    zend_long timeout = -1;
+
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+    Z_PARAM_RESOURCE(res)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(timeout)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_completion_queue_t *cq;
+    if ((cq = (ton_completion_queue_t*)zend_fetch_resource(Z_RES_P(res), "ton_completion_queue_t", cq_res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_completion_queue_next is called for completion queue %p\n", cq);
+    ton_callback_queue_next(cq->queue, NULL, ZEND_NUM_ARGS() > 1, timeout, false, return_value);
+}
+/* }}}*/
+
+/* {{{ ?resource ton_completion_queue_stream( resource $completion_queue )
+ */
+PHP_FUNCTION(ton_completion_queue_stream)
+{
+    zval *res;
+
+    ZEND_PARSE_PARAMETERS_START(1, 1)
+    Z_PARAM_RESOURCE(res)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_completion_queue_t *cq;
+    if ((cq = (ton_completion_queue_t*)zend_fetch_resource(Z_RES_P(res), "ton_completion_queue_t", cq_res_num)) == NULL) {
+        RETURN_NULL();
+    }
+
+    TON_DBG_MSG("ton_completion_queue_stream is called for completion queue %p\n", cq);
+    ton_callback_queue_stream(cq->queue, return_value);
+}
+/* }}}*/
+
+static void ton_pool_stats_to_zval(ton_pool_t *pool, const char *prefix, zval *stats) {
+    ton_pool_stats_t ps;
+    char name[64];
+    ton_pool_get_stats(pool, &ps);
+    snprintf(name, sizeof(name), "%s_size", prefix);
+    add_assoc_long(stats, name, ps.size);
+    snprintf(name, sizeof(name), "%s_capacity", prefix);
+    add_assoc_long(stats, name, ps.capacity);
+    snprintf(name, sizeof(name), "%s_hits", prefix);
+    add_assoc_long(stats, name, (zend_long) ps.hits);
+    snprintf(name, sizeof(name), "%s_misses", prefix);
+    add_assoc_long(stats, name, (zend_long) ps.misses);
+}
+
+// Adds the current and the peak value of the gauge.
+
+static void ton_gauge_to_zval(ton_gauge_t gauge, const char *name, zval *stats) {
+    uint64_t value, peak;
+    char key[64];
+    ton_gauge_get(gauge, &value, &peak);
+    add_assoc_long(stats, name, (zend_long) value);
+    snprintf(key, sizeof(key), "%s_peak", name);
+    add_assoc_long(stats, key, (zend_long) peak);
+}
+
+// Collects the counters returned by ton_client_stats and shown by phpinfo().
+
+static void ton_client_stats_collect(zval *stats) {
+    uint64_t value, peak;
+    uint64_t started = ton_stats_get(TON_STAT_REQUESTS_STARTED);
+    uint64_t finished = ton_stats_get(TON_STAT_REQUESTS_FINISHED);
+    array_init(stats);
+    add_assoc_long(stats, "requests_started", (zend_long) started);
+    add_assoc_long(stats, "requests_finished", (zend_long) finished);
+    add_assoc_long(stats, "requests_in_flight", started > finished ? (zend_long) (started - finished) : 0);
+    ton_gauge_get(TON_GAUGE_ABANDONED_REQUESTS, &value, &peak);
+    add_assoc_long(stats, "requests_abandoned", (zend_long) value);
+    add_assoc_long(stats, "requests_cancelled", (zend_long) ton_stats_get(TON_STAT_REQUESTS_CANCELLED));
+    add_assoc_long(stats, "events_received", (zend_long) ton_stats_get(TON_STAT_EVENTS_RECEIVED));
+    ton_gauge_to_zval(TON_GAUGE_QUEUED_EVENTS, "queued_events", stats);
+    ton_gauge_to_zval(TON_GAUGE_QUEUED_BYTES, "queued_bytes", stats);
+    add_assoc_long(stats, "bytes_copied", (zend_long) ton_stats_get(TON_STAT_BYTES_COPIED));
+    add_assoc_long(stats, "push_waits", (zend_long) ton_stats_get(TON_STAT_PUSH_WAITS));
+    add_assoc_long(stats, "push_wait_us", (zend_long) (ton_stats_get(TON_STAT_PUSH_WAIT_NS) / 1000));
+    add_assoc_long(stats, "pop_waits", (zend_long) ton_stats_get(TON_STAT_POP_WAITS));
+    add_assoc_long(stats, "pop_timeouts", (zend_long) ton_stats_get(TON_STAT_POP_TIMEOUTS));
+    ton_pool_stats_to_zval(&request_pool, "request_pool", stats);
+    ton_pool_stats_to_zval(&queue_pool, "queue_pool", stats);
+    add_assoc_long(stats, "overflow_waited", (zend_long) ton_atomic_load_u64(&overflow_waited));
+    add_assoc_long(stats, "overflow_timeouts", (zend_long) ton_atomic_load_u64(&overflow_timeouts));
+    add_assoc_long(stats, "overflow_grown", (zend_long) ton_atomic_load_u64(&overflow_grown));
+    add_assoc_long(stats, "overflow_evicted", (zend_long) ton_atomic_load_u64(&overflow_evicted));
+    add_assoc_long(stats, "overflow_dropped", (zend_long) ton_atomic_load_u64(&overflow_dropped));
+    add_assoc_long(stats, "single_flight_followers", (zend_long) ton_atomic_load_u64(&single_flight_followers));
+    add_assoc_long(stats, "persistent_contexts", zend_hash_num_elements(&TON_CLIENT_G(persistent_contexts)));
+    add_assoc_long(stats, "result_cache_entries", zend_hash_num_elements(&TON_CLIENT_G(result_cache)));
+    add_assoc_long(stats, "result_cache_size", (zend_long) TON_CLIENT_G(result_cache_size));
+    add_assoc_long(stats, "result_cache_hits", (zend_long) TON_CLIENT_G(result_cache_hits));
+    add_assoc_long(stats, "result_cache_misses", (zend_long) TON_CLIENT_G(result_cache_misses));
+    add_assoc_long(stats, "result_cache_evictions", (zend_long) TON_CLIENT_G(result_cache_evictions));
+    if (shared_cache) {
+        ton_shm_cache_stats_t shared_stats;
+        ton_shm_cache_get_stats(shared_cache, &shared_stats);
+        add_assoc_long(stats, "shared_cache_size", (zend_long) shared_stats.size);
+        add_assoc_long(stats, "shared_cache_entries", (zend_long) shared_stats.entries);
+        add_assoc_long(stats, "shared_cache_hits", (zend_long) shared_stats.hits);
+        add_assoc_long(stats, "shared_cache_misses", (zend_long) shared_stats.misses);
+        add_assoc_long(stats, "shared_cache_stores", (zend_long) shared_stats.stores);
+        add_assoc_long(stats, "shared_cache_resets", (zend_long) shared_stats.resets);
+    }
+}
+
+/* {{{ array ton_client_stats()
+ */
+PHP_FUNCTION(ton_client_stats)
+{
+    ZEND_PARSE_PARAMETERS_NONE();
+
+    ton_client_stats_collect(return_value);
+}
+/* }}}*/
+
+static const char *ton_trace_push_result_name(uint8_t result) {
+    switch (result) {
+        case RPA_PUSH_OK:
+            return "ok";
+        case RPA_PUSH_WAITED:
+            return "waited";
+        case RPA_PUSH_GROWN:
+            return "grown";
+        case RPA_PUSH_EVICTED:
+            return "evicted";
+        case RPA_PUSH_DROPPED:
+            return "dropped";
+        case RPA_PUSH_TIMEOUT:
+            return "timeout";
+        case RPA_PUSH_FAILED:
+            return "failed";
+        case TON_TRACE_NOT_QUEUED:
+            return "not queued";
+        default:
+            return "unknown";
+    }
+}
+
+// Appends the event as a line of text: time since the first event, thread, request, type and details.
+
+static void ton_trace_event_to_str(smart_str *buf, ton_trace_event_t *event, uint64_t start) {
+    char line[256];
+    int len = snprintf(line, sizeof(line), "%12.3f ms  thread %-3u request %-8lld %-10s ",
+                       (double) (event->time - start) / 1e6, (unsigned) event->thread,
+                       (long long) event->request_id, ton_trace_type_name(event->type));
+    size_t left = sizeof(line) - len;
+    switch (event->type) {
+        case TON_TRACE_START:
+            len += snprintf(line + len, left, "context=%llu", (unsigned long long) event->arg);
+            break;
+        case TON_TRACE_ENQUEUE:
+            len += snprintf(line + len, left, "status=%u finished=%u queue=%s",
+                            (unsigned) (uint32_t) event->arg, (unsigned) ((event->arg >> 32) & 1),
+                            ton_trace_push_result_name((uint8_t) (event->arg >> 40)));
+            break;
+        case TON_TRACE_DEQUEUE:
+            len += snprintf(line + len, left, "lag_us=%.3f", (double) event->arg / 1e3);
+            break;
+        case TON_TRACE_JOIN:
+            len += snprintf(line + len, left, "into request %llu", (unsigned long long) event->arg);
+            break;
+        case TON_TRACE_DISCONNECT:
+            len += snprintf(line + len, left, "from request %llu", (unsigned long long) event->arg);
+            break;
+        case TON_TRACE_FREE:
+            len += snprintf(line + len, left, "fetched=%llu", (unsigned long long) event->arg);
+            break;
+        case TON_TRACE_CANCEL:
+            len += snprintf(line + len, left, "dropped=%llu", (unsigned long long) event->arg);
+            break;
+        default:
+            break;
+    }
+    smart_str_appendl(buf, line, len);
+    smart_str_appendc(buf, '\n');
+}
+
+/* {{{ string ton_trace_dump( [ int $limit = 0 ] )
+ */
+PHP_FUNCTION(ton_trace_dump)
+{
+    zend_long limit = 0;
+
+    ZEND_PARSE_PARAMETERS_START(0, 1)
+        Z_PARAM_OPTIONAL
+        Z_PARAM_LONG(limit)
+    ZEND_PARSE_PARAMETERS_END();
+
+    if (limit < 0 || limit > UINT32_MAX) {
+        TON_DBG_MSG("invalid trace dump limit: " ZEND_LONG_FMT "\n", limit);
+        RETURN_NULL();
+    }
+
+    ton_trace_event_t *events;
+    uint32_t count = ton_trace_snapshot(&events, (uint32_t) limit);
+    if (!events) {
+        RETURN_NULL();
+    }
+
+    smart_str buf = {0};
+    char header[128];
+    uint64_t start = count ? events[0].time : 0;
+    int len = snprintf(header, sizeof(header), "# ton_client trace: %u events, starting at %llu ns (monotonic)\n",
+                       count, (unsigned long long) start);
+    smart_str_appendl(&buf, header, len);
+    for (uint32_t i = 0; i < count; i++) {
+        ton_trace_event_to_str(&buf, &events[i], start);
+    }
+    free(events);
+
+    smart_str_0(&buf);
+    RETURN_STR(buf.s);
+}
+/* }}}*/
+
+/* {{{ TonRequest class
+ */
+static zend_object *ton_request_object_create(zend_class_entry *ce)
+{
+    ton_request_object_t *intern = zend_object_alloc(sizeof(ton_request_object_t), ce);
+    zend_object_std_init(&intern->std, ce);
+    object_properties_init(&intern->std, ce);
+    intern->std.handlers = &ton_request_handlers;
+    return &intern->std;
+}
+
+static void ton_request_object_free(zend_object *object)
+{
+    ton_request_object_t *intern = ton_request_object_from(object);
+    TON_DBG_MSG("in ton_request_object_free: %p\n", intern->data);
+    if (intern->data) {
+        ton_request_data_release(intern->data);
+        intern->data = NULL;
+    }
+    zend_object_std_dtor(object);
+}
+
+// Fetches request data of $this; NULL if the object is not initialized by TonRequest::start.
+#define TON_REQUEST_THIS_DATA(data) \
+    do { \
+        if ((data = Z_TON_REQUEST_DATA_P(ZEND_THIS)) == NULL) { \
+            RETURN_NULL(); \
+        } \
+    } while (0)
+
+/* {{{ TonRequest::__construct() */
+PHP_METHOD(TonRequest, __construct)
+{
+}
+/* }}} */
+
+/* {{{ ?TonRequest TonRequest::start( int $context, string $function_name, string|array $params, [ array $options ] ) */
+PHP_METHOD(TonRequest, start)
+{
+    zend_long context;
+    zend_string *function_name;
+    zval *params;
+    HashTable *options = NULL;
+
+    ZEND_PARSE_PARAMETERS_START(3, 4)
+    Z_PARAM_LONG(context)
+    Z_PARAM_STR(function_name)
+    Z_PARAM_ZVAL(params)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_ARRAY_HT(options)
+    ZEND_PARSE_PARAMETERS_END();
+
+    ton_request_data_t *data = ton_request_begin(context, function_name, params, NULL, options);
+    if (!data) {
+        RETURN_NULL();
+    }
+
+    object_init_ex(return_value, ton_request_ce);
+    Z_TON_REQUEST_DATA_P(return_value) = data;
+    TON_DBG_MSG("TonRequest::start returned with request %p\n", data);
+}
+/* }}} */
+
+/* {{{ int TonRequest::id() */
+PHP_METHOD(TonRequest, id)
+{
+    ton_request_data_t *data;
+
+    ZEND_PARSE_PARAMETERS_NONE();
+    TON_REQUEST_THIS_DATA(data);
+
+    RETURN_LONG(data->id);
+}
+/* }}} */
+
+/* {{{ ?TonResponse TonRequest::next( [ int $timeout ] ) */
+PHP_METHOD(TonRequest, next)
+{
+    ton_request_data_t *data;
+    zend_long timeout = -1;
+
+    ZEND_PARSE_PARAMETERS_START(0, 1)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(timeout)
     ZEND_PARSE_PARAMETERS_END();
-
-    ton_request_data_t * data;
-    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
+    TON_REQUEST_THIS_DATA(data);
+    if (!data->queue) {
         RETURN_NULL();
     }
 
-    TON_DBG_MSG("ton_request_id is called for request %p\n", data);
-    TON_DBG_MSG("ton_request_id (%p): return %ld\n", data, data->id);
-    RETURN_LONG(data->id);
+    ton_callback_queue_next(data->queue, data, ZEND_NUM_ARGS() > 0, timeout, true, return_value);
 }
-/* }}}*/
+/* }}} */
 
-/* {{{ array ton_request_next( resource $request, int $timeout )
- */
-PHP_FUNCTION(ton_request_next)
+/* {{{ ?TonResponse TonRequest::await( [ int $timeout ] ) */
+PHP_METHOD(TonRequest, await)
 {
-    zval *res;
+    ton_request_data_t *data;
     zend_long timeout = -1;
 
-    ZEND_PARSE_PARAMETERS_START(1, 2)
-    Z_PARAM_RESOURCE(res)
+    ZEND_PARSE_PARAMETERS_START(0, 1)
     Z_PARAM_OPTIONAL
     Z_PARAM_LONG(timeout)
     ZEND_PARSE_PARAMETERS_END();
+    TON_REQUEST_THIS_DATA(data);
 
-    ton_request_data_t * data;
-    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
-        RETURN_NULL();
-    }
+    ton_request_await(data, timeout, true, return_value);
+}
+/* }}} */
 
-    TON_DBG_MSG("ton_request_next is called for request %p\n", data);
-    TON_DBG_MSG("Calling rpa_queue_pop for request %p; timeout = %ld\n", data, timeout);
-    ton_callback_queue_element_t *e;
-    bool result = (ZEND_NUM_ARGS() == 1)
-            ? rpa_queue_pop(data->queue, (void**)&e)
-            : rpa_queue_timedpop(data->queue, (void**)&e, (int)timeout);
-    if (!result) {
-        TON_DBG_MSG("rpa_queue_pop for request %p returned false\n", data);
-        RETURN_NULL();
-    }
+/* {{{ ?array TonRequest::nextBatch( int $max_items, [ int $max_wait_ms ] ) */
+PHP_METHOD(TonRequest, nextBatch)
+{
+    ton_request_data_t *data;
+    zend_long max_items;
+    zend_long max_wait_ms = 0;
 
-#ifdef TON_DEBUG
-    zend_string *str = zend_string_init(e->json, e->len, 0);
-    TON_DBG_MSG("ton_request_next (%p): return %s\n", data, ZSTR_VAL(str));
-    zend_string_release(str);
-#endif
+    ZEND_PARSE_PARAMETERS_START(1, 2)
+    Z_PARAM_LONG(max_items)
+    Z_PARAM_OPTIONAL
+    Z_PARAM_LONG(max_wait_ms)
+    ZEND_PARSE_PARAMETERS_END();
+    TON_REQUEST_THIS_DATA(data);
 
-    // returning tuple [json, status, finished, resource]
-    zval json, status, finished, id;
-    ZVAL_STRINGL(&json, e->json, e->len);
-    ZVAL_LONG(&status, e->status);
-    ZVAL_BOOL(&finished, e->finished);
-    ZVAL_LONG(&id, e->data->id);
-    HashTable *tuple = zend_new_array(4);
-    zend_hash_next_index_insert(tuple, &json);
-    zend_hash_next_index_insert(tuple, &status);
-    zend_hash_next_index_insert(tuple, &finished);
-    zend_hash_next_index_insert(tuple, &id);
+    ton_request_next_batch_impl(data, max_items, max_wait_ms, true, return_value);
+}
+/* }}} */
 
-    ton_callback_queue_element_free(e);
-    TON_DBG_MSG("ton_request_next (%p) finished\n", data);
-    RETURN_ARR(tuple);
+/* {{{ bool TonRequest::isFinished() */
+PHP_METHOD(TonRequest, isFinished)
+{
+    ton_request_data_t *data;
+
+    ZEND_PARSE_PARAMETERS_NONE();
+    TON_REQUEST_THIS_DATA(data);
+
+    RETURN_BOOL(ton_request_is_finished(data));
 }
-/* }}}*/
+/* }}} */
 
-/* {{{ bool ton_request_join( resource $request, resource $request2 )
- */
-PHP_FUNCTION(ton_request_join)
+/* {{{ int TonRequest::lastStatus() */
+PHP_METHOD(TonRequest, lastStatus)
 {
-    zval *res;
-    zval *res2;
+    ton_request_data_t *data;
 
-    ZEND_PARSE_PARAMETERS_START(2, 2)
-    Z_PARAM_RESOURCE(res)
-    Z_PARAM_RESOURCE(res2)
-    ZEND_PARSE_PARAMETERS_END();
+    ZEND_PARSE_PARAMETERS_NONE();
+    TON_REQUEST_THIS_DATA(data);
 
-    ton_request_data_t * data, *data2;
-    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL ||
-        (data2 = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res2), "ton_request_data_t", res_num)) == NULL) {
-        if (data == NULL) TON_DBG_MSG("Invalid resource for $request\n");
-        if (data2 == NULL) TON_DBG_MSG("Invalid resource for $request2\n");
-        RETURN_FALSE;
-    }
+    RETURN_LONG(data->last_status);
+}
+/* }}} */
 
-    TON_DBG_MSG("ton_request_join is called for requests %p, %p\n", data, data2);
-    if (!data2->joined_to) {
-        data2->joined_to = data;
-        TON_DBG_MSG("request %p started to receive all events of request %p\n", data, data2);
-        RETURN_TRUE;
-    } else {
-        TON_DBG_MSG("Request %p already used for join", data2);
-        RETURN_FALSE;
-    }
+/* {{{ bool TonRequest::cancel() */
+PHP_METHOD(TonRequest, cancel)
+{
+    ton_request_data_t *data;
+
+    ZEND_PARSE_PARAMETERS_NONE();
+    TON_REQUEST_THIS_DATA(data);
+
+    RETURN_BOOL(ton_request_data_cancel(data));
 }
-/* }}}*/
+/* }}} */
 
-/* {{{ bool ton_request_disconnect( resource $request, resource $request2 )
- */
-PHP_FUNCTION(ton_request_disconnect)
+/* {{{ array TonRequest::timings() */
+PHP_METHOD(TonRequest, timings)
 {
-    zval *res;
-    zval *res2;
+    ton_request_data_t *data;
 
-    ZEND_PARSE_PARAMETERS_START(2, 2)
-    Z_PARAM_RESOURCE(res)
-    Z_PARAM_RESOURCE(res2)
-    ZEND_PARSE_PARAMETERS_END();
+    ZEND_PARSE_PARAMETERS_NONE();
+    TON_REQUEST_THIS_DATA(data);
 
-    ton_request_data_t * data, *data2;
-    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL ||
-        (data2 = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res2), "ton_request_data_t", res_num)) == NULL) {
-        if (data == NULL) TON_DBG_MSG("Invalid resource for $request\n");
-        if (data2 == NULL) TON_DBG_MSG("Invalid resource for $request2\n");
-        RETURN_FALSE;
-    }
+    ton_request_timings_impl(data, return_value);
+}
+/* }}} */
 
-    TON_DBG_MSG("ton_request_disconnect is called for requests %p, %p\n", data, data2);
-    if (data2->joined_to == data){
-        data2->joined_to = NULL;
-        TON_DBG_MSG("request %p disconnected from %p\n", data, data2);
-        RETURN_TRUE;
-    } else {
-        TON_DBG_MSG("WARNING: request %p was not joined to %p\n", data, data2);
-        RETURN_FALSE;
+/* {{{ ?resource TonRequest::stream() */
+PHP_METHOD(TonRequest, stream)
+{
+    ton_request_data_t *data;
+
+    ZEND_PARSE_PARAMETERS_NONE();
+    TON_REQUEST_THIS_DATA(data);
+    if (!data->queue) {
+        RETURN_NULL();
     }
+
+    ton_callback_queue_stream(data->queue, return_value);
 }
-/* }}}*/
+/* }}} */
+/* }}} */
 
-/* {{{ ?bool is_ton_request_finished( resource $request )
+/* {{{ TonResponse class
  */
-PHP_FUNCTION(is_ton_request_finished)
+static zend_object *ton_response_object_create(zend_class_entry *ce)
 {
-    zval *res;
+    zend_object *object = zend_objects_new(ce);
+    object_properties_init(object, ce);
+    object->handlers = &ton_response_handlers;
+    return object;
+}
 
-    ZEND_PARSE_PARAMETERS_START(1, 1)
-        Z_PARAM_RESOURCE(res)
-    ZEND_PARSE_PARAMETERS_END();
+// TonResponse properties are read-only.
 
-    ton_request_data_t* data;
-    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
-        RETURN_NULL();
+static void ton_response_throw_readonly(TON_PROPERTY_NAME_ARG)
+{
+    zend_throw_error(NULL, "Cannot modify readonly property TonResponse::$%s", TON_PROPERTY_NAME_VAL);
+}
+
+static zval *ton_response_read_property(TON_OBJECT_HANDLER_ARG, TON_PROPERTY_NAME_ARG, int type, void **cache_slot, zval *rv)
+{
+    if (type != BP_VAR_R && type != BP_VAR_IS) {
+        // fetching for write, e.g. $response->json[] = ...
+        ton_response_throw_readonly(name);
+        return &EG(uninitialized_zval);
     }
+    return std_object_handlers.read_property(object, name, type, cache_slot, rv);
+}
 
-    TON_DBG_MSG("is_ton_request_finished is called for request %p\n", data);
+static zval *ton_response_write_property(TON_OBJECT_HANDLER_ARG, TON_PROPERTY_NAME_ARG, zval *value, void **cache_slot)
+{
+    ton_response_throw_readonly(name);
+    return &EG(error_zval);
+}
 
-    uint32_t size = rpa_queue_size(data->queue);
-    bool result = data->finished && size == 0;
-    TON_DBG_MSG("is_ton_request_finished returning %d for request %p (finished: %d, queue size: %d)\n",
-                result, data, data->finished, size);
+static void ton_response_unset_property(TON_OBJECT_HANDLER_ARG, TON_PROPERTY_NAME_ARG, void **cache_slot)
+{
+    ton_response_throw_readonly(name);
+}
 
-    RETURN_BOOL(result);
+static zval *ton_response_get_property_ptr_ptr(TON_OBJECT_HANDLER_ARG, TON_PROPERTY_NAME_ARG, int type, void **cache_slot)
+{
+    // makes the engine fall back to read_property / write_property
+    return NULL;
 }
-/* }}}*/
 
-/* {{{ ?int ton_request_last_status( resource $request )
+/* {{{ TonResponse::__construct() */
+PHP_METHOD(TonResponse, __construct)
+{
+}
+/* }}} */
+/* }}} */
+
+static void ton_declare_typed_property(zend_class_entry *ce, const char *name, uint32_t type)
+{
+    zval undef;
+    ZVAL_UNDEF(&undef);
+    zend_string *str = zend_string_init_interned(name, strlen(name), 1);
+    zend_declare_typed_property(ce, str, &undef, ZEND_ACC_PUBLIC, NULL, TON_PROPERTY_TYPE(type));
+    zend_string_release(str);
+}
+
+static void ton_class_deny_serialization(zend_class_entry *ce)
+{
+#if PHP_VERSION_ID >= 80100
+    ce->ce_flags |= ZEND_ACC_NOT_SERIALIZABLE;
+#else
+    ce->serialize = zend_class_serialize_deny;
+    ce->unserialize = zend_class_unserialize_deny;
+#endif
+}
+
+// Tracing is global to the process, so it's toggled for all the threads at once.
+
+static ZEND_INI_MH(ton_trace_ini_update)
+{
+    ton_trace_set_enabled(zend_ini_parse_bool(new_value));
+    return SUCCESS;
+}
+
+/* {{{ PHP_INI
  */
-PHP_FUNCTION(ton_request_last_status)
+PHP_INI_BEGIN()
+    PHP_INI_ENTRY("ton_client.request_pool_size", REQUEST_POOL_SIZE, PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY("ton_client.persistent_contexts_max", PERSISTENT_CONTEXTS_MAX, PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY("ton_client.persistent_context_idle_timeout", PERSISTENT_CONTEXT_IDLE_TIMEOUT, PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY("ton_client.result_cache_size", RESULT_CACHE_SIZE, PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY("ton_client.result_cache_functions", RESULT_CACHE_FUNCTIONS, PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY("ton_client.shared_cache_size", SHARED_CACHE_SIZE, PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY("ton_client.shared_cache_functions", SHARED_CACHE_FUNCTIONS, PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY("ton_client.shared_cache_ttl", SHARED_CACHE_TTL, PHP_INI_SYSTEM, NULL)
+    PHP_INI_ENTRY("ton_client.trace", TRACE, PHP_INI_ALL, ton_trace_ini_update)
+PHP_INI_END()
+/* }}} */
+
+/* {{{ PHP_GINIT_FUNCTION
+ */
+static PHP_GINIT_FUNCTION(ton_client)
 {
-    zval *res;
+#if defined(ZTS) && defined(COMPILE_DL_TON_CLIENT)
+    ZEND_TSRMLS_CACHE_UPDATE();
+#endif
+    ton_atomic_add_u32(&shared_holders, 1);
+    memset(ton_client_globals, 0, sizeof(*ton_client_globals));
+    zend_hash_init(&ton_client_globals->persistent_contexts, 8, NULL, ton_persistent_context_dtor, 1);
+    zend_hash_init(&ton_client_globals->result_cache, 8, NULL, ton_result_cache_entry_dtor, 1);
+    zend_hash_init(&ton_client_globals->context_configs, 8, NULL, NULL, 1);
+    zend_hash_init(&ton_client_globals->single_flights, 8, NULL, NULL, 1);
+}
+/* }}} */
 
-    ZEND_PARSE_PARAMETERS_START(1, 1)
-    Z_PARAM_RESOURCE(res)
-    ZEND_PARSE_PARAMETERS_END();
+// Frees the notifier and the pools once both the module and the globals of every thread are shut down.
 
-    ton_request_data_t* data;
-    if ((data = (ton_request_data_t*)zend_fetch_resource(Z_RES_P(res), "ton_request_data_t", res_num)) == NULL) {
-        RETURN_NULL();
+static void ton_client_shared_release(void) {
+    if (ton_atomic_sub_u32(&shared_holders, 1) != 0) {
+        return;
     }
+    ton_notifier_destroy(&request_notifier);
+    ton_pool_destroy(&queue_pool, ton_pooled_queue_free);
+    ton_pool_destroy(&request_pool, free);
+    ton_trace_destroy();
+}
 
-    TON_DBG_MSG("ton_request_last_status is called for request %p\n", data);
-    TON_DBG_MSG("ton_request_last_status returning %d for request %p\n", data->last_status, data);
-
-    RETURN_LONG(data->last_status);
+/* {{{ PHP_GSHUTDOWN_FUNCTION
+ */
+static PHP_GSHUTDOWN_FUNCTION(ton_client)
+{
+    smart_str_free_ex(&ton_client_globals->params_buffer, 1);
+    // persistent contexts of every thread are destroyed here, since MSHUTDOWN only sees the ones
+    // of the thread it runs on (under ZTS)
+    zend_hash_destroy(&ton_client_globals->persistent_contexts);
+    zend_hash_destroy(&ton_client_globals->result_cache);
+    zend_hash_destroy(&ton_client_globals->context_configs);
+    zend_hash_destroy(&ton_client_globals->single_flights);
+    ton_client_shared_release();
 }
-/* }}}*/
+/* }}} */
 
 /* {{{ PHP_RINIT_FUNCTION
  */
@@ -471,8 +3476,9 @@ PHP_RINIT_FUNCTION(ton_client)
 PHP_RSHUTDOWN_FUNCTION(ton_client)
 {
     TON_DBG_MSG("in RSHUTDOWN\n");
-    TON_DBG_MSG("cleaning up unused requests\n");
-    zend_llist_clean(&unused_requests);
+    ton_await_clean();
+    zend_long idle_timeout = INI_INT("ton_client.persistent_context_idle_timeout");
+    zend_hash_apply_with_argument(&TON_CLIENT_G(persistent_contexts), ton_persistent_context_release, &idle_timeout);
     return SUCCESS;
 }
 /* }}} */
@@ -484,16 +3490,57 @@ PHP_MINFO_FUNCTION(ton_client)
     php_info_print_table_start();
     php_info_print_table_header(2, "ton_client support", "enabled");
     php_info_print_table_end();
+
+    zval stats, *value;
+    zend_string *name;
+    char buf[32];
+    ton_client_stats_collect(&stats);
+    php_info_print_table_start();
+    php_info_print_table_header(2, "Counter", "Value");
+    ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL(stats), name, value) {
+        snprintf(buf, sizeof(buf), ZEND_LONG_FMT, Z_LVAL_P(value));
+        php_info_print_table_row(2, ZSTR_VAL(name), buf);
+    } ZEND_HASH_FOREACH_END();
+    php_info_print_table_end();
+    zval_ptr_dtor(&stats);
+
+    DISPLAY_INI_ENTRIES();
 }
 /* }}} */
 
+static void ton_client_register_classes(void);
+
 /* {{{ PHP_MINIT_FUNCTION
  */
 PHP_MINIT_FUNCTION(ton_client)
 {
     TON_DBG_MSG("in MINIT\n");
-    zend_llist_init(&unused_requests, sizeof(ton_request_data_t *), (llist_dtor_func_t) ton_free_unused_request_data, 0);
+    ton_atomic_add_u32(&shared_holders, 1);
+    REGISTER_INI_ENTRIES();
+    REGISTER_LONG_CONSTANT("TON_OVERFLOW_BLOCK", RPA_OVERFLOW_BLOCK, CONST_CS | CONST_PERSISTENT);
+    REGISTER_LONG_CONSTANT("TON_OVERFLOW_GROW", RPA_OVERFLOW_GROW, CONST_CS | CONST_PERSISTENT);
+    REGISTER_LONG_CONSTANT("TON_OVERFLOW_DROP_OLDEST", RPA_OVERFLOW_DROP_OLDEST, CONST_CS | CONST_PERSISTENT);
+    REGISTER_LONG_CONSTANT("TON_OVERFLOW_DROP_NEWEST", RPA_OVERFLOW_DROP_NEWEST, CONST_CS | CONST_PERSISTENT);
+    zend_long pool_size = INI_INT("ton_client.request_pool_size");
+    if (pool_size < 0 || pool_size > UINT32_MAX) {
+        pool_size = 0;
+    }
+    ton_pool_init(&request_pool, (uint32_t) pool_size);
+    ton_pool_init(&queue_pool, (uint32_t) pool_size);
+    zend_long cache_size = INI_INT("ton_client.result_cache_size");
+    result_cache_max_size = cache_size > 0 ? (size_t) cache_size : 0;
+    ton_function_list_init(&result_cache_functions, INI_STR("ton_client.result_cache_functions"));
+    zend_long shared_cache_size = INI_INT("ton_client.shared_cache_size");
+    shared_cache = shared_cache_size > 0 ? ton_shm_cache_create((size_t) shared_cache_size) : NULL;
+    shared_cache_ttl = INI_INT("ton_client.shared_cache_ttl");
+    ton_function_list_init(&shared_cache_functions, INI_STR("ton_client.shared_cache_functions"));
+    ton_client_register_classes();
+    ton_notifier_init(&request_notifier);
     res_num = zend_register_list_destructors_ex(ton_resource_destructor, NULL, "ton_request_data_t", module_number);
+    cq_res_num = zend_register_list_destructors_ex(
+            ton_completion_queue_resource_destructor, NULL, "ton_completion_queue_t", module_number);
+    broadcast_res_num = zend_register_list_destructors_ex(
+            ton_broadcast_consumer_resource_destructor, NULL, "ton_broadcast_consumer_t", module_number);
     return SUCCESS;
 }
 /* }}} */
@@ -502,6 +3549,15 @@ PHP_MINIT_FUNCTION(ton_client)
  */
 PHP_MSHUTDOWN_FUNCTION(ton_client)
 {
+    zend_hash_destroy(&result_cache_functions);
+    zend_hash_destroy(&shared_cache_functions);
+    if (shared_cache) {
+        ton_shm_cache_destroy(shared_cache);
+        shared_cache = NULL;
+    }
+    UNREGISTER_INI_ENTRIES();
+    // the notifier and the pools may still be needed by GSHUTDOWN
+    ton_client_shared_release();
     return SUCCESS;
 }
 /* }}} */
@@ -510,6 +3566,7 @@ PHP_MSHUTDOWN_FUNCTION(ton_client)
  */
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_create_context, 0, 0, 1)
     ZEND_ARG_INFO(0, config_json)
+    ZEND_ARG_INFO(0, persistent)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_destroy_context, 0, 0, 1)
@@ -519,13 +3576,16 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_sync, 0, 0, 3)
     ZEND_ARG_INFO(0, context)
     ZEND_ARG_INFO(0, function_name)
-    ZEND_ARG_INFO(0, params_json)
+    ZEND_ARG_INFO(0, params)
+    ZEND_ARG_INFO(0, decode)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_start, 0, 0, 3)
     ZEND_ARG_INFO(0, context)
     ZEND_ARG_INFO(0, function_name)
-    ZEND_ARG_INFO(0, params_json)
+    ZEND_ARG_INFO(0, params)
+    ZEND_ARG_INFO(0, completion_queue)
+    ZEND_ARG_ARRAY_INFO(0, options, 0)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_id, 0, 0, 1)
@@ -536,6 +3596,16 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_next, 0, 0, 1)
     ZEND_ARG_INFO(0, request_id)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_next_batch, 0, 0, 2)
+    ZEND_ARG_INFO(0, request_id)
+    ZEND_ARG_INFO(0, max_items)
+    ZEND_ARG_INFO(0, max_wait_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_stream, 0, 0, 1)
+    ZEND_ARG_INFO(0, request_id)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_join, 0, 0, 2)
     ZEND_ARG_INFO(0, request_id)
     ZEND_ARG_INFO(0, join_request_id)
@@ -553,8 +3623,149 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_last_status, 0, 0, 1)
     ZEND_ARG_INFO(0, request_id)
 ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_wait_any, 0, 0, 1)
+    ZEND_ARG_INFO(0, requests)
+    ZEND_ARG_INFO(0, timeout)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_wait_all, 0, 0, 1)
+    ZEND_ARG_INFO(0, requests)
+    ZEND_ARG_INFO(0, timeout)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_all, 0, 0, 2)
+    ZEND_ARG_INFO(0, context)
+    ZEND_ARG_ARRAY_INFO(0, calls, 0)
+    ZEND_ARG_INFO(0, timeout)
+    ZEND_ARG_INFO(0, decode)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_await, 0, 0, 1)
+    ZEND_ARG_INFO(0, request)
+    ZEND_ARG_INFO(0, timeout)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_await_run, 0, 0, 0)
+    ZEND_ARG_INFO(0, timeout)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_cancel, 0, 0, 1)
+    ZEND_ARG_INFO(0, request)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_timings, 0, 0, 1)
+    ZEND_ARG_INFO(0, request)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_broadcast_subscribe, 0, 0, 1)
+    ZEND_ARG_INFO(0, request)
+    ZEND_ARG_INFO(0, replay)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_broadcast_next, 0, 0, 1)
+    ZEND_ARG_INFO(0, consumer)
+    ZEND_ARG_INFO(0, timeout)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_completion_queue_create, 0, 0, 0)
+    ZEND_ARG_INFO(0, capacity)
+    ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_completion_queue_next, 0, 0, 1)
+    ZEND_ARG_INFO(0, completion_queue)
+    ZEND_ARG_INFO(0, timeout)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_completion_queue_stream, 0, 0, 1)
+    ZEND_ARG_INFO(0, completion_queue)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_client_stats, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_trace_dump, 0, 0, 0)
+    ZEND_ARG_INFO(0, limit)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_class_void, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_class_start, 0, 0, 3)
+    ZEND_ARG_INFO(0, context)
+    ZEND_ARG_INFO(0, function_name)
+    ZEND_ARG_INFO(0, params)
+    ZEND_ARG_ARRAY_INFO(0, options, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_class_next, 0, 0, 0)
+    ZEND_ARG_INFO(0, timeout)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ton_request_class_next_batch, 0, 0, 1)
+    ZEND_ARG_INFO(0, max_items)
+    ZEND_ARG_INFO(0, max_wait_ms)
+ZEND_END_ARG_INFO()
+/* }}} */
+
+/* {{{ ton_request_methods[]
+ */
+static const zend_function_entry ton_request_methods[] = {
+    PHP_ME(TonRequest, __construct, arginfo_ton_class_void,              ZEND_ACC_PRIVATE)
+    PHP_ME(TonRequest, start,       arginfo_ton_request_class_start,      ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+    PHP_ME(TonRequest, id,          arginfo_ton_class_void,              ZEND_ACC_PUBLIC)
+    PHP_ME(TonRequest, next,        arginfo_ton_request_class_next,       ZEND_ACC_PUBLIC)
+    PHP_ME(TonRequest, nextBatch,   arginfo_ton_request_class_next_batch, ZEND_ACC_PUBLIC)
+    PHP_ME(TonRequest, await,       arginfo_ton_request_class_next,       ZEND_ACC_PUBLIC)
+    PHP_ME(TonRequest, isFinished,  arginfo_ton_class_void,              ZEND_ACC_PUBLIC)
+    PHP_ME(TonRequest, lastStatus,  arginfo_ton_class_void,              ZEND_ACC_PUBLIC)
+    PHP_ME(TonRequest, timings,     arginfo_ton_class_void,              ZEND_ACC_PUBLIC)
+    PHP_ME(TonRequest, cancel,      arginfo_ton_class_void,              ZEND_ACC_PUBLIC)
+    PHP_ME(TonRequest, stream,      arginfo_ton_class_void,              ZEND_ACC_PUBLIC)
+    PHP_FE_END
+};
 /* }}} */
 
+/* {{{ ton_response_methods[]
+ */
+static const zend_function_entry ton_response_methods[] = {
+    PHP_ME(TonResponse, __construct, arginfo_ton_class_void, ZEND_ACC_PRIVATE)
+    PHP_FE_END
+};
+/* }}} */
+
+static void ton_client_register_classes(void)
+{
+    zend_class_entry ce;
+    INIT_CLASS_ENTRY(ce, "TonRequest", ton_request_methods);
+    ton_request_ce = zend_register_internal_class(&ce);
+    ton_request_ce->ce_flags |= ZEND_ACC_FINAL;
+    ton_request_ce->create_object = ton_request_object_create;
+    ton_class_deny_serialization(ton_request_ce);
+    memcpy(&ton_request_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+    ton_request_handlers.offset = XtOffsetOf(ton_request_object_t, std);
+    ton_request_handlers.free_obj = ton_request_object_free;
+    ton_request_handlers.clone_obj = NULL;
+
+    INIT_CLASS_ENTRY(ce, "TonResponse", ton_response_methods);
+    ton_response_ce = zend_register_internal_class(&ce);
+    ton_response_ce->ce_flags |= ZEND_ACC_FINAL;
+    ton_response_ce->create_object = ton_response_object_create;
+    ton_class_deny_serialization(ton_response_ce);
+    zend_declare_property_null(ton_response_ce, ZEND_STRL("json"), ZEND_ACC_PUBLIC);
+    ton_declare_typed_property(ton_response_ce, "status", IS_LONG);
+    ton_declare_typed_property(ton_response_ce, "finished", _IS_BOOL);
+    ton_declare_typed_property(ton_response_ce, "requestId", IS_LONG);
+    ton_declare_typed_property(ton_response_ce, "lost", IS_LONG);
+    memcpy(&ton_response_handlers, &std_object_handlers, sizeof(zend_object_handlers));
+    ton_response_handlers.read_property = ton_response_read_property;
+    ton_response_handlers.write_property = ton_response_write_property;
+    ton_response_handlers.unset_property = ton_response_unset_property;
+    ton_response_handlers.get_property_ptr_ptr = ton_response_get_property_ptr_ptr;
+    ton_response_handlers.clone_obj = NULL;
+}
+
 /* {{{ ton_client_functions[]
  */
 static const zend_function_entry ton_client_functions[] = {
@@ -564,10 +3775,26 @@ static const zend_function_entry ton_client_functions[] = {
     PHP_FE(ton_request_start,       arginfo_ton_request_start)
     PHP_FE(ton_request_id,          arginfo_ton_request_id)
     PHP_FE(ton_request_next,        arginfo_ton_request_next)
+    PHP_FE(ton_request_next_batch,  arginfo_ton_request_next_batch)
+    PHP_FE(ton_request_stream,      arginfo_ton_request_stream)
     PHP_FE(ton_request_join,        arginfo_ton_request_join)
     PHP_FE(ton_request_disconnect,  arginfo_ton_request_disconnect)
     PHP_FE(is_ton_request_finished, arginfo_is_ton_request_finished)
     PHP_FE(ton_request_last_status, arginfo_ton_request_last_status)
+    PHP_FE(ton_request_wait_any,    arginfo_ton_request_wait_any)
+    PHP_FE(ton_request_wait_all,    arginfo_ton_request_wait_all)
+    PHP_FE(ton_request_all,         arginfo_ton_request_all)
+    PHP_FE(ton_await,               arginfo_ton_await)
+    PHP_FE(ton_await_run,           arginfo_ton_await_run)
+    PHP_FE(ton_request_timings,     arginfo_ton_request_timings)
+    PHP_FE(ton_request_cancel,      arginfo_ton_request_cancel)
+    PHP_FE(ton_broadcast_subscribe, arginfo_ton_broadcast_subscribe)
+    PHP_FE(ton_broadcast_next,      arginfo_ton_broadcast_next)
+    PHP_FE(ton_completion_queue_create, arginfo_ton_completion_queue_create)
+    PHP_FE(ton_completion_queue_next,   arginfo_ton_completion_queue_next)
+    PHP_FE(ton_completion_queue_stream, arginfo_ton_completion_queue_stream)
+    PHP_FE(ton_client_stats,            arginfo_ton_client_stats)
+    PHP_FE(ton_trace_dump,              arginfo_ton_trace_dump)
     PHP_FE_END
 };
 /* }}} */
@@ -584,7 +3811,11 @@ zend_module_entry ton_client_module_entry = {
     PHP_RSHUTDOWN(ton_client),      /* PHP_RSHUTDOWN - Request shutdown */
     PHP_MINFO(ton_client),            /* PHP_MINFO - Module info */
     PHP_TON_CLIENT_VERSION,           /* Version */
-    STANDARD_MODULE_PROPERTIES
+    PHP_MODULE_GLOBALS(ton_client),   /* Module globals */
+    PHP_GINIT(ton_client),            /* PHP_GINIT - Globals initialization */
+    PHP_GSHUTDOWN(ton_client),        /* PHP_GSHUTDOWN - Globals shutdown */
+    NULL,                             /* Post deactivate */
+    STANDARD_MODULE_PROPERTIES_EX
 };
 /* }}} */
 
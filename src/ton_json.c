@@ -0,0 +1,448 @@
+#include "ton_json.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TON_JSON_INITIAL_NODES 64
+#define TON_JSON_INITIAL_KEY_SLOTS 64
+
+typedef struct ton_json_parser {
+    const char *pos;
+    const char *end;
+    ton_json_t *tree;
+    uint32_t node_capacity;
+    uint32_t key_capacity;
+    uint32_t strings_capacity;
+    // open addressing table of key indexes + 1 (0 is an empty slot)
+    uint32_t *key_slots;
+    uint32_t key_slot_count;
+} ton_json_parser_t;
+
+static bool ton_json_parse_value(ton_json_parser_t *p, uint32_t key, uint32_t depth);
+
+static void ton_json_skip_whitespace(ton_json_parser_t *p) {
+    while (p->pos < p->end && (*p->pos == ' ' || *p->pos == '\t' || *p->pos == '\n' || *p->pos == '\r')) {
+        p->pos++;
+    }
+}
+
+static bool ton_json_reserve_strings(ton_json_parser_t *p, size_t extra) {
+    ton_json_t *tree = p->tree;
+    if (extra > UINT32_MAX - tree->strings_len) {
+        return false;
+    }
+    uint32_t required = tree->strings_len + (uint32_t) extra;
+    if (required <= p->strings_capacity) {
+        return true;
+    }
+    uint32_t capacity = p->strings_capacity ? p->strings_capacity : 256;
+    while (capacity < required) {
+        capacity = capacity > UINT32_MAX / 2 ? UINT32_MAX : capacity * 2;
+    }
+    char *strings = realloc(tree->strings, capacity);
+    if (!strings) {
+        return false;
+    }
+    tree->strings = strings;
+    p->strings_capacity = capacity;
+    return true;
+}
+
+static bool ton_json_add_node(ton_json_parser_t *p, uint8_t type, uint32_t key, uint32_t *index) {
+    ton_json_t *tree = p->tree;
+    if (tree->node_count == p->node_capacity) {
+        if (p->node_capacity > UINT32_MAX / 2 / sizeof(ton_json_node_t)) {
+            return false;
+        }
+        uint32_t capacity = p->node_capacity ? p->node_capacity * 2 : TON_JSON_INITIAL_NODES;
+        ton_json_node_t *nodes = realloc(tree->nodes, capacity * sizeof(ton_json_node_t));
+        if (!nodes) {
+            return false;
+        }
+        tree->nodes = nodes;
+        p->node_capacity = capacity;
+    }
+    *index = tree->node_count++;
+    ton_json_node_t *node = &tree->nodes[*index];
+    node->type = type;
+    node->key = key;
+    node->len = 0;
+    node->value.integer = 0;
+    return true;
+}
+
+static int ton_json_hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool ton_json_parse_hex4(ton_json_parser_t *p, uint32_t *code) {
+    if (p->end - p->pos < 4) {
+        return false;
+    }
+    *code = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = ton_json_hex_digit(*p->pos++);
+        if (digit < 0) {
+            return false;
+        }
+        *code = (*code << 4) | (uint32_t) digit;
+    }
+    return true;
+}
+
+static void ton_json_put_utf8(ton_json_t *tree, uint32_t code) {
+    char *out = tree->strings + tree->strings_len;
+    if (code < 0x80) {
+        out[0] = (char) code;
+        tree->strings_len += 1;
+    } else if (code < 0x800) {
+        out[0] = (char) (0xC0 | (code >> 6));
+        out[1] = (char) (0x80 | (code & 0x3F));
+        tree->strings_len += 2;
+    } else if (code < 0x10000) {
+        out[0] = (char) (0xE0 | (code >> 12));
+        out[1] = (char) (0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char) (0x80 | (code & 0x3F));
+        tree->strings_len += 3;
+    } else {
+        out[0] = (char) (0xF0 | (code >> 18));
+        out[1] = (char) (0x80 | ((code >> 12) & 0x3F));
+        out[2] = (char) (0x80 | ((code >> 6) & 0x3F));
+        out[3] = (char) (0x80 | (code & 0x3F));
+        tree->strings_len += 4;
+    }
+}
+
+// Unescapes the string at the current position (right after the opening quote)
+// and appends it to the strings buffer.
+
+static bool ton_json_parse_string_text(ton_json_parser_t *p, uint32_t *offset, uint32_t *len) {
+    ton_json_t *tree = p->tree;
+    *offset = tree->strings_len;
+    for (;;) {
+        const char *start = p->pos;
+        while (p->pos < p->end && *p->pos != '"' && *p->pos != '\\' && (unsigned char) *p->pos >= 0x20) {
+            p->pos++;
+        }
+        size_t chunk = (size_t) (p->pos - start);
+        if (chunk > 0) {
+            if (!ton_json_reserve_strings(p, chunk)) {
+                return false;
+            }
+            memcpy(tree->strings + tree->strings_len, start, chunk);
+            tree->strings_len += (uint32_t) chunk;
+        }
+        if (p->pos == p->end || (unsigned char) *p->pos < 0x20) {
+            return false;
+        }
+        if (*p->pos++ == '"') {
+            break;
+        }
+        if (p->pos == p->end || !ton_json_reserve_strings(p, 4)) {
+            return false;
+        }
+        char c = *p->pos++;
+        switch (c) {
+            case '"':
+            case '\\':
+            case '/':
+                tree->strings[tree->strings_len++] = c;
+                break;
+            case 'b':
+                tree->strings[tree->strings_len++] = '\b';
+                break;
+            case 'f':
+                tree->strings[tree->strings_len++] = '\f';
+                break;
+            case 'n':
+                tree->strings[tree->strings_len++] = '\n';
+                break;
+            case 'r':
+                tree->strings[tree->strings_len++] = '\r';
+                break;
+            case 't':
+                tree->strings[tree->strings_len++] = '\t';
+                break;
+            case 'u': {
+                uint32_t code, low;
+                if (!ton_json_parse_hex4(p, &code)) {
+                    return false;
+                }
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    if (p->end - p->pos < 2 || p->pos[0] != '\\' || p->pos[1] != 'u') {
+                        return false;
+                    }
+                    p->pos += 2;
+                    if (!ton_json_parse_hex4(p, &low) || low < 0xDC00 || low > 0xDFFF) {
+                        return false;
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                    return false;
+                }
+                ton_json_put_utf8(tree, code);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    *len = tree->strings_len - *offset;
+    return true;
+}
+
+static uint32_t ton_json_key_hash(const char *key, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char) key[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static bool ton_json_key_slots_grow(ton_json_parser_t *p) {
+    uint32_t count = p->key_slot_count ? p->key_slot_count * 2 : TON_JSON_INITIAL_KEY_SLOTS;
+    uint32_t *slots = calloc(count, sizeof(uint32_t));
+    if (!slots) {
+        return false;
+    }
+    ton_json_t *tree = p->tree;
+    for (uint32_t i = 0; i < tree->key_count; i++) {
+        ton_json_key_t *key = &tree->keys[i];
+        uint32_t slot = ton_json_key_hash(tree->strings + key->offset, key->len) & (count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (count - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    free(p->key_slots);
+    p->key_slots = slots;
+    p->key_slot_count = count;
+    return true;
+}
+
+// Parses object key at the current position (right after the opening quote).
+// If the same key has been seen already, its text is dropped from the strings buffer.
+
+static bool ton_json_parse_key(ton_json_parser_t *p, uint32_t *index) {
+    ton_json_t *tree = p->tree;
+    uint32_t offset, len;
+    if (!ton_json_parse_string_text(p, &offset, &len)) {
+        return false;
+    }
+    if (tree->key_count >= p->key_slot_count / 2 && !ton_json_key_slots_grow(p)) {
+        return false;
+    }
+    uint32_t mask = p->key_slot_count - 1;
+    uint32_t slot = ton_json_key_hash(tree->strings + offset, len) & mask;
+    while (p->key_slots[slot]) {
+        ton_json_key_t *key = &tree->keys[p->key_slots[slot] - 1];
+        if (key->len == len && memcmp(tree->strings + key->offset, tree->strings + offset, len) == 0) {
+            tree->strings_len = offset;
+            *index = p->key_slots[slot] - 1;
+            return true;
+        }
+        slot = (slot + 1) & mask;
+    }
+    if (tree->key_count == p->key_capacity) {
+        uint32_t capacity = p->key_capacity ? p->key_capacity * 2 : TON_JSON_INITIAL_KEY_SLOTS / 2;
+        ton_json_key_t *keys = realloc(tree->keys, capacity * sizeof(ton_json_key_t));
+        if (!keys) {
+            return false;
+        }
+        tree->keys = keys;
+        p->key_capacity = capacity;
+    }
+    *index = tree->key_count++;
+    tree->keys[*index].offset = offset;
+    tree->keys[*index].len = len;
+    p->key_slots[slot] = *index + 1;
+    return true;
+}
+
+static bool ton_json_parse_number(ton_json_parser_t *p, uint32_t key) {
+    const char *start = p->pos;
+    bool negative = false, is_int = true, overflow = false;
+    uint64_t magnitude = 0;
+    if (p->pos < p->end && *p->pos == '-') {
+        negative = true;
+        p->pos++;
+    }
+    if (p->pos == p->end || *p->pos < '0' || *p->pos > '9') {
+        return false;
+    }
+    if (*p->pos == '0') {
+        p->pos++;
+    } else {
+        while (p->pos < p->end && *p->pos >= '0' && *p->pos <= '9') {
+            uint64_t digit = (uint64_t) (*p->pos++ - '0');
+            if (magnitude > (UINT64_MAX - digit) / 10) {
+                overflow = true;
+            } else {
+                magnitude = magnitude * 10 + digit;
+            }
+        }
+    }
+    if (p->pos < p->end && *p->pos == '.') {
+        is_int = false;
+        p->pos++;
+        if (p->pos == p->end || *p->pos < '0' || *p->pos > '9') {
+            return false;
+        }
+        while (p->pos < p->end && *p->pos >= '0' && *p->pos <= '9') {
+            p->pos++;
+        }
+    }
+    if (p->pos < p->end && (*p->pos == 'e' || *p->pos == 'E')) {
+        is_int = false;
+        p->pos++;
+        if (p->pos < p->end && (*p->pos == '+' || *p->pos == '-')) {
+            p->pos++;
+        }
+        if (p->pos == p->end || *p->pos < '0' || *p->pos > '9') {
+            return false;
+        }
+        while (p->pos < p->end && *p->pos >= '0' && *p->pos <= '9') {
+            p->pos++;
+        }
+    }
+    if (is_int && !overflow && magnitude <= (negative ? (uint64_t) INT64_MAX + 1 : (uint64_t) INT64_MAX)) {
+        uint32_t index;
+        if (!ton_json_add_node(p, TON_JSON_INT, key, &index)) {
+            return false;
+        }
+        p->tree->nodes[index].value.integer = negative ? (int64_t) (0 - magnitude) : (int64_t) magnitude;
+        return true;
+    }
+    size_t len = (size_t) (p->pos - start);
+    uint32_t index;
+    if (!ton_json_reserve_strings(p, len + 1) || !ton_json_add_node(p, TON_JSON_DOUBLE, key, &index)) {
+        return false;
+    }
+    ton_json_t *tree = p->tree;
+    tree->nodes[index].value.offset = tree->strings_len;
+    tree->nodes[index].len = (uint32_t) len;
+    memcpy(tree->strings + tree->strings_len, start, len);
+    tree->strings[tree->strings_len + len] = '\0';
+    tree->strings_len += (uint32_t) len + 1;
+    return true;
+}
+
+static bool ton_json_parse_literal(ton_json_parser_t *p, const char *literal, size_t len, uint8_t type, uint32_t key) {
+    uint32_t index;
+    if ((size_t) (p->end - p->pos) < len || memcmp(p->pos, literal, len) != 0) {
+        return false;
+    }
+    p->pos += len;
+    return ton_json_add_node(p, type, key, &index);
+}
+
+static bool ton_json_parse_container(ton_json_parser_t *p, bool is_object, uint32_t key, uint32_t depth) {
+    uint32_t index, count = 0;
+    if (depth >= TON_JSON_MAX_DEPTH || !ton_json_add_node(p, is_object ? TON_JSON_OBJECT : TON_JSON_ARRAY, key, &index)) {
+        return false;
+    }
+    char close = is_object ? '}' : ']';
+    p->pos++;
+    ton_json_skip_whitespace(p);
+    if (p->pos < p->end && *p->pos == close) {
+        p->pos++;
+    } else {
+        for (;;) {
+            uint32_t member_key = TON_JSON_NO_KEY;
+            if (is_object) {
+                if (p->pos == p->end || *p->pos != '"') {
+                    return false;
+                }
+                p->pos++;
+                if (!ton_json_parse_key(p, &member_key)) {
+                    return false;
+                }
+                ton_json_skip_whitespace(p);
+                if (p->pos == p->end || *p->pos != ':') {
+                    return false;
+                }
+                p->pos++;
+                ton_json_skip_whitespace(p);
+            }
+            if (!ton_json_parse_value(p, member_key, depth + 1)) {
+                return false;
+            }
+            count++;
+            ton_json_skip_whitespace(p);
+            if (p->pos == p->end) {
+                return false;
+            }
+            if (*p->pos == close) {
+                p->pos++;
+                break;
+            }
+            if (*p->pos != ',') {
+                return false;
+            }
+            p->pos++;
+            ton_json_skip_whitespace(p);
+        }
+    }
+    // nodes may have been reallocated while parsing members
+    p->tree->nodes[index].len = count;
+    p->tree->nodes[index].value.next = p->tree->node_count;
+    return true;
+}
+
+static bool ton_json_parse_value(ton_json_parser_t *p, uint32_t key, uint32_t depth) {
+    if (p->pos == p->end) {
+        return false;
+    }
+    switch (*p->pos) {
+        case '{':
+            return ton_json_parse_container(p, true, key, depth);
+        case '[':
+            return ton_json_parse_container(p, false, key, depth);
+        case '"': {
+            uint32_t offset, len, index;
+            p->pos++;
+            if (!ton_json_parse_string_text(p, &offset, &len) || !ton_json_add_node(p, TON_JSON_STRING, key, &index)) {
+                return false;
+            }
+            p->tree->nodes[index].value.offset = offset;
+            p->tree->nodes[index].len = len;
+            return true;
+        }
+        case 't':
+            return ton_json_parse_literal(p, "true", 4, TON_JSON_TRUE, key);
+        case 'f':
+            return ton_json_parse_literal(p, "false", 5, TON_JSON_FALSE, key);
+        case 'n':
+            return ton_json_parse_literal(p, "null", 4, TON_JSON_NULL, key);
+        default:
+            return ton_json_parse_number(p, key);
+    }
+}
+
+ton_json_t *ton_json_parse(const char *json, size_t len) {
+    ton_json_parser_t p;
+    memset(&p, 0, sizeof(p));
+    if (len > UINT32_MAX || (p.tree = calloc(1, sizeof(ton_json_t))) == NULL) {
+        return NULL;
+    }
+    p.pos = json;
+    p.end = json + len;
+    ton_json_skip_whitespace(&p);
+    bool result = ton_json_parse_value(&p, TON_JSON_NO_KEY, 0);
+    ton_json_skip_whitespace(&p);
+    free(p.key_slots);
+    if (!result || p.pos != p.end) {
+        ton_json_free(p.tree);
+        return NULL;
+    }
+    return p.tree;
+}
+
+void ton_json_free(ton_json_t *tree) {
+    free(tree->nodes);
+    free(tree->keys);
+    free(tree->strings);
+    free(tree);
+}
@@ -0,0 +1,72 @@
+#ifndef TON_JSON_H
+#define TON_JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Compact parse tree of a JSON document.
+ *
+ * Built by ton_json_parse() without touching any PHP API, so that SDK callbacks
+ * can parse their JSON on the SDK thread and the PHP thread only has to turn
+ * the nodes into zvals (see ton_json_to_zval in ton_client.c).
+ *
+ * Nodes are stored in document order: children of an array or object follow
+ * their parent, and value.next of the parent points right after the last of them.
+ * All the (unescaped) strings live in a single buffer. Object keys are
+ * deduplicated, so a field name repeated in many objects is stored once
+ * and referenced by its index in keys.
+ */
+
+#define TON_JSON_NO_KEY UINT32_MAX
+
+#define TON_JSON_MAX_DEPTH 512
+
+typedef enum ton_json_type {
+    TON_JSON_NULL = 0,
+    TON_JSON_FALSE,
+    TON_JSON_TRUE,
+    TON_JSON_INT,
+    TON_JSON_DOUBLE,
+    TON_JSON_STRING,
+    TON_JSON_ARRAY,
+    TON_JSON_OBJECT
+} ton_json_type_t;
+
+typedef struct ton_json_node {
+    uint8_t type;
+    uint32_t key;      // key index for object members, TON_JSON_NO_KEY otherwise
+    uint32_t len;      // string and double: length of the text; array and object: number of members
+    union {
+        int64_t integer;
+        uint32_t offset;   // string and double: position of the text in strings
+        uint32_t next;     // array and object: index of the node following the members
+    } value;
+} ton_json_node_t;
+
+typedef struct ton_json_key {
+    uint32_t offset;
+    uint32_t len;
+} ton_json_key_t;
+
+typedef struct ton_json {
+    ton_json_node_t *nodes;
+    uint32_t node_count;
+    ton_json_key_t *keys;
+    uint32_t key_count;
+    char *strings;
+    uint32_t strings_len;
+} ton_json_t;
+
+/**
+ * parses JSON document
+ * Doubles are kept as text (NUL-terminated), since converting them is locale
+ * and allocator sensitive; integers out of int64 range are kept as doubles too.
+ * @returns NULL if JSON is invalid, nested deeper than TON_JSON_MAX_DEPTH or too large
+ */
+ton_json_t *ton_json_parse(const char *json, size_t len);
+
+void ton_json_free(ton_json_t *tree);
+
+#endif /* TON_JSON_H */
@@ -0,0 +1,108 @@
+#include "ton_notifier.h"
+#include "os.h"
+#include <errno.h>
+
+#ifndef TON_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef TON_LINUX
+#include <sys/eventfd.h>
+#endif
+
+bool ton_notifier_init(ton_notifier_t *notifier) {
+    notifier->seq = 0;
+    notifier->waiters = 0;
+    if (pthread_mutex_init(&notifier->mutex, NULL) != 0) {
+        return false;
+    }
+    if (pthread_cond_init(&notifier->cond, NULL) != 0) {
+        pthread_mutex_destroy(&notifier->mutex);
+        return false;
+    }
+    return true;
+}
+
+void ton_notifier_destroy(ton_notifier_t *notifier) {
+    pthread_cond_destroy(&notifier->cond);
+    pthread_mutex_destroy(&notifier->mutex);
+}
+
+void ton_notifier_notify(ton_notifier_t *notifier) {
+    pthread_mutex_lock(&notifier->mutex);
+    notifier->seq++;
+    if (notifier->waiters) {
+        pthread_cond_broadcast(&notifier->cond);
+    }
+    pthread_mutex_unlock(&notifier->mutex);
+}
+
+uint64_t ton_notifier_begin_wait(ton_notifier_t *notifier) {
+    pthread_mutex_lock(&notifier->mutex);
+    notifier->waiters++;
+    uint64_t seq = notifier->seq;
+    pthread_mutex_unlock(&notifier->mutex);
+    return seq;
+}
+
+bool ton_notifier_wait(ton_notifier_t *notifier, uint64_t *seq, const struct timespec *deadline) {
+    bool result = true;
+    pthread_mutex_lock(&notifier->mutex);
+    while (notifier->seq == *seq) {
+        int rv = deadline
+                ? pthread_cond_timedwait(&notifier->cond, &notifier->mutex, deadline)
+                : pthread_cond_wait(&notifier->cond, &notifier->mutex);
+        if (rv == ETIMEDOUT) {
+            result = notifier->seq != *seq;
+            break;
+        }
+    }
+    *seq = notifier->seq;
+    pthread_mutex_unlock(&notifier->mutex);
+    return result;
+}
+
+void ton_notifier_end_wait(ton_notifier_t *notifier) {
+    pthread_mutex_lock(&notifier->mutex);
+    notifier->waiters--;
+    pthread_mutex_unlock(&notifier->mutex);
+}
+
+bool ton_notifier_fd_create(int *read_fd, int *write_fd) {
+#if defined(TON_LINUX)
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    *read_fd = *write_fd = fd;
+    return true;
+#elif defined(TON_WINDOWS)
+    (void) read_fd;
+    (void) write_fd;
+    return false;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    *read_fd = fds[0];
+    *write_fd = fds[1];
+    return true;
+#endif
+}
+
+void ton_notifier_fd_close(int read_fd, int write_fd) {
+#ifndef TON_WINDOWS
+    close(read_fd);
+    if (write_fd != read_fd) {
+        close(write_fd);
+    }
+#else
+    (void) read_fd;
+    (void) write_fd;
+#endif
+}
@@ -0,0 +1,68 @@
+#ifndef TON_NOTIFIER_H
+#define TON_NOTIFIER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * Wakeup primitive shared by many producers and waiters.
+ *
+ * Producers call ton_notifier_notify() after publishing something (e.g. pushing
+ * a callback into a request queue). Waiters check whatever they are interested in
+ * and sleep in ton_notifier_wait() until the next notification. The sequence number
+ * taken by ton_notifier_begin_wait() before checking guarantees that notifications
+ * sent in between are not lost.
+ */
+typedef struct ton_notifier {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint64_t seq;
+    uint32_t waiters;
+} ton_notifier_t;
+
+bool ton_notifier_init(ton_notifier_t *notifier);
+
+void ton_notifier_destroy(ton_notifier_t *notifier);
+
+/**
+ * wakes up all the threads waiting in ton_notifier_wait
+ */
+void ton_notifier_notify(ton_notifier_t *notifier);
+
+/**
+ * registers the calling thread as a waiter
+ * @returns sequence number to be passed to ton_notifier_wait
+ */
+uint64_t ton_notifier_begin_wait(ton_notifier_t *notifier);
+
+/**
+ * blocks until there's a notification newer than *seq
+ *
+ * @param notifier  the notifier
+ * @param seq       last seen sequence number; updated on return
+ * @param deadline  absolute timeout (see get_future_timespec) or NULL to wait forever
+ * @returns false if the deadline has been reached
+ */
+bool ton_notifier_wait(ton_notifier_t *notifier, uint64_t *seq, const struct timespec *deadline);
+
+/**
+ * unregisters the waiter previously registered by ton_notifier_begin_wait
+ */
+void ton_notifier_end_wait(ton_notifier_t *notifier);
+
+/**
+ * creates a pair of non-blocking descriptors suitable for rpa_queue_set_notify_fd:
+ * an eventfd (both descriptors are the same) on Linux, or a pipe elsewhere
+ *
+ * @returns false if descriptors can't be created or aren't supported on this platform
+ */
+bool ton_notifier_fd_create(int *read_fd, int *write_fd);
+
+/**
+ * closes descriptors created by ton_notifier_fd_create
+ */
+void ton_notifier_fd_close(int read_fd, int write_fd);
+
+#endif /* TON_NOTIFIER_H */
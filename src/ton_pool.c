@@ -0,0 +1,57 @@
+#include "ton_pool.h"
+#include <stdlib.h>
+
+bool ton_pool_init(ton_pool_t *pool, uint32_t capacity) {
+    pool->size = 0;
+    pool->capacity = capacity;
+    pool->hits = 0;
+    pool->misses = 0;
+    pool->items = NULL;
+    if (capacity > 0 && (pool->items = malloc(capacity * sizeof(void *))) == NULL) {
+        pool->capacity = 0;
+    }
+    return pthread_mutex_init(&pool->mutex, NULL) == 0;
+}
+
+void ton_pool_destroy(ton_pool_t *pool, ton_pool_free_fn free_fn) {
+    while (pool->size > 0) {
+        free_fn(pool->items[--pool->size]);
+    }
+    free(pool->items);
+    pool->items = NULL;
+    pool->capacity = 0;
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+void *ton_pool_get(ton_pool_t *pool) {
+    void *item = NULL;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->size > 0) {
+        item = pool->items[--pool->size];
+        pool->hits++;
+    } else {
+        pool->misses++;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return item;
+}
+
+bool ton_pool_put(ton_pool_t *pool, void *item) {
+    bool result = false;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->size < pool->capacity) {
+        pool->items[pool->size++] = item;
+        result = true;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return result;
+}
+
+void ton_pool_get_stats(ton_pool_t *pool, ton_pool_stats_t *stats) {
+    pthread_mutex_lock(&pool->mutex);
+    stats->size = pool->size;
+    stats->capacity = pool->capacity;
+    stats->hits = pool->hits;
+    stats->misses = pool->misses;
+    pthread_mutex_unlock(&pool->mutex);
+}
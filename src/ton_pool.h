@@ -0,0 +1,55 @@
+#ifndef TON_POOL_H
+#define TON_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Freelist of recycled objects (request records, callback queues) shared by all the
+ * threads of the process. Objects are put back by ton_pool_put() instead of being freed,
+ * until there are capacity objects in the pool.
+ */
+typedef struct ton_pool {
+    pthread_mutex_t mutex;
+    void **items;
+    uint32_t size;
+    uint32_t capacity;
+    uint64_t hits;
+    uint64_t misses;
+} ton_pool_t;
+
+/**
+ * Pool statistics snapshot
+ */
+typedef struct ton_pool_stats {
+    uint32_t size;
+    uint32_t capacity;
+    uint64_t hits;
+    uint64_t misses;
+} ton_pool_stats_t;
+
+typedef void (*ton_pool_free_fn)(void *item);
+
+bool ton_pool_init(ton_pool_t *pool, uint32_t capacity);
+
+/**
+ * frees all the pooled objects with the given function and destroys the pool
+ */
+void ton_pool_destroy(ton_pool_t *pool, ton_pool_free_fn free_fn);
+
+/**
+ * takes an object from the pool
+ * @returns NULL if the pool is empty, so the caller has to allocate a new one
+ */
+void *ton_pool_get(ton_pool_t *pool);
+
+/**
+ * returns the object to the pool
+ * @returns false if the pool is full, so the caller has to free the object
+ */
+bool ton_pool_put(ton_pool_t *pool, void *item);
+
+void ton_pool_get_stats(ton_pool_t *pool, ton_pool_stats_t *stats);
+
+#endif /* TON_POOL_H */
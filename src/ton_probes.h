@@ -0,0 +1,54 @@
+#ifndef TON_PROBES_H
+#define TON_PROBES_H
+
+/**
+ * USDT (SystemTap/DTrace compatible) static probes of the "ton_client" provider,
+ * compiled in with --enable-ton_client_usdt (HAVE_TON_CLIENT_USDT), and compiled
+ * out otherwise. A probe is a single nop until a tracer (bpftrace, perf, stap)
+ * attaches to it, e.g.
+ *
+ *   bpftrace -e 'usdt:/path/to/ton_client.so:ton_client:request__dequeue { @lag_us = hist(arg1 / 1000); }'
+ *
+ * Probes and their arguments:
+ *
+ *   request__start(request_id, context)
+ *   request__enqueue(request_id, payload_size, status, finished) - callback received from TON SDK
+ *   request__dequeue(request_id, lag_ns) - callback fetched after lag_ns spent in the queue
+ *   request__free(request_id, events_fetched)
+ *   queue__full(queue) - callback delivery blocked by the full queue
+ *   queue__unblocked(queue, wait_ns) - ... and resumed after wait_ns
+ *
+ * Arguments are evaluated only if probes are compiled in.
+ */
+
+#ifdef HAVE_TON_CLIENT_USDT
+
+#include <stdint.h>
+#include <sys/sdt.h>
+
+#define TON_PROBE_REQUEST_START(request_id, context) \
+    DTRACE_PROBE2(ton_client, request__start, (int64_t) (request_id), (int64_t) (context))
+#define TON_PROBE_REQUEST_ENQUEUE(request_id, payload_size, status, finished) \
+    DTRACE_PROBE4(ton_client, request__enqueue, (int64_t) (request_id), (uint32_t) (payload_size), \
+                  (uint32_t) (status), (int) (finished))
+#define TON_PROBE_REQUEST_DEQUEUE(request_id, lag_ns) \
+    DTRACE_PROBE2(ton_client, request__dequeue, (int64_t) (request_id), (uint64_t) (lag_ns))
+#define TON_PROBE_REQUEST_FREE(request_id, fetched) \
+    DTRACE_PROBE2(ton_client, request__free, (int64_t) (request_id), (uint64_t) (fetched))
+#define TON_PROBE_QUEUE_FULL(queue) \
+    DTRACE_PROBE1(ton_client, queue__full, (void *) (queue))
+#define TON_PROBE_QUEUE_UNBLOCKED(queue, wait_ns) \
+    DTRACE_PROBE2(ton_client, queue__unblocked, (void *) (queue), (uint64_t) (wait_ns))
+
+#else
+
+#define TON_PROBE_REQUEST_START(request_id, context)
+#define TON_PROBE_REQUEST_ENQUEUE(request_id, payload_size, status, finished)
+#define TON_PROBE_REQUEST_DEQUEUE(request_id, lag_ns)
+#define TON_PROBE_REQUEST_FREE(request_id, fetched)
+#define TON_PROBE_QUEUE_FULL(queue)
+#define TON_PROBE_QUEUE_UNBLOCKED(queue, wait_ns)
+
+#endif /* HAVE_TON_CLIENT_USDT */
+
+#endif /* TON_PROBES_H */
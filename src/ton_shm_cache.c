@@ -0,0 +1,308 @@
+#include "ton_shm_cache.h"
+#include "os.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef TON_WINDOWS
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// Stripes are sized so that each of them keeps a reasonable number of entries;
+// smaller caches have fewer stripes.
+
+#define TON_SHM_CACHE_MAX_STRIPES 16
+#define TON_SHM_CACHE_MIN_STRIPE_SIZE (64 * 1024)
+
+// One index slot per that many bytes of the arena (i.e. the expected average entry size).
+
+#define TON_SHM_CACHE_BYTES_PER_SLOT 512
+
+// Number of slots looked through, starting with the one the key hashes to.
+
+#define TON_SHM_CACHE_PROBE_LIMIT 8
+
+#define TON_SHM_CACHE_ALIGN(size) (((size) + 63) & ~(size_t) 63)
+
+typedef struct ton_shm_cache_slot {
+    uint64_t hash;
+    int64_t expires;    // 0 for a free slot
+    uint32_t offset;    // position of the key in the arena; value follows the key
+    uint32_t key_len;
+    uint32_t value_len;
+} ton_shm_cache_slot_t;
+
+typedef struct ton_shm_cache_stripe {
+    pthread_mutex_t mutex;
+    uint32_t used;      // arena bytes
+    uint32_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t resets;
+} ton_shm_cache_stripe_t;
+
+// Handle is private to the process (it's copied on fork, and points to the same mapping).
+
+struct ton_shm_cache {
+    pid_t owner;        // process which has created the cache
+    char *base;
+    size_t size;
+    size_t stripe_size;
+    uint32_t stripe_count;
+    uint32_t slot_count;
+    uint32_t arena_size;
+};
+
+static inline ton_shm_cache_stripe_t *ton_shm_cache_stripe(ton_shm_cache_t *cache, uint32_t i) {
+    return (ton_shm_cache_stripe_t *) (cache->base + (size_t) i * cache->stripe_size);
+}
+
+static inline ton_shm_cache_slot_t *ton_shm_cache_slots(ton_shm_cache_stripe_t *stripe) {
+    return (ton_shm_cache_slot_t *) ((char *) stripe + TON_SHM_CACHE_ALIGN(sizeof(ton_shm_cache_stripe_t)));
+}
+
+static inline char *ton_shm_cache_arena(ton_shm_cache_t *cache, ton_shm_cache_stripe_t *stripe) {
+    return (char *) ton_shm_cache_slots(stripe)
+           + TON_SHM_CACHE_ALIGN(cache->slot_count * sizeof(ton_shm_cache_slot_t));
+}
+
+// FNV-1a
+
+static uint64_t ton_shm_cache_hash(const char *key, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void ton_shm_cache_reset(ton_shm_cache_t *cache, ton_shm_cache_stripe_t *stripe) {
+    memset(ton_shm_cache_slots(stripe), 0, cache->slot_count * sizeof(ton_shm_cache_slot_t));
+    stripe->used = 0;
+    stripe->entries = 0;
+    stripe->resets++;
+}
+
+// Locks the stripe. Mutexes are robust where supported, so a process killed while holding
+// the lock doesn't block the others forever; the stripe it was updating is wiped.
+
+static void ton_shm_cache_lock(ton_shm_cache_t *cache, ton_shm_cache_stripe_t *stripe) {
+    int rv = pthread_mutex_lock(&stripe->mutex);
+#ifdef TON_LINUX
+    if (rv == EOWNERDEAD) {
+        ton_shm_cache_reset(cache, stripe);
+        pthread_mutex_consistent(&stripe->mutex);
+    }
+#else
+    (void) rv;
+    (void) cache;
+#endif
+}
+
+ton_shm_cache_t *ton_shm_cache_create(size_t size) {
+    if (size < TON_SHM_CACHE_MIN_STRIPE_SIZE) {
+        return NULL;
+    }
+    ton_shm_cache_t *cache = malloc(sizeof(ton_shm_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+    size_t stripe_count = size / TON_SHM_CACHE_MIN_STRIPE_SIZE;
+    if (stripe_count > TON_SHM_CACHE_MAX_STRIPES) {
+        stripe_count = TON_SHM_CACHE_MAX_STRIPES;
+    }
+    cache->owner = getpid();
+    cache->stripe_count = (uint32_t) stripe_count;
+    cache->stripe_size = (size / stripe_count) & ~(size_t) 63;
+    if (cache->stripe_size > UINT32_MAX) {
+        cache->stripe_size = UINT32_MAX & ~(size_t) 63;
+    }
+    cache->size = cache->stripe_size * stripe_count;
+    size_t available = cache->stripe_size - TON_SHM_CACHE_ALIGN(sizeof(ton_shm_cache_stripe_t));
+    cache->slot_count = (uint32_t) (available / (TON_SHM_CACHE_BYTES_PER_SLOT + sizeof(ton_shm_cache_slot_t)));
+    cache->arena_size = (uint32_t) (available - TON_SHM_CACHE_ALIGN(cache->slot_count * sizeof(ton_shm_cache_slot_t)));
+
+    cache->base = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cache->base == MAP_FAILED) {
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef TON_LINUX
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+    for (uint32_t i = 0; i < cache->stripe_count; i++) {
+        // mapping is zero-filled, so the index is empty and counters are zero
+        if (pthread_mutex_init(&ton_shm_cache_stripe(cache, i)->mutex, &attr) != 0) {
+            pthread_mutexattr_destroy(&attr);
+            munmap(cache->base, cache->size);
+            free(cache);
+            return NULL;
+        }
+    }
+    pthread_mutexattr_destroy(&attr);
+    return cache;
+}
+
+void ton_shm_cache_destroy(ton_shm_cache_t *cache) {
+    // child processes just unmap the memory, since the mutexes are still used by the others
+    for (uint32_t i = 0; cache->owner == getpid() && i < cache->stripe_count; i++) {
+        pthread_mutex_destroy(&ton_shm_cache_stripe(cache, i)->mutex);
+    }
+    munmap(cache->base, cache->size);
+    free(cache);
+}
+
+bool ton_shm_cache_get(ton_shm_cache_t *cache, const char *key, size_t key_len, int64_t now,
+                       ton_shm_cache_alloc_fn alloc_fn, void *arg) {
+    uint64_t hash = ton_shm_cache_hash(key, key_len);
+    ton_shm_cache_stripe_t *stripe = ton_shm_cache_stripe(cache, (uint32_t) (hash % cache->stripe_count));
+    bool result = false;
+    ton_shm_cache_lock(cache, stripe);
+    ton_shm_cache_slot_t *slots = ton_shm_cache_slots(stripe);
+    char *arena = ton_shm_cache_arena(cache, stripe);
+    uint32_t first = (uint32_t) ((hash >> 32) % cache->slot_count);
+    for (uint32_t i = 0; i < TON_SHM_CACHE_PROBE_LIMIT && i < cache->slot_count; i++) {
+        ton_shm_cache_slot_t *slot = &slots[(first + i) % cache->slot_count];
+        if (!slot->expires) {
+            break;
+        }
+        if (slot->hash == hash && slot->key_len == key_len && slot->expires > now &&
+            memcmp(arena + slot->offset, key, key_len) == 0) {
+            char *buffer = alloc_fn(slot->value_len, arg);
+            if (buffer) {
+                memcpy(buffer, arena + slot->offset + key_len, slot->value_len);
+                result = true;
+            }
+            break;
+        }
+    }
+    if (result) {
+        stripe->hits++;
+    } else {
+        stripe->misses++;
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+    return result;
+}
+
+bool ton_shm_cache_put(ton_shm_cache_t *cache, const char *key, size_t key_len,
+                       const char *value, size_t value_len, int64_t now, int64_t expires) {
+    if (key_len + value_len > cache->arena_size) {
+        return false;
+    }
+    uint64_t hash = ton_shm_cache_hash(key, key_len);
+    ton_shm_cache_stripe_t *stripe = ton_shm_cache_stripe(cache, (uint32_t) (hash % cache->stripe_count));
+    ton_shm_cache_lock(cache, stripe);
+    ton_shm_cache_slot_t *slots = ton_shm_cache_slots(stripe);
+    char *arena = ton_shm_cache_arena(cache, stripe);
+    uint32_t first = (uint32_t) ((hash >> 32) % cache->slot_count);
+
+    // the same key (to be replaced), or else the first free or expired slot;
+    // slots are never freed one by one, so a free slot ends the probe sequence
+    ton_shm_cache_slot_t *target = NULL, *reusable = NULL;
+    for (uint32_t i = 0; i < TON_SHM_CACHE_PROBE_LIMIT && i < cache->slot_count; i++) {
+        ton_shm_cache_slot_t *slot = &slots[(first + i) % cache->slot_count];
+        if (!slot->expires) {
+            if (!reusable) {
+                reusable = slot;
+            }
+            break;
+        }
+        if (slot->hash == hash && slot->key_len == key_len && memcmp(arena + slot->offset, key, key_len) == 0) {
+            target = slot;
+            break;
+        }
+        if (!reusable && slot->expires <= now) {
+            reusable = slot;
+        }
+    }
+    if (!target) {
+        target = reusable;
+    }
+    if (!target || stripe->used + key_len + value_len > cache->arena_size) {
+        ton_shm_cache_reset(cache, stripe);
+        target = &slots[first];
+    }
+    if (!target->expires) {
+        stripe->entries++;
+    }
+    target->hash = hash;
+    target->offset = stripe->used;
+    target->key_len = (uint32_t) key_len;
+    target->value_len = (uint32_t) value_len;
+    target->expires = expires;
+    memcpy(arena + stripe->used, key, key_len);
+    memcpy(arena + stripe->used + key_len, value, value_len);
+    stripe->used += (uint32_t) (key_len + value_len);
+    stripe->stores++;
+    pthread_mutex_unlock(&stripe->mutex);
+    return true;
+}
+
+void ton_shm_cache_get_stats(ton_shm_cache_t *cache, ton_shm_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(ton_shm_cache_stats_t));
+    stats->size = cache->size;
+    for (uint32_t i = 0; i < cache->stripe_count; i++) {
+        ton_shm_cache_stripe_t *stripe = ton_shm_cache_stripe(cache, i);
+        ton_shm_cache_lock(cache, stripe);
+        stats->entries += stripe->entries;
+        stats->hits += stripe->hits;
+        stats->misses += stripe->misses;
+        stats->stores += stripe->stores;
+        stats->resets += stripe->resets;
+        pthread_mutex_unlock(&stripe->mutex);
+    }
+}
+
+#else
+
+ton_shm_cache_t *ton_shm_cache_create(size_t size) {
+    (void) size;
+    return NULL;
+}
+
+void ton_shm_cache_destroy(ton_shm_cache_t *cache) {
+    (void) cache;
+}
+
+bool ton_shm_cache_get(ton_shm_cache_t *cache, const char *key, size_t key_len, int64_t now,
+                       ton_shm_cache_alloc_fn alloc_fn, void *arg) {
+    (void) cache;
+    (void) key;
+    (void) key_len;
+    (void) now;
+    (void) alloc_fn;
+    (void) arg;
+    return false;
+}
+
+bool ton_shm_cache_put(ton_shm_cache_t *cache, const char *key, size_t key_len,
+                       const char *value, size_t value_len, int64_t now, int64_t expires) {
+    (void) cache;
+    (void) key;
+    (void) key_len;
+    (void) value;
+    (void) value_len;
+    (void) now;
+    (void) expires;
+    return false;
+}
+
+void ton_shm_cache_get_stats(ton_shm_cache_t *cache, ton_shm_cache_stats_t *stats) {
+    (void) cache;
+    memset(stats, 0, sizeof(ton_shm_cache_stats_t));
+}
+
+#endif
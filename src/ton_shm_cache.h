@@ -0,0 +1,67 @@
+#ifndef TON_SHM_CACHE_H
+#define TON_SHM_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Key-value cache in anonymous shared memory, mapped before the process forks
+ * (e.g. in MINIT of the PHP-FPM master), so that all the child processes see
+ * the same entries.
+ *
+ * Memory is split into stripes, each with its own process-shared mutex, hash index
+ * and arena for keys and values. Entries are never freed one by one: they expire
+ * at the given time, and the stripe is wiped as a whole once its arena (or the
+ * probed part of the index) is full.
+ *
+ * Not supported on Windows, where ton_shm_cache_create() always returns NULL.
+ */
+typedef struct ton_shm_cache ton_shm_cache_t;
+
+/**
+ * Cache statistics snapshot, summed over all the stripes
+ */
+typedef struct ton_shm_cache_stats {
+    size_t size;
+    uint32_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t resets;
+} ton_shm_cache_stats_t;
+
+/**
+ * allocates buffer of len bytes for the value found by ton_shm_cache_get();
+ * called with the stripe locked, so it must not block or jump out.
+ * @returns NULL if out of memory, then the value is not returned
+ */
+typedef char *(*ton_shm_cache_alloc_fn)(size_t len, void *arg);
+
+/**
+ * maps size bytes of shared memory for the cache
+ * @returns NULL if size is too small or shared memory is not available
+ */
+ton_shm_cache_t *ton_shm_cache_create(size_t size);
+
+void ton_shm_cache_destroy(ton_shm_cache_t *cache);
+
+/**
+ * looks up the entry which is not expired by now (seconds since the Epoch),
+ * and copies its value into the buffer allocated by alloc_fn
+ * @returns false if there's no such entry
+ */
+bool ton_shm_cache_get(ton_shm_cache_t *cache, const char *key, size_t key_len, int64_t now,
+                       ton_shm_cache_alloc_fn alloc_fn, void *arg);
+
+/**
+ * stores the entry, which expires at the given time (seconds since the Epoch);
+ * entries expired by now can be overwritten by it
+ * @returns false if the entry is too large for the cache
+ */
+bool ton_shm_cache_put(ton_shm_cache_t *cache, const char *key, size_t key_len,
+                       const char *value, size_t value_len, int64_t now, int64_t expires);
+
+void ton_shm_cache_get_stats(ton_shm_cache_t *cache, ton_shm_cache_stats_t *stats);
+
+#endif /* TON_SHM_CACHE_H */
@@ -0,0 +1,83 @@
+#include "ton_stats.h"
+#include "ton_atomic.h"
+#include "os.h"
+
+#ifdef TON_WINDOWS
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define TON_STATS_STRIPES 16
+#define TON_STATS_CACHE_LINE 64
+
+// Stripes are padded to whole cache lines, so that neighbours don't share any.
+
+typedef union ton_stats_stripe {
+    volatile uint64_t counters[TON_STAT_COUNT];
+    char pad[(TON_STAT_COUNT * sizeof(uint64_t) + TON_STATS_CACHE_LINE - 1) / TON_STATS_CACHE_LINE
+             * TON_STATS_CACHE_LINE];
+} ton_stats_stripe_t;
+
+typedef union ton_stats_gauge {
+    struct {
+        volatile uint64_t value;
+        volatile uint64_t peak;
+    } v;
+    char pad[TON_STATS_CACHE_LINE];
+} ton_stats_gauge_t;
+
+static ton_stats_stripe_t stripes[TON_STATS_STRIPES];
+static ton_stats_gauge_t gauges[TON_GAUGE_COUNT];
+
+// Stripes are assigned to the threads round-robin; 0 means not assigned yet.
+
+static volatile uint64_t next_stripe;
+static TON_THREAD_LOCAL uint32_t thread_stripe;
+
+static inline ton_stats_stripe_t *ton_stats_stripe(void) {
+    if (!thread_stripe) {
+        thread_stripe = (uint32_t) (ton_atomic_add_u64(&next_stripe, 1) % TON_STATS_STRIPES) + 1;
+    }
+    return &stripes[thread_stripe - 1];
+}
+
+void ton_stats_add(ton_stat_t stat, uint64_t value) {
+    ton_atomic_add_u64(&ton_stats_stripe()->counters[stat], value);
+}
+
+uint64_t ton_stats_get(ton_stat_t stat) {
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < TON_STATS_STRIPES; i++) {
+        result += ton_atomic_load_u64(&stripes[i].counters[stat]);
+    }
+    return result;
+}
+
+void ton_gauge_add(ton_gauge_t gauge, int64_t delta) {
+    uint64_t value = ton_atomic_add_u64(&gauges[gauge].v.value, (uint64_t) delta);
+    if (delta > 0) {
+        ton_atomic_max_u64(&gauges[gauge].v.peak, value);
+    }
+}
+
+void ton_gauge_get(ton_gauge_t gauge, uint64_t *value, uint64_t *peak) {
+    *value = ton_atomic_load_u64(&gauges[gauge].v.value);
+    *peak = ton_atomic_load_u64(&gauges[gauge].v.peak);
+}
+
+uint64_t ton_stats_now_ns(void) {
+#ifdef TON_WINDOWS
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (uint64_t) ((double) counter.QuadPart * 1e9 / (double) frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+#endif
+}
@@ -0,0 +1,49 @@
+#ifndef TON_STATS_H
+#define TON_STATS_H
+
+#include <stdint.h>
+
+/**
+ * Always-on counters of the extension internals, updated by both SDK and PHP threads.
+ *
+ * Counters are split into per-thread stripes (each thread sticks to the one assigned
+ * on its first update), so that threads updating them concurrently don't contend
+ * for the same cache line; ton_stats_get() sums the stripes up.
+ *
+ * Gauges go up and down, keeping track of their peak value, so they are global.
+ */
+
+typedef enum ton_stat {
+    TON_STAT_REQUESTS_STARTED = 0,
+    TON_STAT_REQUESTS_FINISHED,
+    TON_STAT_REQUESTS_CANCELLED,    // by ton_request_cancel, or by releasing the unfinished request handle
+    TON_STAT_EVENTS_RECEIVED,   // callbacks received from TON SDK
+    TON_STAT_BYTES_COPIED,      // callback JSON copied into queue elements and PHP strings
+    TON_STAT_PUSH_WAITS,        // pushes which waited for a free slot in the full queue
+    TON_STAT_PUSH_WAIT_NS,      // time spent by them
+    TON_STAT_POP_WAITS,         // pops which waited for the empty queue
+    TON_STAT_POP_TIMEOUTS,      // pops which got nothing within the timeout
+    TON_STAT_COUNT
+} ton_stat_t;
+
+typedef enum ton_gauge {
+    TON_GAUGE_QUEUED_EVENTS = 0,    // callbacks held by the extension until they are fetched
+    TON_GAUGE_QUEUED_BYTES,         // memory taken by them
+    TON_GAUGE_ABANDONED_REQUESTS,   // released before they are finished, waiting for the final callback
+    TON_GAUGE_COUNT
+} ton_gauge_t;
+
+void ton_stats_add(ton_stat_t stat, uint64_t value);
+
+uint64_t ton_stats_get(ton_stat_t stat);
+
+void ton_gauge_add(ton_gauge_t gauge, int64_t delta);
+
+void ton_gauge_get(ton_gauge_t gauge, uint64_t *value, uint64_t *peak);
+
+/**
+ * @returns monotonic time in nanoseconds, for measuring durations
+ */
+uint64_t ton_stats_now_ns(void);
+
+#endif /* TON_STATS_H */
@@ -0,0 +1,147 @@
+#include "ton_trace.h"
+#include "ton_atomic.h"
+#include "ton_stats.h"
+#include "os.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Events kept per thread (power of 2), and the max number of threads traced;
+// events of the threads started after that many are not recorded.
+
+#define TON_TRACE_RING_SIZE 4096
+#define TON_TRACE_MAX_THREADS 64
+
+typedef struct ton_trace_ring {
+    volatile uint32_t head;     // number of events recorded
+    ton_trace_event_t events[TON_TRACE_RING_SIZE];
+} ton_trace_ring_t;
+
+volatile uint32_t ton_trace_enabled;
+
+static ton_trace_ring_t *rings[TON_TRACE_MAX_THREADS];
+static volatile uint32_t ring_count;
+
+// Ring of the current thread; points to the sentinel if the thread can't be traced.
+
+static ton_trace_ring_t no_ring;
+static TON_THREAD_LOCAL ton_trace_ring_t *thread_ring;
+
+static ton_trace_ring_t *ton_trace_register(void) {
+    uint32_t index = ton_atomic_add_u32(&ring_count, 1) - 1;
+    if (index >= TON_TRACE_MAX_THREADS) {
+        ton_atomic_sub_u32(&ring_count, 1);
+        return &no_ring;
+    }
+    ton_trace_ring_t *ring = calloc(1, sizeof(ton_trace_ring_t));
+    if (!ring) {
+        // slot stays empty, and is skipped by readers
+        return &no_ring;
+    }
+    ton_atomic_fence();
+    rings[index] = ring;
+    return ring;
+}
+
+void ton_trace_set_enabled(bool enabled) {
+    ton_atomic_store_u32(&ton_trace_enabled, enabled ? 1 : 0);
+}
+
+void ton_trace_record(ton_trace_type_t type, int64_t request_id, uint64_t arg) {
+    ton_trace_ring_t *ring = thread_ring;
+    if (!ring) {
+        ring = thread_ring = ton_trace_register();
+    }
+    if (ring == &no_ring) {
+        return;
+    }
+    uint32_t pos = ring->head;
+    ton_trace_event_t *event = &ring->events[pos & (TON_TRACE_RING_SIZE - 1)];
+    // readers skip the event while seq doesn't match its position
+    ton_atomic_store_u32(&event->seq, 0);
+    ton_atomic_fence();
+    event->time = ton_stats_now_ns();
+    event->request_id = request_id;
+    event->arg = arg;
+    event->type = (uint8_t) type;
+    ton_atomic_store_u32(&event->seq, pos + 1);
+    ton_atomic_store_u32(&ring->head, pos + 1);
+}
+
+static int ton_trace_event_compare(const void *a, const void *b) {
+    const ton_trace_event_t *x = a, *y = b;
+    return x->time < y->time ? -1 : x->time > y->time;
+}
+
+uint32_t ton_trace_snapshot(ton_trace_event_t **events, uint32_t limit) {
+    uint32_t count = ton_atomic_load_u32(&ring_count);
+    if (count > TON_TRACE_MAX_THREADS) {
+        count = TON_TRACE_MAX_THREADS;
+    }
+    ton_trace_event_t *result = malloc((size_t) count * TON_TRACE_RING_SIZE * sizeof(ton_trace_event_t) + 1);
+    uint32_t n = 0;
+    if (!result) {
+        *events = NULL;
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        ton_trace_ring_t *ring = rings[i];
+        if (!ring) {
+            continue;
+        }
+        uint32_t head = ton_atomic_load_u32(&ring->head);
+        uint32_t pos = head > TON_TRACE_RING_SIZE ? head - TON_TRACE_RING_SIZE : 0;
+        for (; pos < head; pos++) {
+            ton_trace_event_t *event = &ring->events[pos & (TON_TRACE_RING_SIZE - 1)];
+            if (ton_atomic_load_u32(&event->seq) != pos + 1) {
+                continue;
+            }
+            result[n] = *event;
+            ton_atomic_fence();
+            // overwritten while it's been copied
+            if (ton_atomic_load_u32(&event->seq) != pos + 1) {
+                continue;
+            }
+            result[n].thread = (uint16_t) i;
+            n++;
+        }
+    }
+    qsort(result, n, sizeof(ton_trace_event_t), ton_trace_event_compare);
+    if (limit && n > limit) {
+        memmove(result, result + (n - limit), limit * sizeof(ton_trace_event_t));
+        n = limit;
+    }
+    *events = result;
+    return n;
+}
+
+const char *ton_trace_type_name(uint8_t type) {
+    switch (type) {
+        case TON_TRACE_START:
+            return "start";
+        case TON_TRACE_ENQUEUE:
+            return "enqueue";
+        case TON_TRACE_DEQUEUE:
+            return "dequeue";
+        case TON_TRACE_JOIN:
+            return "join";
+        case TON_TRACE_DISCONNECT:
+            return "disconnect";
+        case TON_TRACE_ABANDON:
+            return "abandon";
+        case TON_TRACE_FREE:
+            return "free";
+        case TON_TRACE_CANCEL:
+            return "cancel";
+        default:
+            return "unknown";
+    }
+}
+
+void ton_trace_destroy(void) {
+    ton_trace_set_enabled(false);
+    uint32_t count = ton_atomic_load_u32(&ring_count);
+    for (uint32_t i = 0; i < count && i < TON_TRACE_MAX_THREADS; i++) {
+        free(rings[i]);
+        rings[i] = NULL;
+    }
+}
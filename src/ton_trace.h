@@ -0,0 +1,78 @@
+#ifndef TON_TRACE_H
+#define TON_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Binary trace of the request lifecycle, for post-mortem analysis of stalls
+ * in production, where TON_DBG_MSG output is not an option.
+ *
+ * Every thread (PHP or SDK) records its events into its own ring, registered
+ * on the first event, so recording takes no locks: the oldest events are
+ * overwritten. Readers take a snapshot of all the rings, skipping the events
+ * being overwritten at the moment.
+ *
+ * Tracing is toggled at runtime; when it's off, TON_TRACE costs a single branch.
+ */
+
+typedef enum ton_trace_type {
+    TON_TRACE_START = 1,    // arg: context
+    TON_TRACE_ENQUEUE,      // arg: see TON_TRACE_ENQUEUE_ARG
+    TON_TRACE_DEQUEUE,      // arg: time spent in the queue, ns
+    TON_TRACE_JOIN,         // arg: ID of the request receiving the events
+    TON_TRACE_DISCONNECT,   // arg: ID of the request which was receiving the events
+    TON_TRACE_ABANDON,      // arg: 0; handle is released before the request is finished
+    TON_TRACE_FREE,         // arg: number of events fetched
+    TON_TRACE_CANCEL        // arg: number of queued events freed
+} ton_trace_type_t;
+
+// Callback status, final callback flag and the queue push result (rpa_queue_push_result_t,
+// or TON_TRACE_NOT_QUEUED if the callback isn't pushed to the queue) packed together.
+
+#define TON_TRACE_NOT_QUEUED 0xFF
+#define TON_TRACE_ENQUEUE_ARG(status, finished, result) \
+    ((uint64_t) (uint32_t) (status) | ((uint64_t) ((finished) ? 1 : 0) << 32) | ((uint64_t) ((result) & 0xFF) << 40))
+
+typedef struct ton_trace_event {
+    uint64_t time;          // monotonic, ns
+    int64_t request_id;
+    uint64_t arg;
+    volatile uint32_t seq;  // position in the ring + 1 once written, 0 while being written
+    uint16_t thread;        // ring number, set in snapshots
+    uint8_t type;
+} ton_trace_event_t;
+
+extern volatile uint32_t ton_trace_enabled;
+
+#if defined(__GNUC__)
+#define TON_TRACE_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define TON_TRACE_UNLIKELY(x) (x)
+#endif
+
+#define TON_TRACE(type, request_id, arg) do { \
+        if (TON_TRACE_UNLIKELY(ton_trace_enabled)) { \
+            ton_trace_record((type), (int64_t) (request_id), (uint64_t) (arg)); \
+        } \
+    } while (0)
+
+void ton_trace_set_enabled(bool enabled);
+
+void ton_trace_record(ton_trace_type_t type, int64_t request_id, uint64_t arg);
+
+/**
+ * copies the events recorded by all the threads into the array allocated with malloc,
+ * ordered by time; at most limit latest events if limit isn't 0
+ * @returns number of events
+ */
+uint32_t ton_trace_snapshot(ton_trace_event_t **events, uint32_t limit);
+
+const char *ton_trace_type_name(uint8_t type);
+
+/**
+ * frees all the rings; no events may be recorded after it
+ */
+void ton_trace_destroy(void);
+
+#endif /* TON_TRACE_H */
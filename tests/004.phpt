@@ -0,0 +1,54 @@
+--TEST--
+ton_request_start() / ton_request_next() against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":3,"mock_payload_size":4}'), true)['result'];
+$request = ton_request_start($context, 'mock.run', '{}');
+do {
+	[$json, $status, $finished, $id] = ton_request_next($request, 5000);
+	$data = json_decode($json, true);
+	var_dump($data['seq'], $data['data'], $status, $finished, $id === ton_request_id($request));
+} while (!$finished);
+var_dump(is_ton_request_finished($request));
+var_dump(ton_request_next($request, 10));
+
+$request = ton_request_start($context, 'mock.run', '{"mock_callbacks":1,"mock_finish":1}');
+var_dump(ton_request_next($request, 5000)[2]);
+var_dump(ton_request_next($request, 5000));
+ton_destroy_context($context);
+?>
+--EXPECT--
+int(0)
+string(4) "xxxx"
+int(0)
+bool(false)
+bool(true)
+int(1)
+string(4) "xxxx"
+int(0)
+bool(false)
+bool(true)
+int(2)
+string(4) "xxxx"
+int(0)
+bool(true)
+bool(true)
+bool(true)
+NULL
+bool(false)
+array(5) {
+  [0]=>
+  string(0) ""
+  [1]=>
+  int(2)
+  [2]=>
+  bool(true)
+  [3]=>
+  int(2)
+  [4]=>
+  int(0)
+}
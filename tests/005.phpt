@@ -0,0 +1,45 @@
+--TEST--
+ton_request_wait_any() / ton_request_wait_all() against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":1}'), true)['result'];
+$requests = [
+	'fast' => ton_request_start($context, 'mock.run', '{}'),
+	'slow' => ton_request_start($context, 'mock.run', '{"mock_delay_us":300000}'),
+];
+var_dump(array_keys(ton_request_wait_any($requests, 5000)));
+var_dump(ton_request_wait_all($requests, 5000));
+var_dump(array_keys(ton_request_wait_any($requests, 0)));
+foreach ($requests as $request) {
+	ton_request_next($request);
+}
+var_dump(ton_request_wait_any($requests));
+var_dump(ton_request_wait_any([1]));
+$bound = ton_request_start($context, 'mock.run', '{}', ton_completion_queue_create());
+try {
+	ton_request_wait_all([$bound], 5000);
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+ton_destroy_context($context);
+?>
+--EXPECT--
+array(1) {
+  [0]=>
+  string(4) "fast"
+}
+bool(true)
+array(2) {
+  [0]=>
+  string(4) "fast"
+  [1]=>
+  string(4) "slow"
+}
+array(0) {
+}
+NULL
+Requests bound to a completion queue can't be waited for
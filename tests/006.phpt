@@ -0,0 +1,33 @@
+--TEST--
+ton_completion_queue_create() / ton_completion_queue_next() against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":2}'), true)['result'];
+$queue = ton_completion_queue_create();
+$ids = [];
+for ($i = 0; $i < 10; $i++) {
+	$request = ton_request_start($context, 'mock.run', '{}', $queue);
+	$ids[ton_request_id($request)] = 0;
+}
+$finished = 0;
+while ($finished < 10) {
+	[$json, $status, $done, $id] = ton_completion_queue_next($queue, 5000);
+	$ids[$id]++;
+	$finished += $done ? 1 : 0;
+}
+var_dump(array_unique($ids));
+var_dump(ton_completion_queue_next($queue, 10));
+var_dump(ton_request_next($request, 10));
+ton_destroy_context($context);
+?>
+--EXPECT--
+array(1) {
+  [1]=>
+  int(2)
+}
+NULL
+NULL
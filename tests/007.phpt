@@ -0,0 +1,40 @@
+--TEST--
+ton_request_stream() / ton_completion_queue_stream() against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+if (PHP_OS_FAMILY === 'Windows') {
+	echo 'skip not supported on Windows';
+}
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":1,"mock_delay_us":50000}'), true)['result'];
+
+$request = ton_request_start($context, 'mock.run', '{}');
+$stream = ton_request_stream($request);
+$read = [$stream]; $write = $except = null;
+var_dump(stream_select($read, $write, $except, 5));
+[$json, $status, $done] = ton_request_next($request, 0);
+var_dump($done);
+$read = [$stream];
+var_dump(stream_select($read, $write, $except, 0, 10000));
+
+$queue = ton_completion_queue_create();
+$request = ton_request_start($context, 'mock.run', '{}', $queue);
+var_dump(ton_request_stream($request));
+$stream = ton_completion_queue_stream($queue);
+$read = [$stream];
+var_dump(stream_select($read, $write, $except, 5));
+[$json, $status, $done] = ton_completion_queue_next($queue, 0);
+var_dump($done);
+
+ton_destroy_context($context);
+?>
+--EXPECT--
+int(1)
+bool(true)
+int(0)
+NULL
+int(1)
+bool(true)
@@ -0,0 +1,30 @@
+--TEST--
+ton_request_next_batch() against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":10}'), true)['result'];
+$request = ton_request_start($context, 'mock.run', '{}');
+
+$batch = ton_request_next_batch($request, 4, 5000);
+var_dump(count($batch), $batch[0][2]);
+
+// returns early on the final event
+$batch = ton_request_next_batch($request, 100, 5000);
+var_dump(count($batch), end($batch)[2]);
+
+var_dump(ton_request_next_batch($request, 100));
+var_dump(ton_request_next_batch($request, 0));
+ton_destroy_context($context);
+?>
+--EXPECT--
+int(4)
+bool(false)
+int(6)
+bool(true)
+array(0) {
+}
+NULL
@@ -0,0 +1,31 @@
+--TEST--
+ton_client_stats() request pool counters
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--INI--
+ton_client.request_pool_size=4
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{}'), true)['result'];
+$before = ton_client_stats();
+for ($i = 0; $i < 10; $i++) {
+	$request = ton_request_start($context, 'mock.run', '{}');
+	while (!ton_request_next($request, 5000)[2]);
+	unset($request);
+}
+$after = ton_client_stats();
+var_dump($after['request_pool_capacity']);
+var_dump($after['request_pool_misses'] - $before['request_pool_misses']);
+var_dump($after['request_pool_hits'] - $before['request_pool_hits']);
+var_dump($after['queue_pool_hits'] - $before['queue_pool_hits']);
+var_dump($after['request_pool_size']);
+ton_destroy_context($context);
+?>
+--EXPECT--
+int(4)
+int(1)
+int(9)
+int(9)
+int(1)
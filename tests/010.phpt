@@ -0,0 +1,73 @@
+--TEST--
+Overflow policies of completion queues against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+if (ton_completion_queue_create(4, ['overflow' => TON_OVERFLOW_DROP_OLDEST]) === null) {
+	echo 'skip not supported by the callback queue implementation';
+}
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":10}'), true)['result'];
+var_dump(ton_completion_queue_create(4, ['overflow' => 42]));
+var_dump(ton_request_start($context, 'mock.run', '{}', null, ['overflow_timeout' => 'soon']));
+$queue = ton_completion_queue_create();
+var_dump(ton_request_start($context, 'mock.run', '{}', $queue, ['overflow' => TON_OVERFLOW_DROP_NEWEST]));
+
+$before = ton_client_stats();
+
+// only the last 4 events are kept
+$queue = ton_completion_queue_create(4, ['overflow' => TON_OVERFLOW_DROP_OLDEST]);
+$request = ton_request_start($context, 'mock.run', '{}', $queue);
+usleep(300000);
+while ($event = ton_completion_queue_next($queue, 10)) {
+	[$json, $status, $finished, $id, $lost] = $event;
+	echo json_decode($json, true)['seq'], ' ', $lost, $finished ? ' finished' : '', "\n";
+}
+
+// grows up to 8, then drops on timeout
+$queue = ton_completion_queue_create(4, ['overflow' => TON_OVERFLOW_GROW, 'max_capacity' => 8, 'overflow_timeout' => 0]);
+$request = ton_request_start($context, 'mock.run', '{}', $queue);
+usleep(300000);
+$count = 0;
+while (ton_completion_queue_next($queue, 10)) {
+	$count++;
+}
+var_dump($count);
+
+// the final event is kept, and reports the ones dropped before it
+$queue = ton_completion_queue_create(4, ['overflow' => TON_OVERFLOW_DROP_NEWEST]);
+$request = ton_request_start($context, 'mock.run', ['mock_burst' => 10], $queue);
+usleep(300000);
+while ($event = ton_completion_queue_next($queue)) {
+	[$json, $status, $finished, $id, $lost] = $event;
+	echo json_decode($json, true)['seq'], ' ', $lost, $finished ? ' finished' : '', "\n";
+	if ($finished) {
+		break;
+	}
+}
+
+$after = ton_client_stats();
+var_dump($after['overflow_evicted'] - $before['overflow_evicted']);
+var_dump($after['overflow_grown'] - $before['overflow_grown']);
+var_dump($after['overflow_timeouts'] - $before['overflow_timeouts']);
+ton_destroy_context($context);
+?>
+--EXPECT--
+NULL
+NULL
+NULL
+6 6
+7 0
+8 0
+9 0 finished
+int(9)
+0 0
+1 0
+2 0
+3 0
+9 5 finished
+int(6)
+int(2)
+int(1)
@@ -0,0 +1,42 @@
+--TEST--
+Decoded responses against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":2,"mock_finish":1}'), true)['result'];
+
+$params = '{"s":"a\"b\\\\c\/é😀\n","i":[0,-12,9223372036854775807,18446744073709551616],'
+    . '"f":[1.5,-2e3,0.1],"b":[true,false,null],"o":{"7":{},"x":[]},"":""}';
+$result = ton_request_sync($context, 'mock.echo', $params, true);
+var_dump($result === json_decode(ton_request_sync($context, 'mock.echo', $params), true));
+var_dump(array_keys($result['result']['o']));
+
+// not a valid JSON, returned as is
+var_dump(ton_request_sync($context, 'mock.echo', '[1,', true));
+
+$request = ton_request_start($context, 'mock.run', '{}', null, ['decode' => true]);
+while ($event = ton_request_next($request, 5000)) {
+	[$data, $status, $finished] = $event;
+	echo is_array($data) ? implode(',', array_keys($data)) . ' seq=' . $data['seq'] : var_export($data, true);
+	echo $finished ? ' finished' : '', "\n";
+	if ($finished) {
+		break;
+	}
+}
+ton_destroy_context($context);
+?>
+--EXPECT--
+bool(true)
+array(2) {
+  [0]=>
+  int(7)
+  [1]=>
+  string(1) "x"
+}
+string(15) "{"result":[1,}"
+seq,request,ts,data seq=0
+seq,request,ts,data seq=1
+NULL finished
@@ -0,0 +1,64 @@
+--TEST--
+Params passed as arrays against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{}'), true)['result'];
+
+$object = new stdClass();
+$object->public = 'x';
+$params = [
+	's' => "a\"b\\c/é😀\n\x01",
+	'i' => [0, -12, PHP_INT_MAX],
+	'f' => [1.5, -2e30, 0.1],
+	'b' => [true, false, null],
+	'm' => [1 => 'a', 2 => 'b'],
+	'e' => [],
+	'o' => $object,
+];
+$result = ton_request_sync($context, 'mock.echo', $params, true)['result'];
+$params['o'] = (array)$params['o'];
+var_dump($result == $params);
+// floats are encoded the same way as json_encode does
+$floats = ['f' => [0.1, 1 / 3, -2e30, 1e-7, 100.0]];
+var_dump(ton_request_sync($context, 'mock.echo', $floats) === '{"result":' . json_encode($floats) . '}');
+var_dump(ton_request_sync($context, 'mock.echo', [], true));
+var_dump(ton_request_sync($context, 'mock.echo', ['list' => [1, 2], 'empty' => []]));
+
+// no JSON representation
+var_dump(ton_request_sync($context, 'mock.echo', ['f' => INF]));
+var_dump(ton_request_sync($context, 'mock.echo', ['r' => STDIN]));
+var_dump(ton_request_sync($context, 'mock.echo', 42));
+$recursive = ['a' => 1];
+$recursive['self'] = &$recursive;
+var_dump(ton_request_start($context, 'mock.run', $recursive));
+
+// per-request mock settings are passed as params
+$request = ton_request_start($context, 'mock.run', ['mock_callbacks' => 3]);
+$count = 0;
+while ($event = ton_request_next($request, 5000)) {
+	$count++;
+	if ($event[2]) {
+		break;
+	}
+}
+var_dump($count);
+ton_destroy_context($context);
+?>
+--EXPECT--
+bool(true)
+bool(true)
+array(1) {
+  ["result"]=>
+  array(0) {
+  }
+}
+string(36) "{"result":{"list":[1,2],"empty":[]}}"
+NULL
+NULL
+NULL
+NULL
+int(3)
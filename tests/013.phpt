@@ -0,0 +1,51 @@
+--TEST--
+ton_request_all() against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":1,"mock_workers":4}'), true)['result'];
+
+$results = ton_request_all($context, [
+	'slow' => ['mock.run', ['mock_delay_us' => 200000]],
+	'fast' => ['mock.run', '{}'],
+	'error' => ['mock.run', ['mock_status' => 1]],
+	'nop' => ['mock.run', ['mock_finish' => 1]],
+	'invalid' => ['mock.run', ['f' => INF]],
+], 5000, true);
+foreach ($results as $name => $result) {
+	echo $name, ': ', $result === null ? 'null' : implode(',', array_keys($result)), "\n";
+}
+
+$results = ton_request_all($context, [['mock.run', '{}']]);
+var_dump(strpos($results[0], '{"result":{"seq":0,') === 0, substr($results[0], -1));
+
+// calls failed to be encoded take no request ID
+$results = ton_request_all($context, [['mock.run', ['f' => NAN]], ['mock.run', '{}'], ['mock.run', '{}']], 5000, true);
+var_dump($results[0], isset($results[1]['result'], $results[2]['result']));
+
+// the slow one is out of time
+$results = ton_request_all($context, [['mock.run', ['mock_delay_us' => 2000000]], ['mock.run', '{}']], 500, true);
+var_dump($results[0], isset($results[1]['result']));
+
+var_dump(ton_request_all($context, []));
+var_dump(ton_request_all($context, [['mock.run']]));
+ton_destroy_context($context);
+?>
+--EXPECT--
+slow: result
+fast: result
+error: error
+nop: result
+invalid: null
+bool(true)
+string(1) "}"
+NULL
+bool(true)
+NULL
+bool(true)
+array(0) {
+}
+NULL
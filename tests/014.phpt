@@ -0,0 +1,64 @@
+--TEST--
+TonRequest and TonResponse classes against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":3}'), true)['result'];
+
+$request = TonRequest::start($context, 'mock.run', [], ['decode' => true]);
+var_dump($request instanceof TonRequest, $request->id() > 0);
+var_dump(ton_request_wait_all([$request], 5000));
+
+$response = $request->next(5000);
+var_dump(get_class($response), $response->json['seq'], $response->status, $response->finished,
+	$response->requestId === $request->id(), $response->lost);
+
+try {
+	$response->status = 1;
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+try {
+	$response->json['seq'] = 1;
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+try {
+	unset($response->finished);
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+
+$batch = $request->nextBatch(10, 1000);
+var_dump(count($batch), end($batch)->finished, $request->isFinished(), $request->lastStatus());
+
+try {
+	new TonRequest();
+} catch (Error $e) {
+	echo get_class($e), "\n";
+}
+var_dump(TonRequest::start($context, 'mock.run', [], ['overflow' => 42]));
+ton_destroy_context($context);
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+string(11) "TonResponse"
+int(0)
+int(0)
+bool(false)
+bool(true)
+int(0)
+Cannot modify readonly property TonResponse::$status
+Cannot modify readonly property TonResponse::$json
+Cannot modify readonly property TonResponse::$finished
+int(2)
+bool(true)
+bool(true)
+int(0)
+Error
+NULL
@@ -0,0 +1,59 @@
+--TEST--
+ton_await() suspends fibers against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+if (!class_exists('Fiber')) {
+	echo 'skip fibers are not supported';
+}
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":1,"mock_workers":4}'), true)['result'];
+
+$fibers = [];
+foreach (['slow' => 300000, 'fast' => 50000] as $name => $delay) {
+	$fibers[$name] = new Fiber(function () use ($context, $name, $delay) {
+		$request = TonRequest::start($context, 'mock.run', ['mock_delay_us' => $delay], ['decode' => true]);
+		$response = ton_await($request);
+		echo $name, ': ', $response->json['seq'], ',', (int)$response->finished, "\n";
+		var_dump(ton_await($request, 0));
+	});
+	$fibers[$name]->start();
+}
+echo "started\n";
+
+// the main context keeps running fibers while waiting for its own request
+$request = ton_request_start($context, 'mock.run', ['mock_delay_us' => 600000]);
+$event = ton_await($request);
+echo 'main: ', $event[2] ? 'finished' : 'pending', "\n";
+var_dump($fibers['slow']->isTerminated(), $fibers['fast']->isTerminated());
+
+// nothing is waiting
+var_dump(ton_await_run(0));
+
+$fiber = new Fiber(function () use ($context) {
+	$request = ton_request_start($context, 'mock.run', ['mock_delay_us' => 2000000]);
+	var_dump(ton_await($request, 100));
+});
+$fiber->start();
+var_dump(ton_await_run());
+var_dump($fiber->isTerminated());
+
+var_dump(ton_await('foo'));
+ton_destroy_context($context);
+?>
+--EXPECT--
+started
+fast: 0,1
+NULL
+slow: 0,1
+NULL
+main: finished
+bool(true)
+bool(true)
+int(0)
+NULL
+int(1)
+bool(true)
+NULL
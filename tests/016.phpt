@@ -0,0 +1,38 @@
+--TEST--
+Persistent contexts against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--INI--
+ton_client.persistent_contexts_max=2
+--FILE--
+<?php
+$config = '{"mock_callbacks":1}';
+$first = json_decode(ton_create_context($config, true), true)['result'];
+$second = json_decode(ton_create_context($config, true), true)['result'];
+var_dump($first === $second);
+
+$regular = json_decode(ton_create_context($config), true)['result'];
+var_dump($regular === $first);
+ton_destroy_context($regular);
+var_dump(ton_client_stats()['persistent_contexts']);
+
+// destroying persistent context is a no-op
+ton_destroy_context($first);
+$request = ton_request_start($first, 'mock.run', '{}');
+$event = ton_request_next($request, 5000);
+var_dump($event[2]);
+
+// no room for the third one, since all the kept contexts are in use
+$other = json_decode(ton_create_context('{"mock_callbacks":2}', true), true)['result'];
+$third = json_decode(ton_create_context('{"mock_callbacks":3}', true), true)['result'];
+var_dump(ton_client_stats()['persistent_contexts']);
+ton_destroy_context($third);
+?>
+--EXPECT--
+bool(true)
+bool(false)
+int(1)
+bool(true)
+int(2)
@@ -0,0 +1,67 @@
+--TEST--
+ton_request_sync() result cache against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--INI--
+ton_client.result_cache_size=4096
+ton_client.result_cache_functions=" mock.echo , client.*"
+--FILE--
+<?php
+function cache_stats() {
+	$stats = ton_client_stats();
+	echo $stats['result_cache_entries'], ' entries, ', $stats['result_cache_hits'], ' hits, ',
+		$stats['result_cache_misses'], ' misses, ', $stats['result_cache_evictions'], " evictions\n";
+}
+
+$context = json_decode(ton_create_context('{}'), true)['result'];
+var_dump(ton_request_sync($context, 'mock.echo', ['a' => 1]));
+var_dump(ton_request_sync($context, 'mock.echo', ['a' => 1], true));
+var_dump(ton_request_sync($context, 'mock.echo', '{"a":2}'));
+cache_stats();
+
+ton_request_sync($context, 'client.version', '{}');
+ton_request_sync($context, 'client.version', '{}');
+cache_stats();
+
+// too large to be cached
+$large = ['data' => str_repeat('x', 3000)];
+ton_request_sync($context, 'mock.echo', $large);
+ton_request_sync($context, 'mock.echo', $large);
+cache_stats();
+
+// the least recently used ones are evicted
+ton_request_sync($context, 'mock.echo', ['a' => 1]);
+for ($i = 0; $i < 40; $i++) {
+	ton_request_sync($context, 'mock.echo', ['i' => $i, 'data' => str_repeat('x', 30)]);
+}
+var_dump(ton_client_stats()['result_cache_size'] <= 4096, ton_client_stats()['result_cache_evictions'] > 0);
+
+// results are kept separately for every context config
+$other = json_decode(ton_create_context('{"crypto":{"mnemonic_word_count":24}}'), true)['result'];
+$misses = ton_client_stats()['result_cache_misses'];
+ton_request_sync($context, 'mock.echo', ['b' => 1]);
+ton_request_sync($other, 'mock.echo', ['b' => 1]);
+ton_request_sync($other, 'mock.echo', ['b' => 1]);
+var_dump(ton_client_stats()['result_cache_misses'] - $misses);
+ton_destroy_context($other);
+
+ton_destroy_context($context);
+?>
+--EXPECT--
+string(18) "{"result":{"a":1}}"
+array(1) {
+  ["result"]=>
+  array(1) {
+    ["a"]=>
+    int(1)
+  }
+}
+string(18) "{"result":{"a":2}}"
+2 entries, 1 hits, 2 misses, 0 evictions
+3 entries, 2 hits, 3 misses, 0 evictions
+3 entries, 2 hits, 5 misses, 0 evictions
+bool(true)
+bool(true)
+int(2)
@@ -0,0 +1,70 @@
+--TEST--
+ton_request_sync() shared memory cache against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+if (PHP_OS_FAMILY === 'Windows') {
+	echo 'skip not supported on Windows';
+}
+?>
+--INI--
+ton_client.shared_cache_size=1048576
+ton_client.shared_cache_functions="mock.echo:60,client.*"
+ton_client.shared_cache_ttl=0
+--FILE--
+<?php
+function cache_stats() {
+	$stats = ton_client_stats();
+	echo $stats['shared_cache_entries'], ' entries, ', $stats['shared_cache_hits'], ' hits, ',
+		$stats['shared_cache_misses'], ' misses, ', $stats['shared_cache_stores'], " stores\n";
+}
+
+$context = json_decode(ton_create_context('{"mock_callbacks":1}'), true)['result'];
+var_dump(ton_request_sync($context, 'mock.echo', ['a' => 1]));
+var_dump(ton_request_sync($context, 'mock.echo', '{"a":1}', true));
+cache_stats();
+
+// no TTL
+ton_request_sync($context, 'client.version', '{}');
+cache_stats();
+
+// results are kept per config
+$other = json_decode(ton_create_context('{"mock_callbacks":2}'), true)['result'];
+ton_request_sync($other, 'mock.echo', ['a' => 1]);
+cache_stats();
+ton_destroy_context($other);
+
+// unknown context
+ton_request_sync($context + 100, 'mock.echo', ['a' => 1]);
+cache_stats();
+
+// shared by the child processes
+if (function_exists('pcntl_fork')) {
+	$pid = pcntl_fork();
+	if ($pid === 0) {
+		ton_request_sync($context, 'mock.echo', ['b' => 1]);
+		exit(0);
+	}
+	pcntl_waitpid($pid, $status);
+	ton_request_sync($context, 'mock.echo', ['b' => 1]);
+	var_dump(ton_client_stats()['shared_cache_hits']);
+} else {
+	var_dump(2);
+}
+
+ton_destroy_context($context);
+?>
+--EXPECT--
+string(18) "{"result":{"a":1}}"
+array(1) {
+  ["result"]=>
+  array(1) {
+    ["a"]=>
+    int(1)
+  }
+}
+1 entries, 1 hits, 1 misses, 1 stores
+1 entries, 1 hits, 1 misses, 1 stores
+2 entries, 1 hits, 2 misses, 2 stores
+2 entries, 1 hits, 2 misses, 2 stores
+int(2)
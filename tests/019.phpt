@@ -0,0 +1,66 @@
+--TEST--
+Single-flight requests against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":2}'), true)['result'];
+$params = ['mock_delay_us' => 200000];
+
+$leader = ton_request_start($context, 'mock.run', $params, null, ['single_flight' => true, 'decode' => true]);
+$follower = ton_request_start($context, 'mock.run', $params, null, ['single_flight' => true, 'decode' => true]);
+// different decode option
+$other = ton_request_start($context, 'mock.run', $params, null, ['single_flight' => true]);
+var_dump(ton_client_stats()['single_flight_followers']);
+
+foreach (['leader' => $leader, 'follower' => $follower] as $name => $request) {
+	while ($event = ton_request_next($request, 5000)) {
+		[$data, $status, $finished, $id] = $event;
+		echo $name, ': seq ', $data['seq'], ', from leader ', (int)($id === ton_request_id($leader)),
+			', finished ', (int)$finished, "\n";
+	}
+	var_dump(is_ton_request_finished($request));
+}
+while (ton_request_next($other, 5000));
+
+// too late to follow the finished one
+$late = ton_request_start($context, 'mock.run', $params, null, ['single_flight' => true, 'decode' => true]);
+var_dump(ton_client_stats()['single_flight_followers']);
+while (ton_request_next($late, 5000));
+
+// follower joined to the request started with another decode option
+$params = ['mock_delay_us' => 150000];
+$leader = ton_request_start($context, 'mock.run', $params, null, ['single_flight' => true]);
+$follower = ton_request_start($context, 'mock.run', $params, null, ['single_flight' => true]);
+$target = ton_request_start($context, 'mock.run', ['mock_finish' => 2], null, ['decode' => true]);
+ton_request_next($target, 5000);
+ton_request_next($target, 5000);
+var_dump(ton_request_join($target, $follower));
+foreach (['leader' => $leader, 'target' => $target] as $name => $request) {
+	for ($i = 0; $i < 2; $i++) {
+		[$data, $status, $finished, $id] = ton_request_next($request, 5000);
+		echo $name, ': ', gettype($data), ', from leader ', (int)($id === ton_request_id($leader)),
+			', finished ', (int)$finished, "\n";
+	}
+}
+
+var_dump(ton_request_start($context, 'mock.run', $params, ton_completion_queue_create(), ['single_flight' => true]));
+ton_destroy_context($context);
+?>
+--EXPECT--
+int(1)
+leader: seq 0, from leader 1, finished 0
+leader: seq 1, from leader 1, finished 1
+bool(true)
+follower: seq 0, from leader 1, finished 0
+follower: seq 1, from leader 1, finished 1
+bool(true)
+int(1)
+bool(true)
+leader: string, from leader 1, finished 0
+leader: string, from leader 1, finished 1
+target: array, from leader 1, finished 0
+target: array, from leader 1, finished 1
+NULL
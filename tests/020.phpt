@@ -0,0 +1,57 @@
+--TEST--
+Broadcast requests against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":4}'), true)['result'];
+
+$request = ton_request_start($context, 'mock.run', ['mock_delay_us' => 200000], null,
+	['broadcast' => true, 'retention' => 2, 'decode' => true]);
+$first = ton_broadcast_subscribe($request);
+$second = ton_broadcast_subscribe($request, false);
+
+// events are only delivered to the consumers
+var_dump(ton_request_next($request, 0));
+
+foreach (['first' => $first, 'second' => $second] as $name => $consumer) {
+	while ($event = ton_broadcast_next($consumer, 5000)) {
+		[$data, $status, $finished, $id, $lost] = $event;
+		echo $name, ': seq ', $data['seq'], ', finished ', (int)$finished, ', lost ', $lost, "\n";
+	}
+}
+var_dump(is_ton_request_finished($request));
+
+// late joiners replay the retained events only
+$late = ton_broadcast_subscribe($request);
+while ($event = ton_broadcast_next($late, 5000)) {
+	echo 'late: seq ', $event[0]['seq'], "\n";
+}
+var_dump(ton_broadcast_next(ton_broadcast_subscribe($request, false), 0));
+
+var_dump(ton_broadcast_subscribe(ton_request_start($context, 'mock.run', '{}')));
+var_dump(ton_request_start($context, 'mock.run', '{}', null, ['broadcast' => true, 'retention' => -1]));
+var_dump(ton_request_start($context, 'mock.run', '{}', null, ['broadcast' => true, 'retention' => 65537]));
+var_dump(ton_request_start($context, 'mock.run', '{}', ton_completion_queue_create(), ['broadcast' => true]));
+ton_destroy_context($context);
+?>
+--EXPECT--
+NULL
+first: seq 0, finished 0, lost 0
+first: seq 1, finished 0, lost 0
+first: seq 2, finished 0, lost 0
+first: seq 3, finished 1, lost 0
+second: seq 0, finished 0, lost 0
+second: seq 1, finished 0, lost 0
+second: seq 2, finished 0, lost 0
+second: seq 3, finished 1, lost 0
+bool(true)
+late: seq 2
+late: seq 3
+NULL
+NULL
+NULL
+NULL
+NULL
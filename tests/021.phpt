@@ -0,0 +1,51 @@
+--TEST--
+ton_client_stats() request and callback flow counters
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":2}'), true)['result'];
+$before = ton_client_stats();
+$requests = [];
+for ($i = 0; $i < 3; $i++) {
+	$requests[] = ton_request_start($context, 'mock.run', '{}');
+}
+ton_request_wait_all($requests, 5000);
+var_dump(ton_client_stats()['queued_events'] >= 6);
+foreach ($requests as $request) {
+	while (ton_request_next($request, 5000));
+}
+$after = ton_client_stats();
+var_dump($after['requests_started'] - $before['requests_started']);
+var_dump($after['requests_finished'] - $before['requests_finished']);
+var_dump($after['requests_in_flight']);
+var_dump($after['events_received'] - $before['events_received']);
+var_dump($after['queued_events'], $after['queued_bytes']);
+var_dump($after['queued_events_peak'] >= 6, $after['queued_bytes_peak'] > 0);
+var_dump($after['bytes_copied'] > $before['bytes_copied']);
+
+$slow = ton_request_start($context, 'mock.run', ['mock_delay_us' => 200000]);
+var_dump(ton_request_next($slow, 1));
+$stats = ton_client_stats();
+var_dump($stats['pop_waits'] > $after['pop_waits'], $stats['pop_timeouts'] - $after['pop_timeouts']);
+unset($slow);
+var_dump(ton_client_stats()['requests_abandoned']);
+ton_destroy_context($context);
+?>
+--EXPECT--
+bool(true)
+int(3)
+int(3)
+int(0)
+int(6)
+int(0)
+int(0)
+bool(true)
+bool(true)
+bool(true)
+NULL
+bool(true)
+int(1)
+int(1)
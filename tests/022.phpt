@@ -0,0 +1,44 @@
+--TEST--
+ton_request_timings() against the mock TON client
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+$context = json_decode(ton_create_context('{"mock_callbacks":2}'), true)['result'];
+
+$start = hrtime(true);
+$request = ton_request_start($context, 'mock.run', ['mock_delay_us' => 50000]);
+$timings = ton_request_timings($request);
+var_dump($timings['started_at'] >= $start, $timings['first_event_us'], $timings['finished_us']);
+
+// let the events wait in the queue for a while
+ton_request_wait_all([$request], 5000);
+usleep(100000);
+while (ton_request_next($request, 5000));
+
+$timings = ton_request_timings($request);
+var_dump($timings['first_event_us'] >= 50000);
+var_dump($timings['finished_us'] >= $timings['last_event_us'], $timings['last_event_us'] >= $timings['first_event_us']);
+var_dump($timings['events_fetched']);
+var_dump($timings['lag_max_us'] >= 100000, $timings['lag_avg_us'] <= $timings['lag_max_us']);
+
+$object = TonRequest::start($context, 'mock.run', '{}');
+$object->nextBatch(2, 5000);
+var_dump($object->timings()['events_fetched']);
+var_dump(ton_request_timings('foo'));
+ton_destroy_context($context);
+?>
+--EXPECT--
+bool(true)
+NULL
+NULL
+bool(true)
+bool(true)
+bool(true)
+int(2)
+bool(true)
+bool(true)
+int(2)
+NULL
@@ -0,0 +1,58 @@
+--TEST--
+ton_trace_dump() request lifecycle trace
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--INI--
+ton_client.trace=1
+--FILE--
+<?php
+function trace_lines($id) {
+	$lines = [];
+	foreach (explode("\n", ton_trace_dump()) as $line) {
+		if (preg_match('/request (\d+)\s+(\w+)\s+(.*)$/', $line, $m) && (int) $m[1] === $id) {
+			$lines[] = $m[2] . ' ' . preg_replace('/lag_us=[\d.]+/', 'lag_us=*', trim($m[3]));
+		}
+	}
+	return $lines;
+}
+
+$context = json_decode(ton_create_context('{"mock_callbacks":2}'), true)['result'];
+$request = TonRequest::start($context, 'mock.run', '{}');
+while ($request->next(5000));
+$id = $request->id();
+unset($request);
+$lines = trace_lines($id);
+var_dump(strpos($lines[0], 'start context=') === 0);
+$lines = array_slice($lines, 1);
+sort($lines);
+print_r($lines);
+
+var_dump(strpos(ton_trace_dump(), '# ton_client trace: ') === 0);
+var_dump(substr_count(ton_trace_dump(1), "\n"));
+var_dump(ton_trace_dump(-1));
+
+ini_set('ton_client.trace', '0');
+$request = TonRequest::start($context, 'mock.run', '{}');
+while ($request->next(5000));
+$id = $request->id();
+unset($request);
+var_dump(trace_lines($id));
+ton_destroy_context($context);
+?>
+--EXPECT--
+bool(true)
+Array
+(
+    [0] => dequeue lag_us=*
+    [1] => dequeue lag_us=*
+    [2] => enqueue status=0 finished=0 queue=ok
+    [3] => enqueue status=0 finished=1 queue=ok
+    [4] => free fetched=2
+)
+bool(true)
+int(2)
+NULL
+array(0) {
+}
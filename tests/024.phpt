@@ -0,0 +1,67 @@
+--TEST--
+ton_request_cancel() frees the queued events right away
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+function wait_queued($request, $count) {
+	$end = microtime(true) + 5;
+	while (ton_request_timings($request)['last_event_us'] === null ||
+		   ton_client_stats()['events_received'] < $count) {
+		if (microtime(true) > $end) {
+			return false;
+		}
+		usleep(1000);
+	}
+	return true;
+}
+
+// subscription-like requests, never finished until the context is destroyed
+$context = json_decode(ton_create_context('{"mock_callbacks":3,"mock_finish":2}'), true)['result'];
+$before = ton_client_stats();
+
+$request = ton_request_start($context, 'mock.run', '{}');
+var_dump(wait_queued($request, $before['events_received'] + 3));
+$queued = ton_client_stats()['queued_events'];
+var_dump(ton_request_cancel($request));
+var_dump($queued - ton_client_stats()['queued_events']);
+var_dump(ton_request_next($request, 0));
+var_dump(is_ton_request_finished($request));
+var_dump(ton_request_cancel($request));
+
+$other = ton_request_start($context, 'mock.run', '{}');
+var_dump(ton_request_join($request, $other));
+
+// released handle is cancelled automatically
+var_dump(wait_queued($other, $before['events_received'] + 6));
+$queued = ton_client_stats()['queued_events'];
+unset($other);
+var_dump($queued - ton_client_stats()['queued_events']);
+
+$object = TonRequest::start($context, 'mock.run', '{}');
+var_dump($object->cancel(), $object->next(0), $object->cancel());
+
+$after = ton_client_stats();
+var_dump($after['requests_cancelled'] - $before['requests_cancelled']);
+var_dump($after['requests_abandoned'] - $before['requests_abandoned']);
+var_dump(ton_request_cancel('foo'));
+ton_destroy_context($context);
+?>
+--EXPECT--
+bool(true)
+bool(true)
+int(3)
+NULL
+bool(false)
+bool(false)
+bool(false)
+bool(true)
+int(3)
+bool(true)
+NULL
+bool(false)
+int(3)
+int(1)
+bool(false)
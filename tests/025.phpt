@@ -0,0 +1,75 @@
+--TEST--
+Abandoned requests are freed once their final event is received
+--SKIPIF--
+<?php
+require __DIR__ . '/skipif.inc';
+?>
+--FILE--
+<?php
+function wait_abandoned($count) {
+	$end = microtime(true) + 5;
+	while (ton_client_stats()['requests_abandoned'] != $count) {
+		if (microtime(true) > $end) {
+			return false;
+		}
+		usleep(1000);
+	}
+	return true;
+}
+
+$context = json_decode(ton_create_context('{"mock_callbacks":2}'), true)['result'];
+$before = ton_client_stats()['requests_abandoned'];
+
+$requests = [];
+for ($i = 0; $i < 10; $i++) {
+	$requests[] = ton_request_start($context, 'mock.run', ['mock_delay_us' => 100000]);
+}
+$requests[] = TonRequest::start($context, 'mock.run', ['mock_delay_us' => 100000]);
+$requests = [];
+var_dump(ton_client_stats()['requests_abandoned'] - $before);
+var_dump(wait_abandoned($before));
+
+// never finished until the context is destroyed
+$request = ton_request_start($context, 'mock.run', ['mock_finish' => 2]);
+unset($request);
+var_dump(ton_client_stats()['requests_abandoned'] - $before);
+ton_destroy_context($context);
+var_dump(wait_abandoned($before));
+
+// released after the final event is received
+$context = json_decode(ton_create_context('{"mock_callbacks":2}'), true)['result'];
+$request = ton_request_start($context, 'mock.run', '{}');
+ton_request_wait_all([$request], 5000);
+var_dump(is_ton_request_finished($request));
+while (ton_request_next($request, 5000));
+var_dump(is_ton_request_finished($request));
+unset($request);
+var_dump(ton_client_stats()['requests_abandoned'] - $before);
+
+// released after the final event is received, while the request joined to it keeps delivering
+$target = ton_request_start($context, 'mock.run', '{}');
+while (ton_request_next($target, 5000));
+$source = ton_request_start($context, 'mock.run',
+	['mock_delay_us' => 50000, 'mock_burst' => 1, 'mock_interval_us' => 50000]);
+var_dump(ton_request_join($target, $source));
+unset($target);
+var_dump(ton_client_stats()['requests_abandoned'] - $before);
+var_dump(ton_request_wait_all([$source], 5000));
+var_dump(is_ton_request_finished($source));
+unset($source);
+var_dump(wait_abandoned($before));
+ton_destroy_context($context);
+?>
+--EXPECT--
+int(11)
+bool(true)
+int(1)
+bool(true)
+bool(false)
+bool(true)
+int(0)
+bool(true)
+int(0)
+bool(true)
+bool(true)
+bool(true)